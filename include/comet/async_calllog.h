@@ -0,0 +1,972 @@
+/** \file
+  * Call logging that writes on a background thread.
+  *
+  * See \ref cometasynccalllog.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_ASYNC_CALLLOG_H
+#define COMET_ASYNC_CALLLOG_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // raise_exception
+#include <comet/handle.h> // auto_handle
+#include <comet/handle_except.h> // source_info_t
+#include <comet/module.h> // module, impl::cmd_t
+#include <comet/threading.h> // critical_section, thread
+#include <comet/tstring.h>
+
+#include <algorithm> // copy, find, stable_sort
+#include <vector>
+
+/** \page cometasynccalllog Asynchronous call logging
+    async_call_logger_t implements the call logger concept (see
+    \ref cometcalllogging) without writing on the calling thread.
+
+    Each thread that logs gets its own ring of fixed-size records, which
+    only it writes to and only the logger's background thread reads from,
+    so logging a call takes no lock and makes no system call.  A record
+    holds the time, the thread and the text of the call: interface,
+    method, arguments and return value, cut short if they don't fit.
+
+    The background thread wakes every COMET_CALLLOG_INTERVAL milliseconds,
+    or sooner if a ring is half full.  It takes the records from every
+    ring, puts them in time order and writes them to the stream, flushing
+    it once per batch rather than once per line:
+
+    \verbatim
+        0.001234 [2468] In  IFoo::Bar(42)
+        0.001240 [2468] Out IFoo::Bar returned 'x'
+    \endverbatim
+
+    If a thread logs faster than the background thread drains its ring,
+    the records that don't fit are dropped and a line saying how many
+    takes their place.  The cost of a call is therefore bounded whatever
+    the stream does.
+
+    Like stream_call_logger_t, it is given a class whose `create()` makes
+    the stream:
+
+    \code
+        template<>
+        struct call_logger_<true> : async_call_logger_t<tofstream_comet>
+        {
+        };
+    \endcode
+
+    This is what COMET_LOGFILE uses unless COMET_LOGFILE_SYNC is defined.
+
+    The log is written out when the module shuts down.  If the process is
+    ending and the background thread has already gone, the records are
+    written by the thread shutting down instead.  Calls logged after that
+    are ignored.
+
+    The background thread holds a reference to the module whose code it
+    runs, so the module can't be unloaded while the thread is running.  It
+    exits after COMET_CALLLOG_WRITER_IDLE milliseconds with nothing to write,
+    releasing the reference, and the next call logged starts it again.  A
+    DLL that has logged can therefore be unloaded once it has been quiet for
+    that long.
+*/
+
+/**
+ * Records in each thread's ring.
+ */
+#ifndef COMET_CALLLOG_RING_SIZE
+#define COMET_CALLLOG_RING_SIZE 256
+#endif
+
+/**
+ * Characters of text a record can hold.  Longer calls are cut short.
+ */
+#ifndef COMET_CALLLOG_RECORD_CHARS
+#define COMET_CALLLOG_RECORD_CHARS 240
+#endif
+
+/**
+ * Milliseconds between writes.
+ */
+#ifndef COMET_CALLLOG_INTERVAL
+#define COMET_CALLLOG_INTERVAL 100
+#endif
+
+/**
+ * Milliseconds with nothing to write after which the background thread
+ * exits.  The next call logged starts another.
+ */
+#ifndef COMET_CALLLOG_WRITER_IDLE
+#define COMET_CALLLOG_WRITER_IDLE 1000
+#endif
+
+/**
+ * Milliseconds shutdown waits for the last write.
+ */
+#ifndef COMET_CALLLOG_SHUTDOWN_TIMEOUT
+#define COMET_CALLLOG_SHUTDOWN_TIMEOUT 2000
+#endif
+
+namespace comet {
+
+    namespace impl {
+
+        enum call_record_kind
+        {
+            call_record_in,
+            call_record_out,
+            call_record_error
+        };
+
+        /** Logged call as it waits in a ring.
+         * \internal
+         */
+        struct call_record
+        {
+            enum { field_count = 4 };
+
+            LONGLONG time;
+            DWORD thread_id;
+            unsigned short kind;
+            unsigned short truncated; ///< Bit for each field cut short.
+            unsigned short lengths[field_count];
+            TCHAR text[COMET_CALLLOG_RECORD_CHARS];
+
+            /// Copy in as much of each field as fits, first field first.
+            void assign(
+                call_record_kind record_kind, const tstring& first,
+                const tstring& second, const tstring& third,
+                const tstring& fourth)
+            {
+                const tstring* fields[field_count] =
+                    { &first, &second, &third, &fourth };
+
+                kind = static_cast<unsigned short>(record_kind);
+                truncated = 0;
+
+                size_t used = 0;
+                for (size_t i = 0; i < field_count; ++i)
+                {
+                    size_t length = fields[i]->size();
+                    if (length > COMET_CALLLOG_RECORD_CHARS - used)
+                    {
+                        length = COMET_CALLLOG_RECORD_CHARS - used;
+                        truncated = static_cast<unsigned short>(
+                            truncated | (1 << i));
+                    }
+
+                    std::copy(
+                        fields[i]->data(), fields[i]->data() + length,
+                        text + used);
+                    lengths[i] = static_cast<unsigned short>(length);
+                    used += length;
+                }
+            }
+        };
+
+        /** Records logged by one thread, waiting to be written.
+         * Written only by that thread and read only by the log's
+         * background thread.
+         * \internal
+         */
+        class call_ring
+        {
+        public:
+            static const unsigned long capacity = COMET_CALLLOG_RING_SIZE;
+
+            call_ring(DWORD thread_id, HANDLE thread)
+                : head_(0), tail_(0), dropped_(0), thread_id_(thread_id),
+                  thread_(auto_attach(thread)),
+                  records_(COMET_CALLLOG_RING_SIZE) {}
+
+            /// Free record to fill, or NULL if the ring is full.
+            call_record* next()
+            {
+                if (pending() == capacity)
+                {
+                    InterlockedIncrement(&dropped_);
+                    return NULL;
+                }
+                return &records_[static_cast<unsigned long>(head_) % capacity];
+            }
+
+            /**
+             * Hand the record from next() to the reader.
+             * Returns true if the reader should be woken early.
+             */
+            bool publish()
+            {
+                InterlockedExchange(
+                    &head_, static_cast<long>(
+                        static_cast<unsigned long>(head_) + 1));
+                return pending() == capacity / 2;
+            }
+
+            /// Number of records waiting.
+            unsigned long pending() const
+            {
+                return static_cast<unsigned long>(head_) -
+                    static_cast<unsigned long>(tail_);
+            }
+
+            /// `index`th waiting record.
+            const call_record& at(unsigned long index) const
+            {
+                return records_[
+                    (static_cast<unsigned long>(tail_) + index) % capacity];
+            }
+
+            /// Give the oldest `count` records back to the writer.
+            void consume(unsigned long count)
+            {
+                InterlockedExchange(
+                    &tail_, static_cast<long>(
+                        static_cast<unsigned long>(tail_) + count));
+            }
+
+            /// Number of records dropped since the last call.
+            long take_dropped()
+            {
+                return InterlockedExchange(&dropped_, 0);
+            }
+
+            DWORD thread_id() const
+            {
+                return thread_id_;
+            }
+
+            /// Has the thread that writes to the ring ended?
+            bool orphaned() const
+            {
+                return ::WaitForSingleObject(thread_, 0) == WAIT_OBJECT_0;
+            }
+
+        private:
+            call_ring(const call_ring&);
+            call_ring& operator=(const call_ring&);
+
+            long volatile head_;
+            long volatile tail_;
+            long volatile dropped_;
+            DWORD thread_id_;
+            auto_handle thread_;
+            std::vector<call_record> records_;
+        };
+
+        /** Background thread that writes an owner's records.
+         * \internal
+         */
+        template<typename Owner> class call_log_writer
+        {
+        public:
+            explicit call_log_writer(Owner& owner) : owner_(owner), module_(0)
+            {}
+
+            /**
+             * Start a thread running the owner's run(), holding a reference
+             * to the module until it exits.
+             *
+             * \returns The thread's handle, or NULL if it couldn't start.
+             */
+            HANDLE start()
+            {
+                // Only one thread runs at a time, and it reads module_ as
+                // soon as it starts, so this can't overwrite it in use
+                HMODULE module = 0;
+                ::GetModuleHandleEx(
+                    GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                    reinterpret_cast<LPCTSTR>(&call_log_writer::in_module),
+                    &module);
+                module_ = module;
+
+                DWORD id;
+                HANDLE thread = ::CreateThread(
+                    0, 0, &call_log_writer::thread_proc, this, 0, &id);
+                if (!thread && module)
+                {
+                    DWORD error = ::GetLastError();
+                    ::FreeLibrary(module);
+                    ::SetLastError(error);
+                }
+                return thread;
+            }
+
+        private:
+            static DWORD WINAPI thread_proc(void* param)
+            {
+                call_log_writer* writer = static_cast<call_log_writer*>(param);
+                HMODULE module = writer->module_;
+                writer->owner_.run();
+
+                // The module can't be unloaded until this thread has left
+                // its code
+                if (module)
+                    ::FreeLibraryAndExitThread(module, 0);
+                return 0;
+            }
+
+            /// Marks the module the writer's code is in.
+            static void in_module() {}
+
+            call_log_writer(const call_log_writer&);
+            call_log_writer& operator=(const call_log_writer&);
+
+            Owner& owner_;
+            HMODULE module_;
+        };
+
+        class async_call_log;
+
+        /** Closes a log at module shutdown.
+         * \internal
+         */
+        struct call_log_closer : public cmd_t
+        {
+            explicit call_log_closer(async_call_log* log) : log_(log) {}
+            void cmd();
+
+        private:
+            async_call_log* log_;
+            call_log_closer(const call_log_closer&);
+            call_log_closer& operator=(const call_log_closer&);
+        };
+
+        /** Rings of records and the thread that writes them to a stream.
+         *
+         * The log itself is never deleted, so a pointer to it can be read
+         * without a lock.  What it logs to is reference-counted instead:
+         * opening the log holds one reference, each call to log() or
+         * flush() holds one while it runs and the background thread holds
+         * one while it is running.  The stream and rings are freed with the
+         * last reference once the log is closed, and nothing can take a
+         * reference after that.
+         *
+         * The background thread exits when there has been nothing to write
+         * for COMET_CALLLOG_WRITER_IDLE milliseconds, releasing its
+         * reference to the module, and the next call logged starts another.
+         * \internal
+         */
+        class async_call_log
+        {
+        public:
+            /// Logs nothing until open() is called.
+            async_call_log()
+                : stream_(0), refs_(0), writing_(0), stopping_(false),
+                  failed_(false), flush_requests_(0), flushed_(0),
+                  tls_(::TlsAlloc()),
+                  wake_(auto_attach(::CreateEvent(0, false, false, 0))),
+                  flushed_event_(auto_attach(::CreateEvent(0, true, false, 0))),
+                  drained_(auto_attach(::CreateEvent(0, true, false, 0))),
+                  writer_(*this)
+            {
+                LARGE_INTEGER now;
+                ::QueryPerformanceCounter(&now);
+                start_ = now.QuadPart;
+
+                LARGE_INTEGER frequency;
+                ::QueryPerformanceFrequency(&frequency);
+                frequency_ = static_cast<double>(frequency.QuadPart);
+            }
+
+            /// Only ever called on a log that was never opened.
+            ~async_call_log()
+            {
+                destroy();
+            }
+
+            /**
+             * Start logging to `stream`, which is deleted with the log's
+             * last reference.
+             *
+             * \returns false, leaving `stream` to the caller, if the log
+             *          couldn't get the resources it needs.
+             */
+            bool open(tostream* stream)
+            {
+                if (tls_ == TLS_OUT_OF_INDEXES || !wake_ || !flushed_event_ ||
+                    !drained_)
+                    return false;
+
+                stream_ = stream;
+                stream_->setf(std::ios::fixed, std::ios::floatfield);
+                stream_->precision(6);
+
+                // The reference dropped by close()
+                InterlockedExchange(&refs_, 1);
+                return true;
+            }
+
+            /**
+             * Write what has been logged and stop logging.
+             *
+             * Only waits for the background thread to finish writing, not
+             * to exit, so it is safe in DllMain.  If the writing doesn't
+             * finish in time the stream and rings are left to the
+             * background thread rather than freed from under it.
+             */
+            void close()
+            {
+                bool claimed;
+                HANDLE thread;
+                {
+                    auto_cs lock(cs_);
+                    stopping_ = true;
+                    claimed = InterlockedCompareExchange(&writing_, 1, 0) == 0;
+                    thread = writer_thread_.get();
+                }
+
+                if (claimed)
+                {
+                    // No background thread, and now none can start
+                    write_batch();
+                }
+                else
+                {
+                    ::SetEvent(wake_.get());
+
+                    HANDLE handles[2] = { drained_.get(), thread };
+                    DWORD result = ::WaitForMultipleObjects(
+                        2, handles, FALSE, COMET_CALLLOG_SHUTDOWN_TIMEOUT);
+                    if (result == WAIT_OBJECT_0 + 1)
+                    {
+                        // Killed by the end of the process
+                        write_batch();
+                    }
+                    else if (result != WAIT_OBJECT_0)
+                    {
+                        return;
+                    }
+                }
+
+                release();
+            }
+
+            /// Is the log open and the stream still writable?
+            bool good() const
+            {
+                return refs_ != 0 && !failed_;
+            }
+
+            /// Record a call on the calling thread's ring.  Never throws.
+            void log(
+                call_record_kind kind, const tstring& first,
+                const tstring& second, const tstring& third,
+                const tstring& fourth)
+            {
+                if (!acquire())
+                    return;
+
+                call_ring* ring = this_thread_ring();
+                call_record* record = (ring) ? ring->next() : NULL;
+                if (record)
+                {
+                    LARGE_INTEGER now;
+                    ::QueryPerformanceCounter(&now);
+                    record->time = now.QuadPart;
+                    record->thread_id = ring->thread_id();
+                    record->assign(kind, first, second, third, fourth);
+
+                    // Publishing before looking at writing_ means either we
+                    // see the writer or it sees our record
+                    bool half_full = ring->publish();
+                    if (!start_writer() && half_full)
+                        ::SetEvent(wake_.get());
+                }
+
+                release();
+            }
+
+            /// Wait until everything logged so far has been written.
+            void flush()
+            {
+                if (!acquire())
+                    return;
+
+                long request = InterlockedIncrement(&flush_requests_);
+                while (flushed_ - request < 0 && !failed_ && !stopping_)
+                {
+                    if (!start_writer())
+                    {
+                        // Try again in case the thread was just exiting
+                        if (writing_ == 0 && !start_writer() && writing_ == 0)
+                            break; // the background thread can't start
+                        ::SetEvent(wake_.get());
+                    }
+
+                    ::WaitForSingleObject(
+                        flushed_event_.get(), COMET_CALLLOG_INTERVAL);
+                    ::ResetEvent(flushed_event_.get());
+                }
+
+                release();
+            }
+
+        private:
+            typedef call_log_writer<async_call_log> writer_type;
+            friend class call_log_writer<async_call_log>;
+
+            /// Take a reference unless the log is closed.
+            bool acquire()
+            {
+                for (;;)
+                {
+                    long refs = refs_;
+                    if (refs == 0)
+                        return false;
+                    if (InterlockedCompareExchange(
+                            &refs_, refs + 1, refs) == refs)
+                        return true;
+                }
+            }
+
+            void release()
+            {
+                if (InterlockedDecrement(&refs_) == 0)
+                    destroy();
+            }
+
+            /// Free the stream and rings.  Nothing else can be using them.
+            void destroy()
+            {
+                for (size_t i = 0; i < rings_.size(); ++i)
+                    delete rings_[i];
+                rings_.clear();
+
+                delete stream_;
+                stream_ = 0;
+
+                if (tls_ != TLS_OUT_OF_INDEXES)
+                    ::TlsFree(tls_);
+                tls_ = TLS_OUT_OF_INDEXES;
+
+                writer_thread_.close();
+            }
+
+            /**
+             * Start the background thread unless it is running, the log is
+             * closing or the caller, who must hold a reference, can't.
+             *
+             * writing_ is only set under cs_ so that close() can tell
+             * whether a background thread is running.
+             *
+             * \returns true if this call started the thread.
+             */
+            bool start_writer()
+            {
+                if (writing_ != 0)
+                    return false;
+
+                auto_cs lock(cs_);
+                if (stopping_ ||
+                    InterlockedCompareExchange(&writing_, 1, 0) != 0)
+                    return false;
+
+                // The thread's own reference, released as run() ends
+                InterlockedIncrement(&refs_);
+
+                HANDLE thread = writer_.start();
+                if (!thread)
+                {
+                    InterlockedExchange(&writing_, 0);
+                    InterlockedDecrement(&refs_);
+                    return false;
+                }
+
+                writer_thread_ = auto_attach(thread);
+                return true;
+            }
+
+            /**
+             * Background thread's loop.  Ends by releasing the thread's
+             * reference, after which nothing of the log may be touched.
+             */
+            void run()
+            {
+                DWORD idle = 0;
+                for (;;)
+                {
+                    // Read first, so the batch covers everything logged
+                    // before the request
+                    bool stopping = stopping_;
+                    long requests = flush_requests_;
+
+                    bool wrote = write_batch();
+
+                    InterlockedExchange(&flushed_, requests);
+                    ::SetEvent(flushed_event_.get());
+
+                    if (stopping)
+                    {
+                        ::SetEvent(drained_.get());
+                        break;
+                    }
+
+                    idle = (wrote) ? 0 : idle + COMET_CALLLOG_INTERVAL;
+                    if (idle >= COMET_CALLLOG_WRITER_IDLE && !keep_writing())
+                        break;
+
+                    ::WaitForSingleObject(
+                        wake_.get(), COMET_CALLLOG_INTERVAL);
+                }
+
+                release();
+            }
+
+            /**
+             * Give up writing unless there is something new to write.
+             *
+             * \returns true if the background thread should carry on.
+             */
+            bool keep_writing()
+            {
+                {
+                    auto_cs lock(cs_);
+                    if (stopping_)
+                        return true;
+                    InterlockedExchange(&writing_, 0);
+                }
+
+                // Looking at the rings after clearing writing_ means either
+                // we see a new record or its thread sees writing_ clear
+                if (!has_work())
+                    return false;
+
+                // Unless a logging thread has already started another
+                // background thread, or close() is writing instead
+                auto_cs lock(cs_);
+                return InterlockedCompareExchange(&writing_, 1, 0) == 0;
+            }
+
+            /// Are records or flush requests waiting?
+            bool has_work() const
+            {
+                if (flushed_ != flush_requests_)
+                    return true;
+
+                auto_cs lock(cs_);
+                for (size_t i = 0; i < rings_.size(); ++i)
+                {
+                    if (rings_[i]->pending() != 0)
+                        return true;
+                }
+                return false;
+            }
+
+            call_ring* this_thread_ring()
+            {
+                call_ring* ring = static_cast<call_ring*>(::TlsGetValue(tls_));
+                if (ring)
+                    return ring;
+
+                try
+                {
+                    HANDLE thread;
+                    if (!::DuplicateHandle(
+                            ::GetCurrentProcess(), ::GetCurrentThread(),
+                            ::GetCurrentProcess(), &thread, SYNCHRONIZE,
+                            FALSE, 0))
+                        return NULL;
+
+                    ring = new call_ring(::GetCurrentThreadId(), thread);
+                    {
+                        auto_cs lock(cs_);
+                        rings_.push_back(ring);
+                    }
+                    ::TlsSetValue(tls_, ring);
+                    return ring;
+                }
+                catch (...)
+                {
+                    // Logging mustn't fail the call being logged
+                    delete ring;
+                    return NULL;
+                }
+            }
+
+            /**
+             * Write every waiting record in time order, then flush.
+             * \returns false if there was nothing to write.
+             */
+            bool write_batch()
+            {
+                std::vector<call_ring*> rings;
+                {
+                    auto_cs lock(cs_);
+                    rings = rings_;
+                }
+
+                batch_.clear();
+                bool wrote = false;
+                std::vector<unsigned long> taken(rings.size());
+                for (size_t i = 0; i < rings.size(); ++i)
+                {
+                    long dropped = rings[i]->take_dropped();
+                    if (dropped != 0)
+                    {
+                        wrote = true;
+                        *stream_ << _T("[") << rings[i]->thread_id()
+                                 << _T("] Dropped ") << dropped
+                                 << _T(" calls") << _T('\n');
+                    }
+
+                    taken[i] = rings[i]->pending();
+                    for (unsigned long j = 0; j < taken[i]; ++j)
+                        batch_.push_back(&rings[i]->at(j));
+                }
+
+                // Each ring is already in order, so this only interleaves
+                std::stable_sort(batch_.begin(), batch_.end(), earlier);
+
+                for (size_t i = 0; i < batch_.size(); ++i)
+                    format(*batch_[i]);
+                wrote = wrote || !batch_.empty();
+
+                stream_->flush();
+                if (!stream_->good())
+                    failed_ = true;
+
+                for (size_t i = 0; i < rings.size(); ++i)
+                    rings[i]->consume(taken[i]);
+
+                remove_orphans(rings);
+                return wrote;
+            }
+
+            /// Delete the rings of threads that have ended, once empty.
+            void remove_orphans(const std::vector<call_ring*>& rings)
+            {
+                for (size_t i = 0; i < rings.size(); ++i)
+                {
+                    // Check the thread has gone before that the ring is
+                    // empty, or a last record could be missed
+                    if (!rings[i]->orphaned() || rings[i]->pending() != 0)
+                        continue;
+
+                    {
+                        auto_cs lock(cs_);
+                        rings_.erase(
+                            std::find(rings_.begin(), rings_.end(), rings[i]));
+                    }
+                    delete rings[i];
+                }
+            }
+
+            static bool earlier(const call_record* a, const call_record* b)
+            {
+                return a->time < b->time;
+            }
+
+            /// Write one line in the style of stream_call_logger_t.
+            void format(const call_record& record)
+            {
+                tostream& os = *stream_;
+                os << (record.time - start_) / frequency_
+                   << _T(" [") << record.thread_id << _T("] ");
+
+                switch (record.kind)
+                {
+                case call_record_in:
+                    os << _T("In  ");
+                    field(record, 0);
+                    os << _T("::");
+                    field(record, 1);
+                    os << _T("(");
+                    field(record, 2);
+                    os << _T(")");
+                    break;
+
+                case call_record_out:
+                    os << _T("Out ");
+                    field(record, 0);
+                    os << _T("::");
+                    field(record, 1);
+                    if (!empty(record, 2))
+                    {
+                        os << _T("(");
+                        field(record, 2);
+                        os << _T(")");
+                    }
+                    if (!empty(record, 3))
+                    {
+                        os << _T(" returned ");
+                        field(record, 3);
+                    }
+                    break;
+
+                case call_record_error:
+                    os << _T("Err ");
+                    field(record, 0);
+                    if (!empty(record, 2))
+                    {
+                        os << _T(" ");
+                        field(record, 1);
+                        os << _T(": ");
+                        field(record, 2);
+                    }
+                    break;
+                }
+
+                os << _T('\n');
+            }
+
+            static bool empty(const call_record& record, size_t index)
+            {
+                return record.lengths[index] == 0 &&
+                    !(record.truncated & (1 << index));
+            }
+
+            void field(const call_record& record, size_t index)
+            {
+                size_t offset = 0;
+                for (size_t i = 0; i < index; ++i)
+                    offset += record.lengths[i];
+
+                stream_->write(record.text + offset, record.lengths[index]);
+                if (record.truncated & (1 << index))
+                    *stream_ << _T("...");
+            }
+
+            async_call_log(const async_call_log&);
+            async_call_log& operator=(const async_call_log&);
+
+            tostream* stream_;
+            LONGLONG start_;
+            double frequency_;
+
+            long volatile refs_;
+            long volatile writing_; ///< Set while a thread owns the stream.
+            volatile bool stopping_;
+            volatile bool failed_;
+            long volatile flush_requests_;
+            long volatile flushed_;
+
+            DWORD tls_;
+            critical_section cs_;
+            std::vector<call_ring*> rings_;
+            std::vector<const call_record*> batch_;
+
+            auto_handle wake_;
+            auto_handle flushed_event_;
+            auto_handle drained_;
+            auto_handle writer_thread_;
+            writer_type writer_;
+        };
+
+        inline void call_log_closer::cmd()
+        {
+            log_->close();
+        }
+    }
+
+    /*!\addtogroup CallLog
+     */
+    //@{
+
+    /** \struct async_call_logger_t async_calllog.h comet/async_calllog.h
+      * Log calls to a tostream from a background thread.
+      * See \ref cometasynccalllog.
+      * \param CREATESTREAM Class with a static function \p create() that
+      *        returns a <b> tostream * </b>, or NULL to disable logging.
+      * \sa stream_call_logger_t call_logger_
+      */
+    template<typename CREATESTREAM>
+    struct async_call_logger_t
+#ifdef COMET_DOXYGEN // For documentation
+        : call_logger_
+#endif
+    {
+        static inline bool can_log_call()
+        {
+            impl::async_call_log* log = logger();
+            return log != NULL && log->good();
+        }
+        static inline bool can_log_return() { return can_log_call(); }
+        static inline bool can_log_exception() { return can_log_call(); }
+
+        // The log may have been closed since can_log_call() was asked, in
+        // which case the call is dropped
+        static inline void log_call(
+            const tstring& iface, const tstring& funcname, const tstring& log)
+        {
+            impl::async_call_log* call_log = logger();
+            if (call_log)
+                call_log->log(
+                    impl::call_record_in, iface, funcname, log, tstring());
+        }
+
+        static inline void log_return(
+            const tstring& iface, const tstring& funcname, const tstring& log,
+            const tstring& retval)
+        {
+            impl::async_call_log* call_log = logger();
+            if (call_log)
+                call_log->log(
+                    impl::call_record_out, iface, funcname, log, retval);
+        }
+
+        static inline void log_exception(
+            const tstring& type, const tstring& desc,
+            const source_info_t& errorSource, const source_info_t& callSource)
+        {
+            COMET_NOTUSED(errorSource);
+            impl::async_call_log* call_log = logger();
+            if (call_log)
+                call_log->log(
+                    impl::call_record_error, callSource.source().t_str(),
+                    type, desc, tstring());
+        }
+
+        /// Wait until everything logged so far has been written.
+        static void flush()
+        {
+            impl::async_call_log* log = logger();
+            if (log)
+                log->flush();
+        }
+
+    protected:
+        // The log, created on first use.  Logs nothing if there is no
+        // stream.  Never deleted, so safe to use after it has been closed.
+        static impl::async_call_log* logger()
+        {
+            static impl::async_call_log* volatile log_ = NULL;
+
+            impl::async_call_log* log = log_;
+            if (log)
+                return log;
+
+            try
+            {
+                impl::async_call_log* created = new impl::async_call_log();
+                log = impl::publish_once(log_, created);
+                if (log != created)
+                    return log;
+
+                // Calls logged by other threads before the stream is open
+                // are lost
+                tostream* stream = CREATESTREAM::create();
+                if (stream && !log->open(stream))
+                    delete stream;
+                else if (stream)
+                    module().add_object_to_dispose(
+                        new impl::call_log_closer(log));
+            }
+            catch (...) {}
+            return log;
+        }
+    };
+
+    //@}
+}
+
+#endif
@@ -0,0 +1,736 @@
+/** \file
+  * Asynchronous delivery of connection point events.
+  *
+  * See \ref cometasyncevents.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_ASYNC_CP_H
+#define COMET_ASYNC_CP_H
+
+#include <comet/config.h>
+
+#include <comet/cp.h> // connection_point_impl
+#include <comet/handle.h> // auto_handle
+#include <comet/ptr.h>
+#include <comet/threading.h> // critical_section, thread
+
+#include <algorithm> // max
+#include <climits> // LONG_MAX
+#include <deque>
+#include <map>
+#include <memory> // auto_ptr
+#include <stdexcept> // invalid_argument
+#include <vector>
+
+/** \page cometasyncevents Asynchronous events
+    Firing an event through a connection point calls every sink in turn on
+    the firing thread, so one slow or out-of-process sink holds up the
+    object raising the event.  async_event_firer instead queues each event
+    for each sink and returns at once.  A pool of worker threads delivers
+    the queued events, at most one call at a time per sink so that each
+    sink still sees its events in order.
+
+    An event is a function object that makes the call on a sink:
+
+    \code
+        struct on_changed
+        {
+            explicit on_changed(long value) : value(value) {}
+            HRESULT operator()(IFooEvents* sink) const
+            { return sink->OnChanged(value); }
+            long value;
+        };
+
+        async_event_firer<IFooEvents> firer(
+            connection_point_for<IFooEvents>::connection_point);
+        firer.fire(on_changed(42));
+    \endcode
+
+    Each sink has a queue of bounded length.  What happens when it is full
+    is set by event_overflow_policy.  The producer never waits for a sink
+    unless event_overflow_block is chosen.
+
+    Events that only report the latest state, such as property changes,
+    can be given a key and coalesced:
+
+    \code
+        firer.coalesce_within(50);
+        firer.fire(on_property_changed(DISPID_VALUE), DISPID_VALUE);
+    \endcode
+
+    A keyed event then waits up to 50ms before delivery, and later events
+    with the same key fired meanwhile replace it.  Each sink gets at most
+    one event per key per window and always gets the latest one.  The
+    latest event takes its place in the queue by when it was fired, so a
+    sink never sees it ahead of events fired before it.
+
+    The workers join the multithreaded apartment, so the sinks must be
+    callable from the MTA.  This is the case when the connection point lives
+    in the MTA, which is also when asynchronous firing is worthwhile.
+*/
+
+namespace comet {
+
+    /*! \addtogroup Interfaces
+     */
+    //@{
+
+    /// What async_event_firer does with an event for a sink whose queue is
+    /// full.
+    enum event_overflow_policy
+    {
+        /// Discard the new event.
+        event_overflow_drop,
+
+        /// Replace the newest queued event with the same key, or discard
+        /// the oldest queued event if none has the key.  The replacement
+        /// moves to the back of the queue, behind events fired before it.
+        event_overflow_coalesce,
+
+        /// Wait until the sink's queue has room.
+        event_overflow_block
+    };
+
+    /// Delivery statistics for one sink of an async_event_firer.
+    struct event_sink_metrics
+    {
+        DWORD cookie;
+        size_t queue_depth;         ///< Events waiting now.
+        size_t max_queue_depth;     ///< Most events ever waiting at once.
+        ULONGLONG delivered;        ///< Calls that succeeded.
+        ULONGLONG failed;           ///< Calls that returned a failure.
+        ULONGLONG dropped;          ///< Events discarded on overflow.
+        ULONGLONG coalesced;        ///< Events merged into a queued one.
+        ULONGLONG total_latency_us; ///< Sum of queueing plus call times.
+        ULONGLONG max_latency_us;   ///< Longest queueing plus call time.
+    };
+
+    //@}
+
+    namespace impl {
+
+        /** Event shared by the queues of all the sinks it is fired at.
+         * \internal
+         */
+        template<typename Itf> class async_event
+        {
+        public:
+            async_event() : rc_(1) {}
+            virtual ~async_event() {}
+
+            virtual HRESULT deliver(Itf* sink) = 0;
+
+            void add_ref() { InterlockedIncrement(&rc_); }
+            void release() { if (InterlockedDecrement(&rc_) == 0) delete this; }
+
+        private:
+            async_event(const async_event&);
+            async_event& operator=(const async_event&);
+
+            long rc_;
+        };
+
+        template<typename Itf, typename F>
+        class async_event_t : public async_event<Itf>
+        {
+        public:
+            explicit async_event_t(const F& call) : call_(call) {}
+
+            HRESULT deliver(Itf* sink) { return call_(sink); }
+
+        private:
+            F call_;
+        };
+
+        template<typename Itf> struct queued_event
+        {
+            async_event<Itf>* event;
+            DWORD key;
+            LONGLONG queued_at;
+            LONGLONG due_at; ///< Held back for coalescing until then.
+        };
+
+        template<typename Itf> struct async_sink
+        {
+            async_sink(DWORD cookie, const com_ptr<Itf>& sink)
+                : sink(sink), scheduled(false), connected(true), generation(0)
+            {
+                metrics.cookie = cookie;
+                metrics.queue_depth = 0;
+                metrics.max_queue_depth = 0;
+                metrics.delivered = 0;
+                metrics.failed = 0;
+                metrics.dropped = 0;
+                metrics.coalesced = 0;
+                metrics.total_latency_us = 0;
+                metrics.max_latency_us = 0;
+            }
+
+            ~async_sink()
+            {
+                for (size_t i = 0; i < queue.size(); ++i)
+                    queue[i].event->release();
+            }
+
+            com_ptr<Itf> sink;
+            std::deque< queued_event<Itf> > queue;
+            bool scheduled; ///< In the ready list or being delivered to.
+            bool connected; ///< Still in the source's sinks.
+            unsigned long generation;
+            event_sink_metrics metrics;
+        };
+
+        inline LONGLONG performance_counter()
+        {
+            LARGE_INTEGER now;
+            ::QueryPerformanceCounter(&now);
+            return now.QuadPart;
+        }
+
+        /** Worker thread that runs an owner's delivery loop.
+         * \internal
+         */
+        template<typename Owner> class async_event_worker : public thread
+        {
+        public:
+            explicit async_event_worker(Owner& owner) : owner_(owner) {}
+
+        private:
+            DWORD thread_main()
+            {
+                HRESULT hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+                owner_.run();
+                if (SUCCEEDED(hr))
+                    ::CoUninitialize();
+                return 0;
+            }
+
+            Owner& owner_;
+        };
+    }
+
+    /*! \addtogroup Interfaces
+     */
+    //@{
+
+    /** \class async_event_firer  async_cp.h comet/async_cp.h
+      * Fires events at the sinks of a connection point from a pool of worker
+      * threads.
+      *
+      * \param Itf Event interface.
+      * \param Source Provides the sinks.  Like connection_point_impl, which
+      *        is the default, it must have a sinks() method returning a
+      *        `sinks_snapshot`: a container of std::pair<DWORD, com_ptr<Itf> >
+      *        holding each sink's cookie and interface.
+      */
+    template<typename Itf, typename Source=connection_point_impl<Itf> >
+    class async_event_firer
+    {
+        typedef impl::async_sink<Itf> sink_type;
+        typedef std::map<DWORD, sink_type*> SINKS;
+
+    public:
+        /**
+         * Start the worker threads.
+         *
+         * \param source          Connection point whose sinks receive events.
+         *                        Must outlive the firer.
+         * \param worker_count    Number of delivery threads.
+         * \param queue_capacity  Most events waiting per sink.
+         * \param policy          What to do when a sink's queue is full.
+         */
+        explicit async_event_firer(
+            Source& source, size_t worker_count=2, size_t queue_capacity=1024,
+            event_overflow_policy policy=event_overflow_drop)
+            : source_(source), capacity_(queue_capacity), policy_(policy),
+              window_ticks_(0), stopping_(false), generation_(0),
+              next_due_(0)
+        {
+            if (worker_count == 0 || queue_capacity == 0)
+                throw std::invalid_argument(
+                    "async_event_firer needs a worker and a queue");
+
+            LARGE_INTEGER frequency;
+            ::QueryPerformanceFrequency(&frequency);
+            ticks_per_us_ = frequency.QuadPart / 1000000.0;
+
+            ready_signal_ = auto_attach(::CreateSemaphore(0, 0, LONG_MAX, 0));
+            space_signal_ = auto_attach(::CreateEvent(0, true, false, 0));
+            flush_timer_ = auto_attach(::CreateWaitableTimer(0, false, 0));
+            if (!ready_signal_ || !space_signal_ || !flush_timer_)
+                raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+            try
+            {
+                for (size_t i = 0; i < worker_count; ++i)
+                {
+                    workers_.push_back(new worker_type(*this));
+                    if (!workers_.back()->start())
+                        raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                }
+            }
+            catch (...)
+            {
+                stop();
+                throw;
+            }
+        }
+
+        /**
+         * Stop the workers once they finish their current calls.
+         * Events not yet delivered are discarded.
+         */
+        ~async_event_firer()
+        {
+            stop();
+        }
+
+        /**
+         * Queue an event for every sink currently connected.
+         *
+         * \param call  Function object taking `Itf*` and returning HRESULT.
+         *              Copied once and shared by all the sinks' queues.
+         * \param key   Identifies events that supersede one another, such
+         *              as changes to the same property, for
+         *              event_overflow_coalesce.  0 means never coalesce.
+         */
+        template<typename F>
+        void fire(const F& call, DWORD key=0)
+        {
+            typename Source::sinks_snapshot sinks = source_.sinks();
+
+            impl::async_event<Itf>* event =
+                new impl::async_event_t<Itf, F>(call);
+            try
+            {
+                auto_cs lock(cs_);
+                ++generation_;
+
+                for (typename Source::sinks_snapshot::const_iterator it =
+                         sinks.begin(); it != sinks.end(); ++it)
+                {
+                    sink_type* sink = find_or_add(it->first, it->second);
+                    sink->generation = generation_;
+                    enqueue(sink, event, key);
+                }
+
+                forget_disconnected();
+            }
+            catch (...)
+            {
+                event->release();
+                throw;
+            }
+            event->release();
+        }
+
+        /**
+         * Coalesce keyed events fired within a window of each other.
+         *
+         * Each keyed event is held for up to `milliseconds` before it is
+         * delivered.  If another event with the same key is fired for the
+         * same sink meanwhile, the new event replaces the held one, so the
+         * sink receives only the latest.  Events without a key are never
+         * held but are not delivered ahead of held events queued before
+         * them.  0, the default, turns coalescing off.
+         */
+        void coalesce_within(DWORD milliseconds)
+        {
+            auto_cs lock(cs_);
+            window_ticks_ = static_cast<LONGLONG>(
+                milliseconds * 1000.0 * ticks_per_us_);
+        }
+
+        /// Statistics for each sink connected at the last fire().
+        std::vector<event_sink_metrics> metrics() const
+        {
+            auto_cs lock(cs_);
+
+            std::vector<event_sink_metrics> result;
+            result.reserve(sinks_.size());
+            for (typename SINKS::const_iterator it = sinks_.begin();
+                 it != sinks_.end(); ++it)
+            {
+                if (it->second->connected)
+                    result.push_back(it->second->metrics);
+            }
+            return result;
+        }
+
+    private:
+        typedef impl::async_event_worker<async_event_firer> worker_type;
+        friend class impl::async_event_worker<async_event_firer>;
+
+        sink_type* find_or_add(DWORD cookie, const com_ptr<Itf>& sink)
+        {
+            typename SINKS::iterator it = sinks_.find(cookie);
+            if (it != sinks_.end())
+                return it->second;
+
+            std::auto_ptr<sink_type> added(new sink_type(cookie, sink));
+            sinks_[cookie] = added.get();
+            return added.release();
+        }
+
+        /// Must be called with cs_ held.
+        void enqueue(sink_type* sink, impl::async_event<Itf>* event, DWORD key)
+        {
+            while (sink->queue.size() >= capacity_)
+            {
+                if (policy_ == event_overflow_drop)
+                {
+                    ++sink->metrics.dropped;
+                    return;
+                }
+                else if (policy_ == event_overflow_coalesce)
+                {
+                    if (coalesce(*sink, event, key))
+                        return;
+
+                    sink->queue.front().event->release();
+                    sink->queue.pop_front();
+                    ++sink->metrics.dropped;
+                }
+                else
+                {
+                    // The sink may be forgotten while cs_ is dropped
+                    DWORD cookie = sink->metrics.cookie;
+                    wait_for_space();
+
+                    typename SINKS::iterator it = sinks_.find(cookie);
+                    if (stopping_ || it == sinks_.end() ||
+                        !it->second->connected)
+                        return;
+                    sink = it->second;
+                }
+            }
+
+            enqueue_unbounded(*sink, event, key);
+        }
+
+        void enqueue_unbounded(
+            sink_type& sink, impl::async_event<Itf>* event, DWORD key)
+        {
+            if (window_ticks_ > 0 && coalesce(sink, event, key))
+                return;
+
+            impl::queued_event<Itf> queued;
+            queued.event = event;
+            queued.key = key;
+            queued.queued_at = impl::performance_counter();
+            queued.due_at =
+                queued.queued_at + ((key != 0) ? window_ticks_ : 0);
+            sink.queue.push_back(queued);
+            event->add_ref();
+
+            sink.metrics.queue_depth = sink.queue.size();
+            if (sink.metrics.queue_depth > sink.metrics.max_queue_depth)
+                sink.metrics.max_queue_depth = sink.metrics.queue_depth;
+
+            schedule(sink);
+        }
+
+        /**
+         * Replace the newest queued event with the same key.
+         *
+         * The new event goes to the back of the queue so that it isn't
+         * delivered ahead of events fired before it.  It keeps the original
+         * queueing and due times, so repeated firing can't hold it back
+         * indefinitely.
+         */
+        bool coalesce(sink_type& sink, impl::async_event<Itf>* event, DWORD key)
+        {
+            if (key == 0)
+                return false;
+
+            for (size_t i = sink.queue.size(); i > 0; --i)
+            {
+                if (sink.queue[i - 1].key == key)
+                {
+                    impl::queued_event<Itf> queued = sink.queue[i - 1];
+                    sink.queue.erase(sink.queue.begin() + (i - 1));
+
+                    event->add_ref();
+                    queued.event->release();
+                    queued.event = event;
+                    sink.queue.push_back(queued);
+                    ++sink.metrics.coalesced;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Drop cs_ until a worker takes an event off some queue.
+         *
+         * Workers only set space_signal_ with cs_ held, so none can be
+         * missed between resetting it and waiting.  A producer resets it
+         * only when its own sink's queue is full, which guarantees another
+         * signal for anyone else still waiting.
+         */
+        void wait_for_space()
+        {
+            if (stopping_)
+                return;
+
+            ::ResetEvent(space_signal_);
+            cs_.leave();
+            ::WaitForSingleObject(space_signal_, INFINITE);
+            cs_.enter();
+        }
+
+        void schedule(sink_type& sink)
+        {
+            if (!sink.scheduled && !sink.queue.empty())
+            {
+                sink.scheduled = true;
+                ready_.push_back(&sink);
+                ::ReleaseSemaphore(ready_signal_, 1, 0);
+            }
+        }
+
+        /// Drop sinks that weren't in the latest snapshot.
+        void forget_disconnected()
+        {
+            typename SINKS::iterator it = sinks_.begin();
+            while (it != sinks_.end())
+            {
+                sink_type* sink = it->second;
+                if (sink->generation == generation_)
+                {
+                    ++it;
+                    continue;
+                }
+
+                sink->connected = false;
+                if (sink->scheduled)
+                {
+                    // A worker owns it; it deletes it when done
+                    ++it;
+                }
+                else
+                {
+                    delete sink;
+                    sinks_.erase(it++);
+                }
+            }
+        }
+
+        /**
+         * Delivery loop run by each worker thread.
+         *
+         * Idle workers wait for a ready sink or for flush_timer_, which is
+         * shared by them all and set to when the first held event is due,
+         * so a held event is released even if the worker that held it is
+         * busy delivering.
+         */
+        void run()
+        {
+            HANDLE signals[] = { ready_signal_, flush_timer_ };
+            for (;;)
+            {
+                DWORD woken =
+                    ::WaitForMultipleObjects(2, signals, false, INFINITE);
+
+                sink_type* sink;
+                impl::queued_event<Itf> queued;
+                {
+                    auto_cs lock(cs_);
+                    if (stopping_)
+                        return;
+
+                    LONGLONG now = impl::performance_counter();
+                    release_due(now, woken == WAIT_OBJECT_0 + 1);
+                    if (ready_.empty())
+                        continue;
+
+                    sink = ready_.front();
+                    ready_.pop_front();
+
+                    if (!sink->connected || sink->queue.empty())
+                    {
+                        retire(sink);
+                        continue;
+                    }
+
+                    LONGLONG due_at = sink->queue.front().due_at;
+                    if (due_at > now)
+                    {
+                        // Still gathering events to coalesce with it
+                        held_.push_back(sink);
+                        if (next_due_ == 0 || due_at < next_due_)
+                            set_flush_timer(due_at, now);
+                        continue;
+                    }
+
+                    queued = sink->queue.front();
+                    sink->queue.pop_front();
+                    sink->metrics.queue_depth = sink->queue.size();
+                    ::SetEvent(space_signal_);
+                }
+
+                HRESULT hr = E_FAIL;
+                try
+                {
+                    hr = queued.event->deliver(sink->sink.raw());
+                }
+                catch (...) {}
+                queued.event->release();
+
+                LONGLONG elapsed = impl::performance_counter() - queued.queued_at;
+                ULONGLONG latency_us =
+                    static_cast<ULONGLONG>(elapsed / ticks_per_us_);
+
+                auto_cs lock(cs_);
+                if (SUCCEEDED(hr))
+                    ++sink->metrics.delivered;
+                else
+                    ++sink->metrics.failed;
+                sink->metrics.total_latency_us += latency_us;
+                if (latency_us > sink->metrics.max_latency_us)
+                    sink->metrics.max_latency_us = latency_us;
+
+                // Back of the line so that busy sinks don't starve others
+                sink->scheduled = false;
+                if (sink->connected)
+                    schedule(*sink);
+                else
+                    retire(sink);
+            }
+        }
+
+        /**
+         * Move held sinks whose first event is due back to the ready list
+         * and set flush_timer_ for the next one.  cs_ must be held.
+         *
+         * \param timer_fired  flush_timer_ woke the caller, so it must be
+         *                     set again even if the next due time is
+         *                     unchanged.
+         */
+        void release_due(LONGLONG now, bool timer_fired)
+        {
+            LONGLONG next_due = 0;
+            typename std::vector<sink_type*>::iterator it = held_.begin();
+            while (it != held_.end())
+            {
+                sink_type* sink = *it;
+                if (!sink->connected || sink->queue.empty() ||
+                    sink->queue.front().due_at <= now)
+                {
+                    ready_.push_back(sink);
+                    ::ReleaseSemaphore(ready_signal_, 1, 0);
+                    it = held_.erase(it);
+                }
+                else
+                {
+                    LONGLONG due_at = sink->queue.front().due_at;
+                    if (next_due == 0 || due_at < next_due)
+                        next_due = due_at;
+                    ++it;
+                }
+            }
+
+            if (next_due == 0)
+            {
+                if (next_due_ != 0)
+                    ::CancelWaitableTimer(flush_timer_);
+                next_due_ = 0;
+            }
+            else if (timer_fired || next_due != next_due_)
+            {
+                set_flush_timer(next_due, now);
+            }
+        }
+
+        /// Wake one idle worker at `due_at`.  cs_ must be held.
+        void set_flush_timer(LONGLONG due_at, LONGLONG now)
+        {
+            next_due_ = due_at;
+
+            // Relative due times are negative, in units of 100ns
+            LARGE_INTEGER delay;
+            delay.QuadPart = -(std::max)(
+                static_cast<LONGLONG>((due_at - now) * 10 / ticks_per_us_),
+                LONGLONG(1));
+            ::SetWaitableTimer(flush_timer_, &delay, 0, 0, 0, false);
+        }
+
+        /// Forget a sink that is no longer connected.  cs_ must be held.
+        void retire(sink_type* sink)
+        {
+            sink->scheduled = false;
+            if (!sink->connected)
+            {
+                sinks_.erase(sink->metrics.cookie);
+                delete sink;
+            }
+        }
+
+        void stop()
+        {
+            {
+                auto_cs lock(cs_);
+                stopping_ = true;
+            }
+            ::SetEvent(space_signal_);
+
+            if (ready_signal_)
+                ::ReleaseSemaphore(
+                    ready_signal_, static_cast<LONG>(workers_.size()), 0);
+
+            for (size_t i = 0; i < workers_.size(); ++i)
+            {
+                if (workers_[i]->handle())
+                    workers_[i]->wait();
+                delete workers_[i];
+            }
+            workers_.clear();
+
+            for (typename SINKS::iterator it = sinks_.begin();
+                 it != sinks_.end(); ++it)
+                delete it->second;
+            sinks_.clear();
+            ready_.clear();
+            held_.clear();
+        }
+
+        async_event_firer(const async_event_firer&);
+        async_event_firer& operator=(const async_event_firer&);
+
+        Source& source_;
+        const size_t capacity_;
+        const event_overflow_policy policy_;
+        double ticks_per_us_;
+
+        critical_section cs_;
+        SINKS sinks_;
+        std::deque<sink_type*> ready_;
+        std::vector<sink_type*> held_; ///< Waiting for a coalescing window.
+        LONGLONG window_ticks_;
+        bool stopping_;
+        unsigned long generation_;
+        LONGLONG next_due_; ///< When flush_timer_ is set for, or 0.
+
+        auto_handle ready_signal_;
+        auto_handle space_signal_;
+        auto_handle flush_timer_; ///< Due when the first held event is.
+        std::vector<worker_type*> workers_;
+    };
+
+    //@}
+}
+
+#endif
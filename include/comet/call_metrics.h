@@ -0,0 +1,800 @@
+/** \file
+  * Call counts and latency histograms from interface call logging.
+  *
+  * See \ref cometcallmetrics.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_CALL_METRICS_H
+#define COMET_CALL_METRICS_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // raise_exception
+#include <comet/handle.h> // auto_handle
+#include <comet/handle_except.h> // source_info_t
+#include <comet/threading.h> // critical_section, auto_cs
+#include <comet/tstring.h>
+
+#include <ios> // ios_base
+#include <map>
+#include <memory> // auto_ptr
+#include <ostream>
+#include <utility> // pair
+#include <vector>
+
+/** \page cometcallmetrics Call metrics
+    metrics_call_logger is a call logger (see \ref cometcalllogging) that
+    keeps numbers instead of writing text.  For each interface method it
+    counts the calls and the calls that failed, and keeps a histogram of
+    how long they took:
+
+    \code
+        template<>
+        struct call_logger_<true> : metrics_call_logger
+        {
+        };
+    \endcode
+
+    Each thread adds to its own counters, so recording a call takes no lock
+    and doesn't contend with other threads; the first call to each method
+    on a thread takes a lock to add the method's counters.  When a thread
+    ends, its counters are added into a total for ended threads and freed,
+    the next time a thread starts counting or the counters are exported.
+    The counters are added together when they are exported, on demand, as
+    JSON or in the Prometheus text format:
+
+    \code
+        tostringstream out;
+        metrics_call_logger::write_prometheus(out);
+    \endcode
+
+    \verbatim
+        comet_calls_total{interface="IFoo",method="Bar"} 1042
+        comet_call_errors_total{interface="IFoo",method="Bar"} 3
+        comet_call_duration_seconds{interface="IFoo",method="Bar",quantile="0.5"} 0.000017
+        ...
+    \endverbatim
+
+    Latencies are in nanoseconds, in buckets in the style of an HDR
+    histogram: exact below 32ns, then 16 buckets for each power of two, so
+    any value is out by at most 1/16th.  Latencies over about half an
+    hour go in the last bucket.
+
+    An export doesn't stop the threads counting, so a call in progress may
+    be in one of its numbers and not yet in another: the calls and the
+    histogram of a method can differ by the calls being made as it runs.
+    No single counter is ever read half-written, even on 32-bit Windows.
+
+    A call is timed from `log_call` to `log_return`, or to `log_exception`
+    for a call that fails.  The logging interface passes the arguments as
+    text, and tlb2h generates that formatting, so it still happens on each
+    call.  The cost of the formatting is counted in the latency.
+*/
+
+namespace comet {
+
+    namespace impl {
+
+        /** Log-linear latency buckets.
+         * \internal
+         */
+        struct latency_buckets
+        {
+            enum
+            {
+                sub_bucket_bits = 4,
+                sub_buckets = 1 << sub_bucket_bits,
+                max_exponent = 36,
+                count = sub_buckets * (max_exponent + 2)
+            };
+
+            /// Bucket holding `ns` nanoseconds.
+            static size_t index(ULONGLONG ns)
+            {
+                if (ns < 2 * sub_buckets)
+                    return static_cast<size_t>(ns);
+
+                size_t top_bit = 0;
+                for (ULONGLONG rest = ns >> 1; rest != 0; rest >>= 1)
+                    ++top_bit;
+
+                size_t exponent = top_bit - sub_bucket_bits;
+                if (exponent > max_exponent)
+                    return count - 1;
+
+                return sub_buckets * exponent +
+                    static_cast<size_t>(ns >> exponent);
+            }
+
+            /// Smallest value in bucket `index`.
+            static ULONGLONG lower(size_t index)
+            {
+                if (index < 2 * sub_buckets)
+                    return index;
+
+                size_t exponent = index / sub_buckets - 1;
+                ULONGLONG sub = index % sub_buckets + sub_buckets;
+                return sub << exponent;
+            }
+
+            /// Largest value in bucket `index`.
+            static ULONGLONG upper(size_t index)
+            {
+                return lower(index + 1) - 1;
+            }
+        };
+
+        /**
+         * Read a 64-bit counter that another thread may be writing.
+         * A plain access is two 32-bit ones on 32-bit Windows, which could
+         * see half of an update.
+         * \internal
+         */
+        inline ULONGLONG load_counter(const ULONGLONG volatile& counter)
+        {
+#ifdef _WIN64
+            return counter;
+#else
+            return static_cast<ULONGLONG>(InterlockedCompareExchange64(
+                reinterpret_cast<LONGLONG volatile*>(
+                    const_cast<ULONGLONG volatile*>(&counter)), 0, 0));
+#endif
+        }
+
+        /// Write a 64-bit counter that another thread may be reading.
+        inline void store_counter(ULONGLONG volatile& counter, ULONGLONG value)
+        {
+#ifdef _WIN64
+            counter = value;
+#else
+            InterlockedExchange64(
+                reinterpret_cast<LONGLONG volatile*>(&counter),
+                static_cast<LONGLONG>(value));
+#endif
+        }
+
+        /** One method's counters on one thread.
+         * Written only by that thread.
+         * \internal
+         */
+        struct method_metrics
+        {
+            method_metrics() : calls(0), errors(0), total_ns(0U), max_ns(0U)
+            {
+                for (size_t i = 0; i < latency_buckets::count; ++i)
+                    buckets[i] = 0;
+            }
+
+            void record(ULONGLONG ns)
+            {
+                buckets[latency_buckets::index(ns)] += 1;
+
+                // Only this thread writes, so it can read without care
+                store_counter(total_ns, total_ns + ns);
+                if (ns > max_ns)
+                    store_counter(max_ns, ns);
+            }
+
+            long volatile calls;
+            long volatile errors;
+            ULONGLONG volatile total_ns;
+            ULONGLONG volatile max_ns;
+            long volatile buckets[latency_buckets::count];
+        };
+
+        /// Interface and method name.
+        typedef std::pair<tstring, tstring> method_key;
+
+        /** One thread's counters and the calls it is in the middle of.
+         * \internal
+         */
+        class thread_call_metrics
+        {
+        public:
+            /// Counters for `thread`, a handle that is closed with them.
+            explicit thread_call_metrics(HANDLE thread)
+                : thread_(auto_attach(thread)), last_(NULL) {}
+
+            ~thread_call_metrics()
+            {
+                for (METHODS::iterator it = methods_.begin();
+                     it != methods_.end(); ++it)
+                    delete it->second;
+            }
+
+            /// Counters for a method, added if new.
+            method_metrics& method(const tstring& iface, const tstring& name)
+            {
+                // A call's return usually follows it, so check the method
+                // last looked up before building a key
+                if (last_ && last_->first.second == name &&
+                    last_->first.first == iface)
+                    return *last_->second;
+
+                method_key key(iface, name);
+
+                // Only this thread adds, so it can look without the lock
+                METHODS::iterator it = methods_.find(key);
+                if (it == methods_.end())
+                {
+                    std::auto_ptr<method_metrics> added(new method_metrics());
+                    auto_cs lock(cs_);
+                    it = methods_.insert(
+                        std::make_pair(key, added.get())).first;
+                    added.release();
+                }
+
+                last_ = &*it;
+                return *it->second;
+            }
+
+            /// Has the thread that counts here ended?
+            bool ended() const
+            {
+                return ::WaitForSingleObject(thread_, 0) == WAIT_OBJECT_0;
+            }
+
+            void start(method_metrics* method, LONGLONG now)
+            {
+                pending_.push_back(pending_call(method, now));
+            }
+
+            /**
+             * End the innermost call to `method`, forgetting any inside it
+             * that never ended.  False if there is no such call.
+             */
+            bool finish(
+                const method_metrics* method, LONGLONG& started)
+            {
+                for (size_t i = pending_.size(); i > 0; --i)
+                {
+                    if (pending_[i - 1].first == method)
+                    {
+                        started = pending_[i - 1].second;
+                        pending_.resize(i - 1);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /// Innermost call to a method called `name`, or NULL.
+            method_metrics* pending_named(const tstring& name) const
+            {
+                for (size_t i = pending_.size(); i > 0; --i)
+                {
+                    method_metrics* method = pending_[i - 1].first;
+                    for (METHODS::const_iterator it = methods_.begin();
+                         it != methods_.end(); ++it)
+                    {
+                        if (it->second == method && it->first.second == name)
+                            return method;
+                    }
+                }
+                return NULL;
+            }
+
+            /// Call `add(key, counters)` for each method.
+            template<typename F> void for_each(F& add) const
+            {
+                auto_cs lock(cs_);
+                for (METHODS::const_iterator it = methods_.begin();
+                     it != methods_.end(); ++it)
+                    add(it->first, *it->second);
+            }
+
+        private:
+            typedef std::map<method_key, method_metrics*> METHODS;
+            typedef std::pair<method_metrics*, LONGLONG> pending_call;
+
+            thread_call_metrics(const thread_call_metrics&);
+            thread_call_metrics& operator=(const thread_call_metrics&);
+
+            auto_handle thread_;
+            critical_section cs_;
+            METHODS methods_;
+            const METHODS::value_type* last_;
+            std::vector<pending_call> pending_;
+        };
+
+        /** Counters of every method on every thread, added together.
+         * \internal
+         */
+        struct method_totals
+        {
+            method_totals()
+                : calls(0U), errors(0U), total_ns(0U), max_ns(0U),
+                  buckets(latency_buckets::count) {}
+
+            /// Latency below which `fraction` of the timed calls fall.
+            ULONGLONG quantile(double fraction) const
+            {
+                ULONGLONG timed = 0U;
+                for (size_t i = 0; i < buckets.size(); ++i)
+                    timed += buckets[i];
+                if (timed == 0U)
+                    return 0U;
+
+                ULONGLONG rank = static_cast<ULONGLONG>(fraction * timed);
+                if (rank == 0U)
+                    rank = 1U;
+
+                ULONGLONG seen = 0U;
+                for (size_t i = 0; i < buckets.size(); ++i)
+                {
+                    seen += buckets[i];
+                    if (seen >= rank)
+                        return min(latency_buckets::upper(i), max_ns);
+                }
+                return max_ns;
+            }
+
+            ULONGLONG calls;
+            ULONGLONG errors;
+            ULONGLONG total_ns;
+            ULONGLONG max_ns;
+            std::vector<ULONGLONG> buckets;
+        };
+
+        typedef std::map<method_key, method_totals> metrics_snapshot;
+
+        /** Adds a thread's counters into a snapshot.
+         * \internal
+         */
+        class metrics_adder
+        {
+        public:
+            explicit metrics_adder(metrics_snapshot& totals)
+                : totals_(totals) {}
+
+            void operator()(const method_key& key, const method_metrics& m)
+            {
+                method_totals& total = totals_[key];
+                total.calls += m.calls;
+                total.errors += m.errors;
+                total.total_ns += load_counter(m.total_ns);
+                total.max_ns = max(total.max_ns, load_counter(m.max_ns));
+                for (size_t i = 0; i < latency_buckets::count; ++i)
+                    total.buckets[i] += m.buckets[i];
+            }
+
+        private:
+            metrics_snapshot& totals_;
+        };
+
+        /** Every thread's counters.
+         * \internal
+         */
+        class call_metrics
+        {
+        public:
+            call_metrics() : tls_(::TlsAlloc())
+            {
+                if (tls_ == TLS_OUT_OF_INDEXES)
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+                LARGE_INTEGER frequency;
+                ::QueryPerformanceFrequency(&frequency);
+                ns_per_tick_ = 1e9 / frequency.QuadPart;
+            }
+
+            /// Only deleted if another was published first, so no thread
+            /// has been counted yet.
+            ~call_metrics()
+            {
+                for (size_t i = 0; i < threads_.size(); ++i)
+                    delete threads_[i];
+                ::TlsFree(tls_);
+            }
+
+            /// The calling thread's counters, or NULL if out of memory.
+            thread_call_metrics* this_thread()
+            {
+                thread_call_metrics* metrics =
+                    static_cast<thread_call_metrics*>(::TlsGetValue(tls_));
+                if (metrics)
+                    return metrics;
+
+                try
+                {
+                    HANDLE thread;
+                    if (!::DuplicateHandle(
+                            ::GetCurrentProcess(), ::GetCurrentThread(),
+                            ::GetCurrentProcess(), &thread, SYNCHRONIZE,
+                            FALSE, 0))
+                        return NULL;
+
+                    std::auto_ptr<thread_call_metrics> added(
+                        new thread_call_metrics(thread));
+                    {
+                        auto_cs lock(cs_);
+                        retire_ended();
+                        threads_.push_back(added.get());
+                    }
+                    ::TlsSetValue(tls_, added.get());
+                    return added.release();
+                }
+                catch (...)
+                {
+                    // Counting mustn't fail the call being counted
+                    return NULL;
+                }
+            }
+
+            ULONGLONG to_ns(LONGLONG ticks) const
+            {
+                return (ticks <= 0) ?
+                    0U : static_cast<ULONGLONG>(ticks * ns_per_tick_);
+            }
+
+            /// Add up every thread's counters.
+            metrics_snapshot snapshot()
+            {
+                auto_cs lock(cs_);
+                retire_ended();
+
+                metrics_snapshot totals = retired_;
+                metrics_adder add(totals);
+                for (size_t i = 0; i < threads_.size(); ++i)
+                    threads_[i]->for_each(add);
+                return totals;
+            }
+
+        private:
+            /**
+             * Add the counters of threads that have ended into retired_
+             * and free them.  What they counted still counts, but a
+             * process that starts many threads shouldn't keep a set of
+             * counters for each.  cs_ must be held.
+             */
+            void retire_ended()
+            {
+                metrics_adder add(retired_);
+                size_t kept = 0;
+                for (size_t i = 0; i < threads_.size(); ++i)
+                {
+                    if (threads_[i]->ended())
+                    {
+                        threads_[i]->for_each(add);
+                        delete threads_[i];
+                    }
+                    else
+                    {
+                        threads_[kept++] = threads_[i];
+                    }
+                }
+                threads_.resize(kept);
+            }
+
+            call_metrics(const call_metrics&);
+            call_metrics& operator=(const call_metrics&);
+
+            DWORD tls_;
+            double ns_per_tick_;
+            critical_section cs_;
+            std::vector<thread_call_metrics*> threads_;
+            metrics_snapshot retired_; ///< Counted by threads that ended.
+        };
+
+        inline LONGLONG metrics_clock()
+        {
+            LARGE_INTEGER now;
+            ::QueryPerformanceCounter(&now);
+            return now.QuadPart;
+        }
+
+        /// Write `text` as a quoted JSON string or Prometheus label value.
+        inline void write_quoted(tostream& os, const tstring& text)
+        {
+            os << _T('"');
+            for (tstring::const_iterator it = text.begin();
+                 it != text.end(); ++it)
+            {
+                if (*it == _T('"') || *it == _T('\\'))
+                    os << _T('\\') << *it;
+                else if (*it == _T('\n'))
+                    os << _T("\\n");
+                else
+                    os << *it;
+            }
+            os << _T('"');
+        }
+
+        /// Restores a stream's formatting on leaving scope.
+        class format_saver
+        {
+        public:
+            explicit format_saver(tostream& os)
+                : os_(os), flags_(os.flags()), precision_(os.precision()) {}
+
+            ~format_saver()
+            {
+                os_.flags(flags_);
+                os_.precision(precision_);
+            }
+
+        private:
+            format_saver(const format_saver&);
+            format_saver& operator=(const format_saver&);
+
+            tostream& os_;
+            std::ios_base::fmtflags flags_;
+            std::streamsize precision_;
+        };
+    }
+
+    /*!\addtogroup CallLog
+     */
+    //@{
+
+    /** \struct metrics_call_logger call_metrics.h comet/call_metrics.h
+      * Count calls and time them instead of logging them as text.
+      * See \ref cometcallmetrics.
+      * \sa call_logger_
+      */
+    struct metrics_call_logger
+#ifdef COMET_DOXYGEN // For documentation
+        : call_logger_
+#endif
+    {
+        static inline bool can_log_call() { return metrics() != NULL; }
+        static inline bool can_log_return() { return can_log_call(); }
+        static inline bool can_log_exception() { return can_log_call(); }
+
+        static inline void log_call(
+            const tstring& iface, const tstring& funcname,
+            const tstring& /*log*/)
+        {
+            impl::call_metrics* counters = metrics();
+            impl::thread_call_metrics* thread =
+                (counters) ? counters->this_thread() : NULL;
+            if (!thread)
+                return;
+
+            try
+            {
+                impl::method_metrics& method = thread->method(iface, funcname);
+                method.calls += 1;
+                thread->start(&method, impl::metrics_clock());
+            }
+            catch (...) {}
+        }
+
+        static inline void log_return(
+            const tstring& iface, const tstring& funcname,
+            const tstring& /*log*/, const tstring& /*retval*/)
+        {
+            LONGLONG now = impl::metrics_clock();
+
+            impl::call_metrics* counters = metrics();
+            impl::thread_call_metrics* thread =
+                (counters) ? counters->this_thread() : NULL;
+            if (!thread)
+                return;
+
+            try
+            {
+                impl::method_metrics& method = thread->method(iface, funcname);
+                LONGLONG started;
+                if (thread->finish(&method, started))
+                    method.record(counters->to_ns(now - started));
+            }
+            catch (...) {}
+        }
+
+        /**
+         * Count the failure of the call named by `callSource`.
+         * Exceptions from methods that aren't being counted, such as
+         * those of comet's own objects, are ignored.
+         */
+        static inline void log_exception(
+            const tstring& /*type*/, const tstring& /*desc*/,
+            const source_info_t& /*errorSource*/,
+            const source_info_t& callSource)
+        {
+            LONGLONG now = impl::metrics_clock();
+
+            impl::call_metrics* counters = metrics();
+            impl::thread_call_metrics* thread =
+                (counters) ? counters->this_thread() : NULL;
+            if (!thread)
+                return;
+
+            try
+            {
+                impl::method_metrics* method = thread->pending_named(
+                    callSource.function_name.t_str());
+                LONGLONG started;
+                if (method && thread->finish(method, started))
+                {
+                    method->errors += 1;
+                    method->record(counters->to_ns(now - started));
+                }
+            }
+            catch (...) {}
+        }
+
+        /**
+         * Write the counters as a JSON object.
+         *
+         * \code
+           {"methods":[{"interface":"IFoo","method":"Bar","calls":3,
+             "errors":0,"latency_ns":{"count":3,"sum":5120,"max":2047,
+             "p50":1535,"p90":2047,"p99":2047,"p999":2047,
+             "buckets":[[1535,2],[2047,1]]}}]}
+         * \endcode
+         *
+         * Each bucket is its largest latency and the number of calls in
+         * it.  Only buckets with calls in them are written.
+         */
+        static void write_json(tostream& os)
+        {
+            impl::metrics_snapshot totals = snapshot();
+            impl::format_saver saver(os);
+            os << std::dec;
+
+            os << _T("{\"methods\":[");
+            for (impl::metrics_snapshot::const_iterator it = totals.begin();
+                 it != totals.end(); ++it)
+            {
+                const impl::method_totals& m = it->second;
+                ULONGLONG timed = 0U;
+                for (size_t i = 0; i < m.buckets.size(); ++i)
+                    timed += m.buckets[i];
+
+                if (it != totals.begin())
+                    os << _T(",");
+                os << _T("{\"interface\":");
+                impl::write_quoted(os, it->first.first);
+                os << _T(",\"method\":");
+                impl::write_quoted(os, it->first.second);
+                os << _T(",\"calls\":") << m.calls
+                   << _T(",\"errors\":") << m.errors
+                   << _T(",\"latency_ns\":{\"count\":") << timed
+                   << _T(",\"sum\":") << m.total_ns
+                   << _T(",\"max\":") << m.max_ns
+                   << _T(",\"p50\":") << m.quantile(0.5)
+                   << _T(",\"p90\":") << m.quantile(0.9)
+                   << _T(",\"p99\":") << m.quantile(0.99)
+                   << _T(",\"p999\":") << m.quantile(0.999)
+                   << _T(",\"buckets\":[");
+
+                bool first = true;
+                for (size_t i = 0; i < m.buckets.size(); ++i)
+                {
+                    if (m.buckets[i] == 0U)
+                        continue;
+                    if (!first)
+                        os << _T(",");
+                    first = false;
+                    os << _T("[") << impl::latency_buckets::upper(i)
+                       << _T(",") << m.buckets[i] << _T("]");
+                }
+                os << _T("]}}");
+            }
+            os << _T("]}");
+        }
+
+        /**
+         * Write the counters in the Prometheus text exposition format.
+         *
+         * Calls and errors are counters and latency is a summary, in
+         * seconds, with the 0.5, 0.9, 0.99 and 0.999 quantiles.
+         */
+        static void write_prometheus(tostream& os)
+        {
+            impl::metrics_snapshot totals = snapshot();
+            impl::format_saver saver(os);
+            os << std::dec;
+
+            typedef impl::metrics_snapshot::const_iterator iterator;
+
+            os << _T("# HELP comet_calls_total Calls to the method.\n")
+               << _T("# TYPE comet_calls_total counter\n");
+            for (iterator it = totals.begin(); it != totals.end(); ++it)
+            {
+                os << _T("comet_calls_total");
+                write_labels(os, it->first);
+                os << _T("} ") << it->second.calls << _T("\n");
+            }
+
+            os << _T("# HELP comet_call_errors_total ")
+               << _T("Calls to the method that failed.\n")
+               << _T("# TYPE comet_call_errors_total counter\n");
+            for (iterator it = totals.begin(); it != totals.end(); ++it)
+            {
+                os << _T("comet_call_errors_total");
+                write_labels(os, it->first);
+                os << _T("} ") << it->second.errors << _T("\n");
+            }
+
+            static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+            static const TCHAR* const quantile_names[] =
+                { _T("0.5"), _T("0.9"), _T("0.99"), _T("0.999") };
+
+            os << _T("# HELP comet_call_duration_seconds ")
+               << _T("Time the method took.\n")
+               << _T("# TYPE comet_call_duration_seconds summary\n");
+            os.setf(std::ios::fixed, std::ios::floatfield);
+            os.precision(9);
+            for (iterator it = totals.begin(); it != totals.end(); ++it)
+            {
+                const impl::method_totals& m = it->second;
+                for (size_t q = 0; q < 4; ++q)
+                {
+                    os << _T("comet_call_duration_seconds");
+                    write_labels(os, it->first);
+                    os << _T(",quantile=\"") << quantile_names[q]
+                       << _T("\"} ") << m.quantile(quantiles[q]) / 1e9
+                       << _T("\n");
+                }
+
+                ULONGLONG timed = 0U;
+                for (size_t i = 0; i < m.buckets.size(); ++i)
+                    timed += m.buckets[i];
+
+                os << _T("comet_call_duration_seconds_sum");
+                write_labels(os, it->first);
+                os << _T("} ") << m.total_ns / 1e9 << _T("\n");
+
+                os << _T("comet_call_duration_seconds_count");
+                write_labels(os, it->first);
+                os << _T("} ") << timed << _T("\n");
+            }
+        }
+
+    private:
+        // Shared by every thread, created on first use.  NULL if it
+        // couldn't be.
+        static impl::call_metrics* metrics()
+        {
+            // Constant-initialised, so safe to race on
+            static impl::call_metrics* volatile metrics_ = NULL;
+
+            impl::call_metrics* counters = metrics_;
+            if (counters)
+                return counters;
+
+            try
+            {
+                return impl::publish_once(metrics_, new impl::call_metrics());
+            }
+            catch (...)
+            {
+                return NULL;
+            }
+        }
+
+        // Every thread's counters, or none if there are no counters.
+        static impl::metrics_snapshot snapshot()
+        {
+            impl::call_metrics* counters = metrics();
+            return (counters) ? counters->snapshot() : impl::metrics_snapshot();
+        }
+
+        // Labels without the closing brace, so more can follow.
+        static void write_labels(tostream& os, const impl::method_key& key)
+        {
+            os << _T("{interface=");
+            impl::write_quoted(os, key.first);
+            os << _T(",method=");
+            impl::write_quoted(os, key.second);
+        }
+    };
+
+    //@}
+}
+
+#endif
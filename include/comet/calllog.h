@@ -37,7 +37,9 @@
     Call logging in comet is enabled by using <kbd>tlb2h -L</kbd> (see \ref tlb2husage).
 
     To enable logging to a specified file, define  COMET_LOGFILE and define
-    COMET_LOGFILE_DEFAULT to be the required logfile (see comet::stream_call_logger_t).
+    COMET_LOGFILE_DEFAULT to be the required logfile.  The file is written
+    from a background thread (see \ref cometasynccalllog), or by the calling
+    thread if COMET_LOGFILE_SYNC is defined (see comet::stream_call_logger_t).
 
     To override logging, specialise comet::call_logger_<true> and implement all the interfaces
     defined by the default comet::call_logger_.
@@ -66,6 +68,14 @@
  * \relates call_logger_
  */
 #define COMET_LOGFILE_DEFAULT "C:\\log\\comet.log"
+
+/** \def COMET_LOGFILE_SYNC
+ * If COMET_LOGFILE is defined, define to write each call to the logfile as
+ * it is made (stream_call_logger_t) instead of in batches from a background
+ * thread (async_call_logger_t).
+ * \relates call_logger_
+ */
+#define COMET_LOGFILE_SYNC
 #endif // COMET_DOXYGEN
 
     //@}
@@ -232,6 +242,9 @@ namespace comet
 #define COMET_LOGFILE_DEFAULT NULL
 #endif
 #include <fstream>
+#ifndef COMET_LOGFILE_SYNC
+#include <comet/async_calllog.h>
+#endif
     /** \class tofstream_comet calllog.h comet/calllog.h
       * Provides a filestream creator as well as the implementation of an output filestream logger.
       * Allows overriding of file name.
@@ -271,7 +284,12 @@ namespace comet
      * \relates call_logger_
      */
     template<>
-    struct call_logger_<true> : public stream_call_logger_t<tofstream_comet>
+    struct call_logger_<true>
+#ifdef COMET_LOGFILE_SYNC
+        : public stream_call_logger_t<tofstream_comet>
+#else
+        : public async_call_logger_t<tofstream_comet>
+#endif
     {
     };
 
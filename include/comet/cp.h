@@ -31,10 +31,16 @@
 
 #include <comet/config.h>
 
+#include <algorithm> // swap
 #include <map>
+#include <utility> // pair
+#include <vector>
 
 #include <comet/server.h>
 #include <comet/enum.h>
+#include <comet/lw_lock.h> // lw_lock_backoff
+#include <comet/snapshot_enum.h>
+#include <comet/threading.h>
 
 #pragma warning( push )
 #pragma warning( disable : 4355 )
@@ -67,6 +73,21 @@ comet::connection_point_for class which provides the access syntax.
 
 Note that \b Fire_ is prepended to each method name.
 
+Events can be fired from any thread, while other threads call Advise and
+Unadvise.  Fire_ methods go through connection_point_impl::fire(), or
+iterate the sinks returned by connection_point_impl::sinks(), an immutable
+snapshot of the connections taken without any lock:
+
+\code
+    connection_point_impl<IFooEvent>::sinks_snapshot sinks = connection_point.sinks();
+    for (connection_point_impl<IFooEvent>::sinks_snapshot::iterator it = sinks.begin(); it != sinks.end(); ++it)
+        it->second->FooMethod( args );
+\endcode
+
+The connections themselves are private to connection_point_impl, so Fire_
+methods generated by older versions of tlb2h, which iterate
+\c connections_, must be regenerated.
+
 If there is only one connection point in the list, then the
 connection_point_for namespace segregator is not required.
 
@@ -299,17 +320,157 @@ namespace comet {
     };
 
 
+    namespace impl {
+
+        /** Connections of a connection point at one moment.
+         * Never modified once created; shared between firing threads and
+         * freed by the last one to release it.
+         * \internal
+         */
+        template<typename Itf> class sink_list
+        {
+        public:
+            typedef std::vector< std::pair<DWORD, com_ptr<Itf> > > sinks_type;
+
+            explicit sink_list(const std::map<DWORD, com_ptr<Itf> >& connections)
+                : sinks_(connections.begin(), connections.end()), rc_(1) {}
+
+            const sinks_type& sinks() const { return sinks_; }
+
+            void add_ref() { InterlockedIncrement(&rc_); }
+            void release() { if (InterlockedDecrement(&rc_) == 0) delete this; }
+
+        private:
+            sink_list(const sink_list&);
+            sink_list& operator=(const sink_list&);
+
+            const sinks_type sinks_;
+            long rc_;
+        };
+
+    }
+
     /** \class connection_point_impl  cp.h comet/cp.h
       * Implements a connection point.
+      *
+      * Advise, Unadvise and firing events through sinks() may be called from
+      * any thread.  Each change to the connections publishes a new immutable
+      * snapshot; firing takes a reference to the current one and then
+      * delivers events without holding any lock.
+      *
+      * Firing never takes the connection point's lock.  A firing thread
+      * counts itself in one of two reader slots while it takes its
+      * reference, and Advise and Unadvise wait for each slot in turn to
+      * empty before releasing the snapshot they replaced.
+      *
       * \param Itf Interface of connection point.
       */
     template<typename Itf> class ATL_NO_VTABLE connection_point_impl : public embedded_object< IUnknown, IConnectionPoint >
     {
     public:
+        /** Sinks connected when sinks() was called.
+          * Advise and Unadvise on other threads don't affect an existing
+          * snapshot, so it can be iterated without locking.  It must not
+          * outlive its connection point.
+          */
+        class sinks_snapshot
+        {
+        public:
+            typedef std::pair<DWORD, com_ptr<Itf> > value_type;
+            typedef typename impl::sink_list<Itf>::sinks_type::const_iterator iterator;
+            typedef iterator const_iterator;
+
+            sinks_snapshot(const sinks_snapshot& x) : list_(x.list_), owner_(x.owner_)
+            { list_->add_ref(); }
+
+            sinks_snapshot& operator=(const sinks_snapshot& x)
+            {
+                sinks_snapshot t(x);
+                swap(t);
+                return *this;
+            }
+
+            ~sinks_snapshot() { list_->release(); }
+
+            void swap(sinks_snapshot& x) throw()
+            {
+                std::swap(list_, x.list_);
+                std::swap(owner_, x.owner_);
+            }
+
+            iterator begin() const { return list_->sinks().begin(); }
+            iterator end() const { return list_->sinks().end(); }
+            size_t size() const { return list_->sinks().size(); }
+            bool empty() const { return list_->sinks().empty(); }
+
+            /** Disconnect a sink from the connection point.
+              * The snapshot itself is unchanged so iteration can continue.
+              * This lets cp_nothrow_remove work on snapshots.
+              */
+            void erase(const iterator& it) { owner_->remove_connection(it->first); }
+
+        private:
+            friend class connection_point_impl;
+
+            sinks_snapshot(impl::sink_list<Itf>* list, connection_point_impl* owner)
+                : list_(list), owner_(owner)
+            { list_->add_ref(); }
+
+            impl::sink_list<Itf>* list_;
+            connection_point_impl* owner_;
+        };
+
         bool is_connected() const
-        {    return !connections_.empty(); }
+        {    return !sinks().empty(); }
+
+        /** Snapshot of the connected sinks for firing events.
+          * Takes no lock, so never waits for Advise or Unadvise.
+          */
+        sinks_snapshot sinks() const
+        {
+            long slot = reader_slot_;
+            InterlockedIncrement(&readers_[slot]);
+
+            // Counted before reading sinks_, so the list can't be released
+            // until we have our reference
+            sinks_snapshot snapshot(
+                sinks_, const_cast<connection_point_impl*>(this));
+
+            InterlockedDecrement(&readers_[slot]);
+            impl::lw_lock_backoff::wake(readers_[slot], parked_);
+            return snapshot;
+        }
+
+        /** Call `event` on each connected sink.
+          *
+          * `event` is a function object taking an `Itf*` and returning an
+          * HRESULT.  Failures are passed to the connection-point traits
+          * `traits` (see cp_throw) with the snapshot and iterator of the
+          * failing sink.
+          */
+        template<typename F, typename TR>
+        void fire(const F& event, TR& traits) const
+        {
+            sinks_snapshot connections = sinks();
+            for (typename sinks_snapshot::iterator it = connections.begin();
+                 it != connections.end(); ++it)
+            {
+                if (traits.check_fail(event(it->second.in())) &&
+                    traits.on_fail(connections, it))
+                    return;
+            }
+        }
+
     protected:
-        connection_point_impl(::IUnknown* pUnk) : next_cookie_(1), embedded_object< IUnknown, IConnectionPoint >(pUnk) {}
+        connection_point_impl(::IUnknown* pUnk) : embedded_object< IUnknown, IConnectionPoint >(pUnk),
+            sinks_(new impl::sink_list<Itf>(CONNECTIONS())), reader_slot_(0),
+            parked_(0), next_cookie_(1)
+        {
+            readers_[0] = 0;
+            readers_[1] = 0;
+        }
+
+        ~connection_point_impl() { sinks_->release(); }
 
         /// \name IConnectionPoint interface
         //@{
@@ -328,27 +489,45 @@ namespace comet {
 
         STDMETHOD(Advise)(::IUnknown* pUnkSink, DWORD* pdwCookie)
         {
+            if (!pdwCookie) return E_POINTER;
+            impl::sink_list<Itf>* old_list = 0;
             try {
-                connections_[next_cookie_] = try_cast( com_ptr< ::IUnknown >(pUnkSink) );
+                // QI outside the lock as the sink may be in another apartment
+                com_ptr<Itf> sink = try_cast( com_ptr< ::IUnknown >(pUnkSink) );
+
+                auto_cs lock(cs_);
+                DWORD cookie = next_cookie_;
+                connections_[cookie] = sink;
+                try {
+                    old_list = publish();
+                }
+                catch (...) {
+                    connections_.erase(cookie);
+                    throw;
+                }
+                ++next_cookie_;
+                *pdwCookie = cookie;
             }
             catch (...) {
                 return CONNECT_E_CANNOTCONNECT;
             }
-            *pdwCookie = next_cookie_++;
+            old_list->release();
             return S_OK;
         }
         STDMETHOD(Unadvise)(DWORD dwCookie)
         {
-            CONNECTIONS::iterator it = connections_.find(dwCookie);
-            if (it == connections_.end()) return CONNECT_E_NOCONNECTION;
-            connections_.erase(it);
-            return S_OK;
+            try {
+                return remove_connection(dwCookie);
+            } catch (...) {
+                return E_FAIL;
+            }
         }
 
         STDMETHOD(EnumConnections)(IEnumConnections** ppEnum)
         {
             try {
-                *ppEnum = com_ptr<IEnumConnections>::detach( stl_enumeration<IEnumConnections>::create(connections_, get_unknown()) );
+                auto_cs lock(cs_);
+                *ppEnum = com_ptr<IEnumConnections>::detach( make_snapshot_enumeration<IEnumConnections>(connections_) );
             } catch (...) {
                 return E_FAIL;
             }
@@ -356,9 +535,76 @@ namespace comet {
         }
         //@}
 
-        typedef std::map<DWORD, com_ptr<Itf> > CONNECTIONS;
-        CONNECTIONS connections_;
     private:
+        typedef std::map<DWORD, com_ptr<Itf> > CONNECTIONS;
+
+        /** Replace the published snapshot with one matching connections_.
+          * Must be called with cs_ held.  Returns the previous snapshot for
+          * the caller to release once the lock is dropped, as that may
+          * release sinks.
+          */
+        impl::sink_list<Itf>* publish()
+        {
+            impl::sink_list<Itf>* list = new impl::sink_list<Itf>(connections_);
+            list = static_cast<impl::sink_list<Itf>*>(
+                InterlockedExchangePointer(
+                    reinterpret_cast<void* volatile*>(&sinks_), list));
+
+            // A reader may have read the old list but not yet referenced
+            // it.  It is counted in one of the slots, so switch new readers
+            // to the other slot and wait for this one to empty, then do the
+            // same for the other.  New readers never hold up either wait.
+            for (int i = 0; i < 2; ++i)
+            {
+                long slot = reader_slot_;
+                InterlockedExchange(&reader_slot_, 1 - slot);
+                wait_for_readers(slot);
+            }
+
+            return list;
+        }
+
+        /// Wait until no reader is counted in `slot`.
+        void wait_for_readers(long slot)
+        {
+            impl::lw_lock_backoff backoff;
+            for (;;)
+            {
+                long readers = readers_[slot];
+                if (readers == 0)
+                    return;
+                backoff.wait(readers_[slot], readers, parked_);
+            }
+        }
+
+        HRESULT remove_connection(DWORD cookie)
+        {
+            com_ptr<Itf> removed; // released after the lock
+            impl::sink_list<Itf>* old_list = 0;
+            {
+                auto_cs lock(cs_);
+                typename CONNECTIONS::iterator it = connections_.find(cookie);
+                if (it == connections_.end()) return CONNECT_E_NOCONNECTION;
+                removed = it->second;
+                connections_.erase(it);
+                try {
+                    old_list = publish();
+                }
+                catch (...) {
+                    connections_[cookie] = removed;
+                    throw;
+                }
+            }
+            old_list->release();
+            return S_OK;
+        }
+
+        critical_section cs_;
+        CONNECTIONS connections_; ///< Guarded by cs_.
+        impl::sink_list<Itf>* volatile sinks_;
+        mutable long volatile readers_[2]; ///< Readers taking a reference.
+        long volatile reader_slot_; ///< Slot in readers_ new readers use.
+        mutable long volatile parked_; ///< Advise/Unadvise parked in wait.
         UINT next_cookie_;
     };
 
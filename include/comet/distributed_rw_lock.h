@@ -0,0 +1,231 @@
+/** \file
+  * Multiple Reader Single Writer lock with a reader count per slot.
+  *
+  * See \ref cometdistributedrwlock.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_DISTRIBUTED_RW_LOCK_H
+#define COMET_DISTRIBUTED_RW_LOCK_H
+
+#include <comet/config.h>
+#include <comet/assert.h>
+#include <comet/lw_lock.h> // impl::lw_lock_backoff
+
+#include <windows.h>
+
+/** \page cometdistributedrwlock Distributed Reader/Writer Lock
+  distributed_rw_lock has the same interface and rules as lw_lock (see
+  \ref cometlwlock) but is built for data that is read far more often than
+  it is written, such as caches of type information.
+
+  lw_lock keeps one count of readers, so every reader on every core writes
+  to the same cache line and the line moves between cores on each
+  acquisition.  distributed_rw_lock instead has COMET_RW_LOCK_SLOTS reader
+  counts, each on its own cache line.  A thread always uses the same slot,
+  chosen from its thread ID, so readers on different cores rarely touch the
+  same line and read throughput grows with the number of cores.
+
+  Writers pay for this: a writer first shuts out new readers, as lw_lock
+  does, and then waits for the count in every slot to reach zero.  The lock
+  is also COMET_RW_LOCK_SLOTS cache lines in size.  Use lw_lock unless
+  reads dominate and are contended.
+
+  The slots are aligned to COMET_CACHE_LINE_SIZE, which holds for locks
+  on the stack, in static storage or in an object that is itself aligned.
+  Before C++17, operator new only aligns to 16 bytes at most, so a lock
+  allocated on its own on the heap may have slots that straddle lines.
+  */
+
+#ifndef COMET_RW_LOCK_SLOTS
+#define COMET_RW_LOCK_SLOTS 64
+#endif
+
+#ifndef COMET_CACHE_LINE_SIZE
+#define COMET_CACHE_LINE_SIZE 64
+#endif
+
+#ifdef _MSC_VER
+#define COMET_CACHE_ALIGNED __declspec(align(COMET_CACHE_LINE_SIZE))
+#else
+#define COMET_CACHE_ALIGNED __attribute__((aligned(COMET_CACHE_LINE_SIZE)))
+#endif
+
+namespace comet {
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /** Reader/writer lock that scales with the number of reading cores.
+     *  See \ref cometdistributedrwlock for more information and
+     *  \ref cometlwlock for warnings that apply equally.
+     *  \sa auto_distributed_reader_lock auto_distributed_writer_lock lw_lock
+     */
+    class distributed_rw_lock
+    {
+    public:
+        distributed_rw_lock() : writer_count_(0), parked_(0)
+        {
+            for (size_t i = 0; i < COMET_RW_LOCK_SLOTS; ++i)
+                slots_[i].reader_count = 0;
+        }
+
+        ~distributed_rw_lock()
+        {
+#ifndef NDEBUG
+            for (size_t i = 0; i < COMET_RW_LOCK_SLOTS; ++i)
+                COMET_ASSERT( slots_[i].reader_count == 0 );
+#endif
+            COMET_ASSERT( writer_count_ == 0 );
+        }
+
+        ///  Reader lock acquisition
+        void enter_reader() const
+        {
+            long volatile& readers = slot().reader_count;
+
+            impl::lw_lock_backoff backoff;
+            for (;;)
+            {
+                if (writer_count_ != 0)
+                {
+                    backoff.wait(writer_count_, 1, parked_);
+                    continue;
+                }
+
+                // The increment is a full barrier, so either the writer sees
+                // our count or we see its flag
+                InterlockedIncrement(&readers);
+
+                if (writer_count_ == 0)
+                    break;
+
+                leave_slot(readers);
+                backoff.wait(writer_count_, 1, parked_);
+            }
+        }
+
+        ///  Reader lock release
+        void leave_reader() const
+        {
+            leave_slot(slot().reader_count);
+        }
+
+        /// Writer lock acquisition
+        void enter_writer()
+        {
+            impl::lw_lock_backoff backoff;
+            while (InterlockedExchange(&writer_count_, 1) == 1)
+                backoff.wait(writer_count_, 1, parked_);
+
+            // New readers now back off; wait for the existing ones to leave
+            for (size_t i = 0; i < COMET_RW_LOCK_SLOTS; ++i)
+            {
+                for (;;)
+                {
+                    long readers = slots_[i].reader_count;
+                    if (readers == 0)
+                        break;
+                    backoff.wait(slots_[i].reader_count, readers, parked_);
+                }
+            }
+        }
+
+        ///  Writer lock release
+        void leave_writer()
+        {
+            InterlockedExchange(&writer_count_, 0);
+            impl::lw_lock_backoff::wake(writer_count_, parked_);
+        }
+
+    private:
+        /// Reader count alone on its cache line.
+        struct COMET_CACHE_ALIGNED reader_slot
+        {
+            long volatile reader_count;
+        };
+
+        /// The calling thread's slot, the same every time it is called.
+        reader_slot& slot() const
+        {
+            // Thread IDs are multiples of 4 so drop the low bits
+            DWORD id = ::GetCurrentThreadId() >> 2;
+            return slots_[id % COMET_RW_LOCK_SLOTS];
+        }
+
+        void leave_slot(long volatile& readers) const
+        {
+            if (InterlockedDecrement(&readers) == 0)
+                impl::lw_lock_backoff::wake(readers, parked_);
+        }
+
+        // The slots' alignment keeps these off the first slot's line
+        mutable long volatile writer_count_;
+        mutable long volatile parked_;
+        mutable reader_slot slots_[COMET_RW_LOCK_SLOTS];
+
+        // Declare class non-copyable
+        distributed_rw_lock(const distributed_rw_lock&);
+        distributed_rw_lock& operator=(const distributed_rw_lock&);
+    };
+
+    /** \class auto_distributed_reader_lock distributed_rw_lock.h comet/distributed_rw_lock.h
+     *  Auto-release locking class for distributed_rw_lock read access.
+     *  \sa distributed_rw_lock auto_distributed_writer_lock
+     */
+    class auto_distributed_reader_lock {
+    public:
+        explicit auto_distributed_reader_lock(const distributed_rw_lock& cs)
+            : cs_(cs) {
+            cs_.enter_reader();
+        }
+
+        ~auto_distributed_reader_lock() {
+            cs_.leave_reader();
+        }
+
+    private:
+        auto_distributed_reader_lock& operator=(const auto_distributed_reader_lock&);
+        auto_distributed_reader_lock(const auto_distributed_reader_lock&);
+
+        const distributed_rw_lock& cs_;
+    };
+
+    /** \class auto_distributed_writer_lock distributed_rw_lock.h comet/distributed_rw_lock.h
+     *  Auto-release locking class for distributed_rw_lock write access.
+     *  \sa distributed_rw_lock auto_distributed_reader_lock
+     */
+    class auto_distributed_writer_lock {
+    public:
+        explicit auto_distributed_writer_lock(distributed_rw_lock& cs)
+            : cs_(cs) {
+            cs_.enter_writer();
+        }
+
+        ~auto_distributed_writer_lock() {
+            cs_.leave_writer();
+        }
+
+    private:
+        auto_distributed_writer_lock& operator=(const auto_distributed_writer_lock&);
+        auto_distributed_writer_lock(const auto_distributed_writer_lock&);
+
+        distributed_rw_lock& cs_;
+    };
+    //@}
+
+}
+
+#endif
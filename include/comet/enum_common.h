@@ -25,10 +25,48 @@
 #include <comet/stl.h>
 #include <comet/variant.h>
 
+#include <iterator> // iterator_traits
+
 namespace comet {
 
     namespace impl {
 
+        /**
+         * Advance `it` by up to `n` without passing `end`.
+         * \returns Number of elements advanced.
+         */
+        template<typename It>
+        inline ULONG advance_up_to(
+            It& it, const It& end, ULONG n, std::input_iterator_tag)
+        {
+            ULONG i = 0;
+            for (; i < n && it != end; ++i)
+                ++it;
+            return i;
+        }
+
+        /// Random-access iterators jump straight to the target.
+        template<typename It>
+        inline ULONG advance_up_to(
+            It& it, const It& end, ULONG n, std::random_access_iterator_tag)
+        {
+            typename std::iterator_traits<It>::difference_type remaining =
+                end - it;
+            ULONG step = (remaining < static_cast<
+                typename std::iterator_traits<It>::difference_type>(n)) ?
+                static_cast<ULONG>(remaining) : n;
+            it += step;
+            return step;
+        }
+
+        template<typename It>
+        inline ULONG advance_up_to(It& it, const It& end, ULONG n)
+        {
+            return advance_up_to(
+                it, end, n,
+                typename std::iterator_traits<It>::iterator_category());
+        }
+
         template<typename T> struct type_policy;
 
         template<> struct type_policy<VARIANT>
@@ -68,27 +106,27 @@ namespace comet {
                 if (!rgelt)
                     return E_POINTER;
 
-                UINT i = 0;
-                typename Source::const_iterator backup_it_ = source_.current();
+                ULONG i = 0;
+                typename Source::const_iterator& it = source_.current();
+                const typename Source::const_iterator end = source_.end();
+                const typename Source::const_iterator backup_it_ = it;
                 try
                 {
-                    while (i < celt && source_.current() != source_.end())
-                    {
-                        policy::init(rgelt[i], converter_(*source_.current()));
-                        ++i;
-                        ++source_.current();
-                    }
-                    if (pceltFetched)
-                        *pceltFetched = i;
+                    for (; i < celt && it != end; ++i, ++it)
+                        policy::init(rgelt[i], converter_(*it));
                 }
                 catch (...)
                 {
-                    source_.current() = backup_it_;
-                    for (size_t j = 0; j <= i; ++j)
+                    // Only elements before i were initialised
+                    it = backup_it_;
+                    for (ULONG j = 0; j < i; ++j)
                         policy::clear(rgelt[j]);
                     return E_FAIL;
                 }
 
+                if (pceltFetched)
+                    *pceltFetched = i;
+
                 return i == celt ? S_OK : S_FALSE;
             }
 
@@ -106,10 +144,11 @@ namespace comet {
             {
                 try
                 {
-                    while (celt--) source_.current()++;
+                    ULONG skipped = advance_up_to(
+                        source_.current(), source_.end(), celt);
+                    return skipped == celt ? S_OK : S_FALSE;
                 }
                 catch (...) { return E_FAIL; }
-                return S_OK;
             }
 
             STDMETHOD(Clone)(Itf** ppenum)
@@ -23,6 +23,7 @@
 #include <comet/config.h>
 
 #include <comet/enum_common.h>
+#include <comet/enum_prefetch.h>
 #include <comet/ptr.h>
 
 #include <stdexcept>
@@ -30,7 +31,11 @@
 namespace comet {
 
     /**
-     * STL style iterator for COM enumerator interfaces
+     * STL style iterator for COM enumerator interfaces.
+     *
+     * Elements are fetched from the enumerator one at a time, or in
+     * batches of the size given to the constructor or of
+     * COMET_ENUM_PREFETCH_SIZE if that is defined.
      */
     template<typename E, typename T=enumerated_type_of<E>::is>
     class enum_iterator : public std::iterator<std::input_iterator_tag, T>
@@ -39,7 +44,7 @@ namespace comet {
         typedef typename enumerated_type_of<E>::is  element_type;
         typedef impl::type_policy<element_type>     policy;
 
-        com_ptr<enumerator_type> enum_;
+        impl::enum_prefetch<enumerator_type, element_type, policy> source_;
 
         static value_type policy_init(const element_type& element)
         {
@@ -77,8 +82,10 @@ namespace comet {
         bool is_value_set_;
 
     public:
-        enum_iterator(const com_ptr<enumerator_type>& e) :
-          enum_(e), is_value_set_(false)
+        enum_iterator(
+            const com_ptr<enumerator_type>& e,
+            size_t batch_size=COMET_ENUM_PREFETCH_SIZE) :
+          source_(e, batch_size), is_value_set_(false)
         {
             next();
         }
@@ -86,7 +93,7 @@ namespace comet {
         enum_iterator() : is_value_set_(false) {}
 
         enum_iterator(const enum_iterator& other) :
-            enum_(other.enum_), value_(copy_value_from_other(other)),
+            source_(other.source_), value_(copy_value_from_other(other)),
             is_value_set_(other.is_value_set_) {}
 
         enum_iterator& operator=(const enum_iterator& other)
@@ -98,8 +105,9 @@ namespace comet {
 
         void swap(enum_iterator& other)
         {
-            enum_.swap(other.enum_);
+            source_.swap(other.source_);
             std::swap(value_, other.value_);
+            std::swap(is_value_set_, other.is_value_set_);
         }
 
         /** Move to next element. */
@@ -124,11 +132,11 @@ namespace comet {
          */
         bool operator!=(const enum_iterator& other)
         {
-            if (enum_ && other.enum_)
+            if (!source_.is_null() && !other.source_.is_null())
                 throw std::logic_error(
                     "enum_iterator comparison does not work");
 
-            return enum_ || other.enum_;
+            return !source_.is_null() || !other.source_.is_null();
         }
 
         /** Current element. */
@@ -146,15 +154,13 @@ namespace comet {
 
         void next()
         {
-            if (enum_)
+            if (!source_.is_null())
             {
-                unsigned long fetched = 0;
                 element_type pod;
 
-                enum_->Next(1, &pod, &fetched) | raise_exception;
-                if (fetched == 0)
+                if (!source_.next(pod))
                 {
-                    enum_ = NULL;
+                    source_.reset();
                     return;
                 }
 
@@ -0,0 +1,177 @@
+/** \file
+  * Batched fetching from COM enumerators for the enumerator iterators.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_ENUM_PREFETCH_H
+#define COMET_ENUM_PREFETCH_H
+
+#include <comet/config.h>
+
+#include <comet/assert.h>
+#include <comet/ptr.h>
+
+#include <algorithm> // min, swap
+#include <vector>
+
+/**
+ * Number of elements the enumerator iterators request per call to Next,
+ * unless given a batch size.
+ *
+ * Each call to Next on an out-of-apartment enumerator is a marshalled round
+ * trip, so fetching in batches divides the number of round trips by the
+ * batch size.  The default of 1 fetches one element at a time, as the
+ * iterators always have.  Prefetching is opt-in, because batches take
+ * elements from the enumerator before they are used, and because some
+ * enumerators mishandle requests for more than one element: pass a batch
+ * size to an iterator's constructor, or define this as, say, 64 before
+ * including any comet header.
+ */
+#ifndef COMET_ENUM_PREFETCH_SIZE
+#define COMET_ENUM_PREFETCH_SIZE 1
+#endif
+
+namespace comet {
+
+    namespace impl {
+
+        /**
+         * Elements fetched from a COM enumerator ahead of use.
+         *
+         * Copies share the same buffer, just as copies of an iterator share
+         * the underlying enumerator, so elements are handed out exactly once
+         * whichever copy asks for them.  Fetched elements that are never
+         * handed out are released with `Policy::clear`.
+         *
+         * \note Elements are removed from the enumerator a batch at a time,
+         *       so after iteration stops early the enumerator is positioned
+         *       beyond the last element handed out.
+         */
+        template<typename E, typename T, typename Policy>
+        class enum_prefetch
+        {
+            struct state
+            {
+                state(const com_ptr<E>& e, size_t batch_size)
+                    : enumerator(e), buffer((batch_size) ? batch_size : 1),
+                      position(0), fetched(0), exhausted(false),
+                      references(1) {}
+
+                ~state()
+                {
+                    for (; position < fetched; ++position)
+                        Policy::clear(buffer[position]);
+                }
+
+                com_ptr<E> enumerator;
+                std::vector<T> buffer;
+                size_t position;
+                size_t fetched;
+                bool exhausted;
+                long references;
+            };
+
+            state* state_;
+
+        public:
+            enum_prefetch() : state_(0) {}
+
+            enum_prefetch(const com_ptr<E>& e, size_t batch_size)
+                : state_((e) ? new state(e, batch_size) : 0) {}
+
+            enum_prefetch(const enum_prefetch& other) : state_(other.state_)
+            {
+                if (state_)
+                    ++state_->references;
+            }
+
+            enum_prefetch& operator=(const enum_prefetch& other)
+            {
+                enum_prefetch copy(other);
+                swap(copy);
+                return *this;
+            }
+
+            ~enum_prefetch()
+            {
+                reset();
+            }
+
+            void swap(enum_prefetch& other) throw()
+            {
+                std::swap(state_, other.state_);
+            }
+
+            /// Stop sharing the buffer and become null.
+            void reset() throw()
+            {
+                if (state_ && --state_->references == 0)
+                    delete state_;
+                state_ = 0;
+            }
+
+            bool is_null() const throw()
+            {
+                return state_ == 0;
+            }
+
+            /**
+             * Hand out the next element, fetching another batch if needed.
+             *
+             * The caller takes ownership of `out`.
+             *
+             * \returns false if the enumerator has no more elements.
+             */
+            bool next(T& out)
+            {
+                COMET_ASSERT(state_);
+
+                if (state_->position == state_->fetched)
+                {
+                    if (state_->exhausted)
+                        return false;
+
+                    fill();
+
+                    if (state_->fetched == 0)
+                        return false;
+                }
+
+                out = state_->buffer[state_->position++];
+                return true;
+            }
+
+        private:
+            void fill()
+            {
+                state_->position = 0;
+                state_->fetched = 0;
+
+                ULONG fetched = 0;
+                HRESULT hr = state_->enumerator->Next(
+                    static_cast<ULONG>(state_->buffer.size()),
+                    &state_->buffer[0], &fetched);
+                hr | raise_exception;
+
+                // S_FALSE means fewer than requested: the enumerator is done
+                state_->fetched = (std::min)(
+                    static_cast<size_t>(fetched), state_->buffer.size());
+                state_->exhausted = (hr == S_FALSE || fetched == 0);
+            }
+        };
+
+    }
+}
+
+#endif
@@ -20,11 +20,299 @@
 #define COMET_EXE_SERVER_H
 
 #include <comet/server.h>
+#include <comet/sta_dispatcher.h>
 #include <comet/static_assert.h>
 
+#include <memory> // auto_ptr
+#include <vector>
+
 namespace comet {
 
     namespace impl {
+
+        /** Creates an object with a class factory and marshals it for
+         * another apartment of the process.
+         * \internal
+         */
+        struct apartment_activation
+        {
+            apartment_activation(
+                const com_ptr<IClassFactory>& factory, const IID& iid)
+                : factory(factory), iid(iid) {}
+
+            com_ptr<IStream> operator()() const
+            {
+                com_ptr< ::IUnknown> object;
+                factory->CreateInstance(
+                    0, iid, reinterpret_cast<void**>(object.out()))
+                    | raise_exception;
+
+                IStream* stream;
+                ::CoMarshalInterThreadInterfaceInStream(
+                    iid, object.raw(), &stream) | raise_exception;
+                return auto_attach(stream);
+            }
+
+            com_ptr<IClassFactory> factory;
+            IID iid;
+        };
+
+        struct quit_apartment
+        {
+            void operator()() const { ::PostQuitMessage(0); }
+        };
+
+        /** Single-threaded apartment that objects are created in.
+         * \internal
+         */
+        class apartment_thread : public thread
+        {
+        public:
+            apartment_thread() : dispatcher_(0) {}
+
+            /// Start the thread and wait until it can take calls.
+            bool start_apartment()
+            {
+                if (!start())
+                    return false;
+
+                HANDLE handles[] = { ready_, handle() };
+                return ::WaitForMultipleObjects(
+                    2, handles, FALSE, INFINITE) == WAIT_OBJECT_0;
+            }
+
+            sta_dispatcher& dispatcher()
+            {
+                return *dispatcher_;
+            }
+
+            /// Stop the message loop and wait for the thread to end.
+            void stop()
+            {
+                if (running())
+                {
+                    dispatcher_->post<void>(quit_apartment());
+                    wait();
+                }
+            }
+
+        private:
+            DWORD thread_main()
+            {
+                HRESULT hr = ::CoInitializeEx(0, COINIT_APARTMENTTHREADED);
+                if (FAILED(hr))
+                    return hr;
+
+                try
+                {
+                    sta_dispatcher dispatcher;
+                    dispatcher_ = &dispatcher;
+                    ready_.set();
+
+                    MSG msg;
+                    while (::GetMessage(&msg, 0, 0, 0) > 0)
+                    {
+                        ::TranslateMessage(&msg);
+                        ::DispatchMessage(&msg);
+                    }
+                }
+                catch (...) {}
+
+                ::CoUninitialize();
+                return 0;
+            }
+
+            sta_dispatcher* dispatcher_;
+            event ready_;
+        };
+
+        /** Wait for a handle while dispatching the calling apartment's
+         * messages.
+         * \internal
+         */
+        inline void wait_with_message_loop(HANDLE handle)
+        {
+            bool quit = false;
+            int exit_code = 0;
+            while (::MsgWaitForMultipleObjects(
+                       1, &handle, FALSE, INFINITE, QS_ALLINPUT) ==
+                   WAIT_OBJECT_0 + 1)
+            {
+                MSG msg;
+                while (::PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
+                {
+                    if (msg.message == WM_QUIT)
+                    {
+                        // Leave it for the server's own message loop
+                        quit = true;
+                        exit_code = static_cast<int>(msg.wParam);
+                        continue;
+                    }
+                    ::TranslateMessage(&msg);
+                    ::DispatchMessage(&msg);
+                }
+            }
+
+            if (quit)
+                ::PostQuitMessage(exit_code);
+        }
+
+        class apartment_pool;
+
+        /** Class factory that creates its objects in the apartments of an
+         * apartment_pool.
+         * \internal
+         */
+        class apartment_class_factory : public IClassFactory
+        {
+        public:
+            apartment_class_factory(
+                apartment_pool& pool, const com_ptr<IClassFactory>& factory)
+                : pool_(pool), factory_(factory) {}
+
+            STDMETHOD_(ULONG, AddRef)()
+            {
+                return 2;
+            }
+
+            STDMETHOD_(ULONG, Release)()
+            {
+                return 1;
+            }
+
+            STDMETHOD(QueryInterface)(REFIID riid, void **pv)
+            {
+                if (!pv) return E_POINTER;
+                *pv = 0;
+                if (riid == IID_IClassFactory) *pv = static_cast<IClassFactory*>(this);
+                if (riid == IID_IUnknown) *pv = this;
+
+                if (*pv == NULL) return E_NOINTERFACE;
+
+                AddRef();
+                return S_OK;
+            }
+
+            STDMETHOD(LockServer)(BOOL bLock)
+            {
+                if (bLock)
+                    module().lock();
+                else
+                    module().unlock();
+                return S_OK;
+            }
+
+            STDMETHOD(CreateInstance)(::IUnknown *pUnkOuter, REFIID riid, void **ppv);
+
+        private:
+            apartment_class_factory(const apartment_class_factory&);
+            apartment_class_factory& operator=(const apartment_class_factory&);
+
+            apartment_pool& pool_;
+            com_ptr<IClassFactory> factory_;
+        };
+
+        /** Single-threaded apartments that share out the objects of an
+         * exe_server.
+         * \internal
+         */
+        class apartment_pool
+        {
+        public:
+            apartment_pool() : next_(0) {}
+
+            ~apartment_pool()
+            {
+                stop();
+            }
+
+            void start(size_t thread_count)
+            {
+                for (size_t i = 0; i < thread_count; ++i)
+                {
+                    std::auto_ptr<apartment_thread> apartment(
+                        new apartment_thread());
+                    if (!apartment->start_apartment())
+                        raise_exception(E_UNEXPECTED);
+                    threads_.push_back(apartment.release());
+                }
+            }
+
+            void stop()
+            {
+                for (size_t i = 0; i < threads_.size(); ++i)
+                {
+                    threads_[i]->stop();
+                    delete threads_[i];
+                }
+                threads_.clear();
+
+                for (size_t i = 0; i < factories_.size(); ++i)
+                    delete factories_[i];
+                factories_.clear();
+            }
+
+            bool empty() const
+            {
+                return threads_.empty();
+            }
+
+            /// Factory to register instead of `factory`.  Owned by the pool.
+            ::IUnknown* wrap(::IUnknown* factory)
+            {
+                std::auto_ptr<apartment_class_factory> wrapper(
+                    new apartment_class_factory(
+                        *this, try_cast(com_ptr< ::IUnknown>(factory))));
+                factories_.push_back(wrapper.get());
+                return wrapper.release();
+            }
+
+            /// Apartments take activations in turn.
+            apartment_thread& next()
+            {
+                size_t index = static_cast<size_t>(
+                    InterlockedIncrement(&next_)) % threads_.size();
+                return *threads_[index];
+            }
+
+        private:
+            apartment_pool(const apartment_pool&);
+            apartment_pool& operator=(const apartment_pool&);
+
+            long next_;
+            std::vector<apartment_thread*> threads_;
+            std::vector<apartment_class_factory*> factories_;
+        };
+
+        inline STDMETHODIMP apartment_class_factory::CreateInstance(
+            ::IUnknown *pUnkOuter, REFIID riid, void **ppv)
+        {
+            if (!ppv) return E_POINTER;
+            *ppv = 0;
+
+            // An outer object can't aggregate across apartments
+            if (pUnkOuter) return CLASS_E_NOAGGREGATION;
+
+            try
+            {
+                future< com_ptr<IStream> > marshalled =
+                    pool_.next().dispatcher().post< com_ptr<IStream> >(
+                        apartment_activation(factory_, riid));
+                wait_with_message_loop(marshalled.completion_event());
+
+                return ::CoGetInterfaceAndReleaseStream(
+                    marshalled.get().detach(), riid, ppv);
+            }
+            catch (const com_error& e)
+            {
+                return return_com_error(e);
+            }
+            catch (const std::exception& e)
+            {
+                return return_com_error(e);
+            }
+        }
+
         template <typename CLS_LIST> struct register_class_entry
         {
             typedef COMET_STRICT_TYPENAME CLS_LIST::head  CLASS;
@@ -40,18 +328,31 @@ namespace comet {
                 static register_info<CLASS> info;
                 return info;
             }
-            COMET_FORCEINLINE static HRESULT register_class_object(DWORD context, DWORD flags)
+            COMET_FORCEINLINE static HRESULT register_class_object(DWORD context, DWORD flags, apartment_pool* pool)
             {
                 const IID& clsid = comtype<CLASS>::uuid();
                 ::IUnknown* p = impl::coclass_table_entry<CLASS, false>::factory::get(clsid);
                 if (p)
                 {
-                    HRESULT hr = ::CoRegisterClassObject(clsid, p, context, flags, &get_register_info().id);
+                    ::IUnknown* registered = p;
+                    if (pool)
+                    {
+                        try {
+                            registered = pool->wrap(p);
+                        }
+                        catch (const com_error& e)
+                        {
+                            p->Release();
+                            return e.hr();
+                        }
+                    }
+
+                    HRESULT hr = ::CoRegisterClassObject(clsid, registered, context, flags, &get_register_info().id);
                     p->Release();
                     if (hr != S_OK)
                         return hr;
                 }
-                return register_class_entry<NEXT>::register_class_object(context, flags);
+                return register_class_entry<NEXT>::register_class_object(context, flags, pool);
             }
 
             COMET_FORCEINLINE static void revoke_class_object()
@@ -63,10 +364,11 @@ namespace comet {
 
         template <> struct register_class_entry<nil>
         {
-            COMET_FORCEINLINE static HRESULT register_class_object(DWORD context, DWORD flags)
+            COMET_FORCEINLINE static HRESULT register_class_object(DWORD context, DWORD flags, apartment_pool* pool)
             {
                 COMET_NOTUSED(context);
                 COMET_NOTUSED(flags);
+                COMET_NOTUSED(pool);
                 return S_OK;
             }
 
@@ -80,7 +382,24 @@ namespace comet {
      */
     //@{
 
-    //! Define an EXE server
+    /** Define an EXE server.
+     *
+     * By default the objects of a server that isn't FREE_THREADED all live
+     * in the single-threaded apartment of the thread that calls run(), so
+     * calls on every object are serialised.  apartment_threads() spreads
+     * the objects across a pool of single-threaded apartments instead: each
+     * activation creates its object in the next apartment in turn, and
+     * calls on objects in different apartments then run in parallel.
+     *
+     * Free-threaded servers don't need the pool; their objects already
+     * take calls on COM's own pool of RPC threads.
+     *
+     * The server shuts down once the module has had no locks for an idle
+     * period, and then waits for calls still in progress to release their
+     * locks.  The second wait ends as soon as the last lock is released
+     * rather than after a fixed pause.  Both limits can be set with
+     * shutdown_delays().
+     */
     template<typename TYPELIB, bool FREE_THREADED = false, typename TRAITS = com_server_traits<0> > class exe_server : private thread
     {
 #if  !(_WIN32_WINNT >= 0x0400 ) && !defined(_WIN32_DCOM)
@@ -104,18 +423,48 @@ namespace comet {
         HRESULT register_class_objects(DWORD context, DWORD flags);
         void revoke_class_objects();
 
+        /** Create objects in a pool of single-threaded apartments.
+         *
+         * Call before run().  0, the default, creates them all in the
+         * apartment that calls run().  Ignored by free-threaded servers.
+         *
+         * \param thread_count  Number of apartments.
+         */
+        void apartment_threads(size_t thread_count);
+
+        /** Set the grace periods for shutting down.
+         *
+         * \param idle_time   Milliseconds the module must go without locks
+         *                    before the server stops taking activations.
+         *                    Default 5000.  0 stops as soon as the last lock
+         *                    is released.
+         * \param drain_time  Most milliseconds to wait, after that, for calls
+         *                    in progress to release their locks.  Default
+         *                    1000.
+         */
+        void shutdown_delays(DWORD idle_time, DWORD drain_time);
+
     private:
         event shutdown_event_;
+        DWORD idle_shutdown_time_;
+        DWORD terminate_pause_;
+        size_t apartment_thread_count_;
+        impl::apartment_pool apartments_;
         DWORD main_thread_id_;
         const GUID* appid_;
         tstring appid_descr_;
 
+        void wait_for_calls_to_drain();
+
         virtual DWORD thread_main();
     };
     //@}
 
     template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
     exe_server<TYPELIB, FREE_THREADED, TRAITS>::exe_server(HINSTANCE instance):
+        idle_shutdown_time_(idle_shutdown_time),
+        terminate_pause_(terminate_pause),
+        apartment_thread_count_(0),
         main_thread_id_(::GetCurrentThreadId()),
         appid_(0)
     {
@@ -130,6 +479,9 @@ namespace comet {
 
     template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
     exe_server<TYPELIB, FREE_THREADED, TRAITS>::exe_server(HINSTANCE instance, const GUID& appid, const tstring& appid_descr):
+        idle_shutdown_time_(idle_shutdown_time),
+        terminate_pause_(terminate_pause),
+        apartment_thread_count_(0),
         main_thread_id_(::GetCurrentThreadId()),
         appid_(&appid), appid_descr_(appid_descr)
     {
@@ -151,6 +503,18 @@ namespace comet {
     template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
     HRESULT exe_server<TYPELIB, FREE_THREADED, TRAITS>::run()
     {
+        if (!FREE_THREADED && apartment_thread_count_ > 0)
+        {
+            try {
+                apartments_.start(apartment_thread_count_);
+            }
+            catch (const com_error& e)
+            {
+                apartments_.stop();
+                return e.hr();
+            }
+        }
+
         thread::start();
 
         HRESULT hr;
@@ -178,7 +542,8 @@ namespace comet {
         }
 
         revoke_class_objects();
-        Sleep(terminate_pause); //wait for any threads to finish
+        wait_for_calls_to_drain();
+        apartments_.stop();
 
         module().shutdown();
 
@@ -244,7 +609,37 @@ namespace comet {
     template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
     HRESULT exe_server<TYPELIB, FREE_THREADED, TRAITS>::register_class_objects(DWORD context, DWORD flags)
     {
-        return impl::register_class_entry<TYPELIB::coclasses>::register_class_object(context, flags);
+        return impl::register_class_entry<TYPELIB::coclasses>::register_class_object(
+            context, flags, apartments_.empty() ? 0 : &apartments_);
+    }
+
+    template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
+    void exe_server<TYPELIB, FREE_THREADED, TRAITS>::apartment_threads(size_t thread_count)
+    {
+        apartment_thread_count_ = thread_count;
+    }
+
+    template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
+    void exe_server<TYPELIB, FREE_THREADED, TRAITS>::shutdown_delays(DWORD idle_time, DWORD drain_time)
+    {
+        idle_shutdown_time_ = idle_time;
+        terminate_pause_ = drain_time;
+    }
+
+    template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
+    void exe_server<TYPELIB, FREE_THREADED, TRAITS>::wait_for_calls_to_drain()
+    {
+        module_t& m = module();
+
+        // The shutdown event is set each time the lock count falls to zero
+        DWORD start = ::GetTickCount();
+        while (m.lock_count() != 0)
+        {
+            DWORD elapsed = ::GetTickCount() - start;
+            if (elapsed >= terminate_pause_)
+                break;
+            shutdown_event_.wait(terminate_pause_ - elapsed);
+        }
     }
 
     template<typename TYPELIB, bool FREE_THREADED, typename TRAITS>
@@ -264,7 +659,7 @@ namespace comet {
             do
             {
                 m.reset_activity_flag();
-            } while (shutdown_event_.wait(idle_shutdown_time));
+            } while (shutdown_event_.wait(idle_shutdown_time_));
             // timed out
 
             if (!m.has_activity()) // if no activity let's really bail
@@ -23,7 +23,75 @@
 
 #include <comet/ptr.h>
 
+#include <map>
+
 namespace comet {
+
+    namespace impl {
+
+        /** Proxies one thread has fetched from the GIT.
+         * \internal
+         */
+        struct git_thread_cache
+        {
+            git_thread_cache() : revocations(0) {}
+
+            typedef std::map<DWORD, com_ptr< ::IUnknown> > PROXIES;
+            PROXIES proxies;
+
+            /// Process revocation count when the proxies were last valid.
+            long revocations;
+        };
+
+        /** Process-wide state of the per-thread GIT proxy caches.
+         * Templated only so that the statics can be defined in the header.
+         * \internal
+         */
+        template<typename T> struct git_cache_state
+        {
+            /// Bumped by every revocation so that other threads discard
+            /// proxies that may be stale.
+            static long volatile revocations;
+
+            /// TLS index plus one, or 0 until first used.
+            static long volatile tls_slot;
+
+            static DWORD tls_index()
+            {
+                if (tls_slot == 0)
+                {
+                    DWORD index = ::TlsAlloc();
+                    if (index == TLS_OUT_OF_INDEXES)
+                        raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+                    // Another thread may have got there first
+                    if (InterlockedCompareExchange(
+                            &tls_slot, static_cast<long>(index) + 1, 0) != 0)
+                        ::TlsFree(index);
+                }
+                return static_cast<DWORD>(tls_slot - 1);
+            }
+
+            static git_thread_cache* get(bool create)
+            {
+                DWORD index = tls_index();
+                git_thread_cache* cache =
+                    static_cast<git_thread_cache*>(::TlsGetValue(index));
+                if (!cache && create)
+                {
+                    cache = new git_thread_cache();
+                    cache->revocations = revocations;
+                    ::TlsSetValue(index, cache);
+                }
+                return cache;
+            }
+        };
+
+        template<typename T> long volatile git_cache_state<T>::revocations = 0;
+        template<typename T> long volatile git_cache_state<T>::tls_slot = 0;
+
+        typedef git_cache_state<void> git_cache;
+    }
     /*! \addtogroup COMType
      */
     //@{
@@ -74,6 +142,56 @@ namespace comet {
             return auto_attach(itf);
         }
 
+        /** Retrieve Interface from the GIT, reusing this thread's proxy.
+          *
+          * The first fetch of a cookie on a thread unmarshals a proxy as
+          * get_interface() does and keeps it.  Later fetches on the same
+          * thread return the kept proxy without calling into COM, until any
+          * thread revokes a cookie through this class.
+          *
+          * A thread that uses this must call release_thread_cache() before
+          * it calls CoUninitialize or exits, or the proxies are leaked.
+          * Revocations made directly through IGlobalInterfaceTable are not
+          * noticed.
+          *
+          * \param c Cookie
+          * \return Marshalled interface.
+          */
+        template<typename Itf>
+        com_ptr<Itf> get_cached_interface(GIT_cookie<Itf> const& c)
+        {
+            impl::git_thread_cache* cache = impl::git_cache::get(true);
+
+            long revocations = impl::git_cache::revocations;
+            if (cache->revocations != revocations)
+            {
+                cache->proxies.clear();
+                cache->revocations = revocations;
+            }
+
+            impl::git_thread_cache::PROXIES::const_iterator it =
+                cache->proxies.find(c.get_cookie());
+            if (it != cache->proxies.end())
+                return static_cast<Itf*>(it->second.get());
+
+            com_ptr<Itf> itf = get_interface(c);
+            cache->proxies[c.get_cookie()] = itf;
+            return itf;
+        }
+
+        /** Release the proxies get_cached_interface() kept for the calling
+          * thread.
+          */
+        static void release_thread_cache()
+        {
+            impl::git_thread_cache* cache = impl::git_cache::get(false);
+            if (cache)
+            {
+                ::TlsSetValue(impl::git_cache::tls_index(), 0);
+                delete cache;
+            }
+        }
+
         /** Revoke the cookie from the GIT.
           * \param c Cookie.
           */
@@ -81,6 +199,7 @@ namespace comet {
         void revoke_interface(GIT_cookie<Itf> const& c)
         {
             HRESULT hr = git_->RevokeInterfaceFromGlobal(c.get_cookie());
+            InterlockedIncrement(&impl::git_cache::revocations);
             hr;
             assert(SUCCEEDED(hr));
         }
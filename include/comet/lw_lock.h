@@ -37,12 +37,19 @@
 
   This class is very lightweight. It does not use any kernel objects.
   It is designed for rapid access to resources without requiring
-  code to undergo process and ring changes. Because the "spin"
-  method for this lock is "Sleep(0)", it is a good idea to keep
-  the lock only long enough for short operations; otherwise, CPU
-  will be wasted spinning for the lock. You can change the spin
-  mechanism by #define'ing COMET_LW_LOCK_SPIN before including this
-  header file.
+  code to undergo process and ring changes. A thread that has to wait
+  first spins briefly, pausing the CPU for twice as long each time up
+  to COMET_LW_LOCK_MAX_SPIN pause instructions, as the lock is usually
+  released quickly.  If the lock is still not available, the thread
+  parks: on Windows 8 and later (_WIN32_WINNT >= 0x0602) it blocks in
+  WaitOnAddress until the lock word changes; on earlier versions it
+  gives up the processor to another thread, with SwitchToThread or
+  Sleep(0), up to COMET_LW_LOCK_MAX_YIELD times and only then sleeps for a
+  millisecond (or a timer tick) at a time.  Threads that release the lock
+  only make a wake-up call when some thread is parked.
+
+  You can restore the old fixed spin by #define'ing COMET_LW_LOCK_SPIN
+  before including this header file, for example as Sleep(0).
 
   VERY VERY IMPORTANT: If you have a lock open with read access and
   attempt to get write access as well, you will deadlock! Always
@@ -70,16 +77,110 @@
  * https://github.com/alamaison/comet
  */
 
+#ifndef COMET_LW_LOCK_H
+#define COMET_LW_LOCK_H
+
 #include <comet/config.h>
 #include <comet/assert.h>
 
 #include <windows.h>
 
+#ifndef COMET_LW_LOCK_MAX_SPIN
+#define COMET_LW_LOCK_MAX_SPIN 1024
+#endif
+
+#ifndef COMET_LW_LOCK_MAX_YIELD
+#define COMET_LW_LOCK_MAX_YIELD 64
+#endif
+
+#if !defined(COMET_LW_LOCK_SPIN) && !defined(COMET_LW_LOCK_NO_WAIT_ON_ADDRESS) \
+    && defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+#define COMET_LW_LOCK_WAIT_ON_ADDRESS
+#ifdef _MSC_VER
+#pragma comment( lib, "Synchronization" )
+#endif
+#endif
+
 namespace comet {
 
-#ifndef COMET_LW_LOCK_SPIN
-#define COMET_LW_LOCK_SPIN Sleep(0)
+    namespace impl {
+
+        /** Waits for an lw_lock word to change, spinning then parking.
+         * \internal
+         */
+        class lw_lock_backoff
+        {
+        public:
+            lw_lock_backoff() : spins_(1), yields_(0) {}
+
+            /**
+             * Wait a while for `word` to change from `seen`.
+             * Returns early, or spuriously, so callers must check again.
+             */
+            void wait(long volatile& word, long seen, long volatile& parked)
+            {
+#ifdef COMET_LW_LOCK_SPIN
+                COMET_NOTUSED(word);
+                COMET_NOTUSED(seen);
+                COMET_NOTUSED(parked);
+                COMET_LW_LOCK_SPIN;
+#else
+                if (spins_ <= COMET_LW_LOCK_MAX_SPIN)
+                {
+                    for (unsigned long i = 0; i < spins_; ++i)
+                        YieldProcessor();
+                    spins_ *= 2;
+                    return;
+                }
+
+#ifdef COMET_LW_LOCK_WAIT_ON_ADDRESS
+                // Count ourselves before checking the word so that a thread
+                // changing it either sees us or we see its change
+                InterlockedIncrement(&parked);
+                if (word == seen)
+                {
+                    ::WaitOnAddress(
+                        const_cast<long*>(&word), &seen, sizeof(long),
+                        INFINITE);
+                }
+                InterlockedDecrement(&parked);
+#else
+                COMET_NOTUSED(word);
+                COMET_NOTUSED(seen);
+                COMET_NOTUSED(parked);
+                if (yields_ < COMET_LW_LOCK_MAX_YIELD)
+                {
+                    // The holder may be waiting for this processor
+                    ++yields_;
+                    if (!::SwitchToThread())
+                        ::Sleep(0);
+                }
+                else
+                {
+                    // Held for a long time: stop taking processor time
+                    ::Sleep(1);
+                }
+#endif
 #endif
+            }
+
+            /// Wake threads parked on `word` after changing it.
+            static void wake(long volatile& word, long volatile& parked)
+            {
+#ifdef COMET_LW_LOCK_WAIT_ON_ADDRESS
+                if (parked != 0)
+                    ::WakeByAddressAll(const_cast<long*>(&word));
+#else
+                COMET_NOTUSED(word);
+                COMET_NOTUSED(parked);
+#endif
+            }
+
+        private:
+            unsigned long spins_;
+            unsigned long yields_;
+        };
+    }
     /*! \addtogroup Misc
      */
     //@{
@@ -98,6 +199,7 @@ namespace comet {
         {
             reader_count_ = 0;
             writer_count_ = 0;
+            parked_ = 0;
         }
 
         ///  Destructor
@@ -110,14 +212,15 @@ namespace comet {
         ///  Reader lock acquisition
         void enter_reader() const
         {
+            impl::lw_lock_backoff backoff;
             for (;;)
             {
-                //  If there's a writer already, spin without unnecessarily
+                //  If there's a writer already, wait without unnecessarily
                 //  interlocking the CPUs
 
                 if( writer_count_ != 0 )
                 {
-                    COMET_LW_LOCK_SPIN;
+                    backoff.wait(writer_count_, 1, parked_);
                     continue;
                 }
 
@@ -131,44 +234,53 @@ namespace comet {
                 if( writer_count_ == 0 )
                     break;
 
-                //  Remove from the readers list, spin, try again
+                //  Remove from the readers list (waking the writer if we
+                //  were the last), wait, try again
 
-                InterlockedDecrement((long *)&reader_count_ );
-                COMET_LW_LOCK_SPIN;
+                leave_reader();
+                backoff.wait(writer_count_, 1, parked_);
             }
         }
 
         ///  Reader lock release
         void leave_reader() const
         {
-            InterlockedDecrement((long *)&reader_count_ );
+            if (InterlockedDecrement((long *)&reader_count_ ) == 0)
+                impl::lw_lock_backoff::wake(reader_count_, parked_);
         }
 
         /// Writer lock acquisition
         void enter_writer()
         {
+            impl::lw_lock_backoff backoff;
+
             //  See if we can become the writer (expensive, because it inter-
             //  locks the CPUs, so writing should be an infrequent process)
 
             while( InterlockedExchange((long *)&writer_count_, 1 ) == 1 )
             {
-                COMET_LW_LOCK_SPIN;
+                backoff.wait(writer_count_, 1, parked_);
             }
 
             //  Now we're the writer, but there may be outstanding readers.
-            //  Spin until there aren't any more; new readers will wait now
+            //  Wait until there aren't any more; new readers will wait now
             //  that we're the writer.
 
-            while( reader_count_ != 0 )
+            for (;;)
             {
-                COMET_LW_LOCK_SPIN;
+                long readers = reader_count_;
+                if (readers == 0)
+                    break;
+                backoff.wait(reader_count_, readers, parked_);
             }
         }
 
         ///  Writer lock release
         void leave_writer()
         {
-            writer_count_ = 0;
+            // Interlocked for the barrier that wake() relies on
+            InterlockedExchange((long *)&writer_count_, 0 );
+            impl::lw_lock_backoff::wake(writer_count_, parked_);
         }
 
     //  Implementation
@@ -176,6 +288,7 @@ namespace comet {
     private:
         mutable long volatile reader_count_;
         mutable long volatile writer_count_;
+        mutable long volatile parked_; ///< Threads blocked in WaitOnAddress.
 
         // Declare class non-copyable
         lw_lock(const lw_lock&);
@@ -226,3 +339,5 @@ namespace comet {
     //@}
 
 }
+
+#endif
@@ -0,0 +1,591 @@
+/** \file
+  * Read-only IStream over a memory-mapped file.
+  *
+  * See \ref cometmappedfilestream.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_MAPPED_FILE_STREAM_H
+#define COMET_MAPPED_FILE_STREAM_H
+
+#include <comet/config.h>
+
+#include <comet/bstr.h> // bstr_t
+#include <comet/error.h> // com_error, raise_exception
+#include <comet/handle.h> // auto_handle
+#include <comet/handle_except.h> // COMET_CATCH_CLASS_INTERFACE_BOUNDARY
+#include <comet/server.h> // simple_object
+#include <comet/stream_common.h> // seek_position, ...
+
+#include <cstring> // memcpy
+#include <limits> // numeric_limits
+#include <vector>
+
+#include <strsafe.h> // StringCbCopyW
+
+/** \page cometmappedfilestream Memory-mapped file stream
+    mapped_file_stream serves a file to COM clients through IStream by
+    mapping the whole file into memory.  `Read` copies straight out of the
+    mapping, so there is no stream buffer in between and no system call per
+    read.  `CopyTo` copies the mapped bytes through one buffer per call
+    rather than handing the destination pointers into the mapping, so that
+    an I/O error paging the file in is reported as `STG_E_READFAULT`
+    instead of faulting inside the destination's `Write`.
+
+    \code
+        com_ptr<IStream> file = new mapped_file_stream(L"C:\\data\\big.bin");
+    \endcode
+
+    The stream is read-only.  The file is opened with write sharing denied,
+    as a mapped file changing or shrinking underneath the mapping would show
+    through as corrupt data or faults.
+
+    `Clone` gives a new stream, with its own seek position, over the same
+    mapping, so clones cost no more than the object.  The mapping is released
+    with the last of them.
+
+    When a stream is read sequentially it asks the memory manager to bring in
+    the next COMET_MAPPED_FILE_READAHEAD bytes ahead of the reads (with
+    PrefetchVirtualMemory, when _WIN32_WINNT is at least 0x0602), rather than
+    faulting the file in a page at a time.
+
+    The whole file is mapped at once, so it must fit in the address space:
+    files of several gigabytes need a 64-bit process.
+*/
+
+/**
+ * Bytes a sequentially read mapped_file_stream prefetches ahead of the
+ * read position.  Also the most `CopyTo` buffers and passes to each
+ * destination `Write`.
+ */
+#ifndef COMET_MAPPED_FILE_READAHEAD
+#define COMET_MAPPED_FILE_READAHEAD (4 * 1024 * 1024)
+#endif
+
+namespace comet {
+
+    namespace impl {
+
+        /** Read-only view of a whole file, shared by a stream and its clones.
+         * \internal
+         */
+        class file_view
+        {
+        public:
+            explicit file_view(const bstr_t& path)
+                : rc_(1), path_(path), base_(0), size_(0)
+            {
+                HANDLE file = ::CreateFileW(
+                    path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                    OPEN_EXISTING,
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+                if (file == INVALID_HANDLE_VALUE)
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                file_ = auto_attach(file);
+
+                LARGE_INTEGER size;
+                if (!::GetFileSizeEx(file_.get(), &size))
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+                if (static_cast<ULONGLONG>(size.QuadPart) >
+                    (std::numeric_limits<SIZE_T>::max)())
+                {
+                    throw com_error(
+                        "File too large to map", STG_E_INSUFFICIENTMEMORY);
+                }
+                size_ = size.QuadPart;
+
+                // A file of no bytes cannot be mapped, nor need it be
+                if (size_ != 0U)
+                {
+                    mapping_ = auto_attach(::CreateFileMappingW(
+                        file_.get(), 0, PAGE_READONLY, 0, 0, 0));
+                    if (!mapping_.valid())
+                        raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+                    base_ = static_cast<const unsigned char*>(::MapViewOfFile(
+                        mapping_.get(), FILE_MAP_READ, 0, 0, 0));
+                    if (!base_)
+                        raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                }
+            }
+
+            ~file_view()
+            {
+                if (base_)
+                    ::UnmapViewOfFile(base_);
+            }
+
+            void add_ref() { InterlockedIncrement(&rc_); }
+            void release() { if (InterlockedDecrement(&rc_) == 0) delete this; }
+
+            const unsigned char* data() const { return base_; }
+            ULONGLONG size() const { return size_; }
+            HANDLE file() const { return file_.get(); }
+            const bstr_t& path() const { return path_; }
+
+            /// Ask for a range of the view to be read in before it is touched.
+            void prefetch(ULONGLONG offset, ULONGLONG length) const
+            {
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+                WIN32_MEMORY_RANGE_ENTRY range;
+                range.VirtualAddress =
+                    const_cast<unsigned char*>(base_ + offset);
+                range.NumberOfBytes = static_cast<SIZE_T>(length);
+
+                // Only a hint, so failure doesn't matter
+                ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+#else
+                (void)offset;
+                (void)length;
+#endif
+            }
+
+        private:
+            file_view(const file_view&);
+            file_view& operator=(const file_view&);
+
+            long rc_;
+            bstr_t path_;
+            auto_handle file_;
+            auto_handle mapping_;
+            const unsigned char* base_;
+            ULONGLONG size_;
+        };
+
+        /**
+         * Copy bytes out of a mapped view.
+         *
+         * An I/O error paging the file in surfaces as an access exception
+         * rather than an error code; this turns it into a `false` return.
+         * \internal
+         */
+        inline bool copy_from_view(
+            void* destination, const unsigned char* source, size_t size)
+        {
+#ifdef _MSC_VER
+            __try
+            {
+                std::memcpy(destination, source, size);
+                return true;
+            }
+            __except (
+                (::GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+                EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+            {
+                return false;
+            }
+#else
+            std::memcpy(destination, source, size);
+            return true;
+#endif
+        }
+    }
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /** \class mapped_file_stream  mapped_file_stream.h comet/mapped_file_stream.h
+      * Read-only IStream served from a memory-mapped file.
+      * See \ref cometmappedfilestream.
+      */
+    class mapped_file_stream : public simple_object<IStream>
+    {
+    public:
+        /// Open and map the file at `path`.  Throws com_error on failure.
+        explicit mapped_file_stream(const bstr_t& path)
+            : view_(new impl::file_view(path)), position_(0U),
+            sequential_end_(0U), readahead_end_(0U)
+        {}
+
+        ~mapped_file_stream()
+        {
+            view_->release();
+        }
+
+        /**
+         * Copy bytes from the mapping at the seek position.
+         *
+         * @retval `S_OK`     If `buffer` was filled.
+         * @retval `S_FALSE`  If the end of the file came first.
+         *                    `*read_count_out` gives the bytes read.
+         * @retval `STG_E_READFAULT`  If the file could not be paged in.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Read(
+            void* buffer, ULONG buffer_size, ULONG* read_count_out)
+        {
+            if (read_count_out)
+            {
+                *read_count_out = 0U;
+            }
+
+            try
+            {
+                if (!buffer)
+                {
+                    throw com_error("No buffer given", STG_E_INVALIDPOINTER);
+                }
+
+                ULONG count = static_cast<ULONG>(
+                    min(static_cast<ULONGLONG>(buffer_size), remaining()));
+
+                read_ahead(count);
+
+                if (count != 0U &&
+                    !impl::copy_from_view(
+                        buffer, view_->data() + position_, count))
+                {
+                    throw com_error(
+                        "Unable to read from mapped file", STG_E_READFAULT);
+                }
+
+                position_ += count;
+                sequential_end_ = position_;
+
+                if (read_count_out)
+                {
+                    *read_count_out = count;
+                }
+
+                return (count < buffer_size) ? S_FALSE : S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Read", "mapped_file_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE Write(
+            const void* /*data*/, ULONG /*data_size*/,
+            ULONG* written_count_out)
+        {
+            if (written_count_out)
+            {
+                *written_count_out = 0U;
+            }
+
+            try
+            {
+                throw com_error(
+                    "mapped_file_stream is read-only", STG_E_ACCESSDENIED);
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Write", "mapped_file_stream");
+        }
+
+        /**
+         * Move the seek position.
+         *
+         * As with other IStreams, seeking past the end is allowed; reads
+         * from there return no bytes.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Seek(
+            LARGE_INTEGER offset, DWORD origin,
+            ULARGE_INTEGER* new_position_out)
+        {
+            if (new_position_out)
+            {
+                new_position_out->QuadPart = position_;
+            }
+
+            try
+            {
+                position_ = impl::seek_position(
+                    position_, view_->size(), offset, origin);
+
+                if (new_position_out)
+                {
+                    new_position_out->QuadPart = position_;
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Seek", "mapped_file_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER /*new_size*/)
+        {
+            try
+            {
+                throw com_error(
+                    "mapped_file_stream is read-only", STG_E_ACCESSDENIED);
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "SetSize", "mapped_file_stream");
+        }
+
+        /**
+         * Write bytes from the seek position to another stream.
+         *
+         * The bytes go to the destination's `Write` in pieces of at most
+         * COMET_MAPPED_FILE_READAHEAD bytes, each copied out of the mapping
+         * first so that a fault paging it in can be caught.
+         *
+         * @retval `STG_E_READFAULT`  If the file could not be paged in.
+         */
+        virtual HRESULT STDMETHODCALLTYPE CopyTo(
+            IStream* destination, ULARGE_INTEGER amount,
+            ULARGE_INTEGER* bytes_read_out, ULARGE_INTEGER* bytes_written_out)
+        {
+            ULARGE_INTEGER dummy_read_out;
+            if (!bytes_read_out)
+            {
+                bytes_read_out = &dummy_read_out;
+            }
+            bytes_read_out->QuadPart = 0U;
+
+            ULARGE_INTEGER dummy_written_out;
+            if (!bytes_written_out)
+            {
+                bytes_written_out = &dummy_written_out;
+            }
+            bytes_written_out->QuadPart = 0U;
+
+            try
+            {
+                if (!destination)
+                {
+                    throw com_error(
+                        "Destination stream not given", STG_E_INVALIDPOINTER);
+                }
+
+                ULONGLONG total = min(amount.QuadPart, remaining());
+                std::vector<unsigned char> buffer(static_cast<size_t>(
+                    min(
+                        total,
+                        static_cast<ULONGLONG>(COMET_MAPPED_FILE_READAHEAD))));
+
+                while (bytes_read_out->QuadPart < total)
+                {
+                    ULONG chunk = static_cast<ULONG>(
+                        min(
+                            total - bytes_read_out->QuadPart,
+                            static_cast<ULONGLONG>(
+                                COMET_MAPPED_FILE_READAHEAD)));
+
+                    read_ahead(chunk);
+
+                    if (!impl::copy_from_view(
+                            &buffer[0], view_->data() + position_, chunk))
+                    {
+                        throw com_error(
+                            "Unable to read from mapped file",
+                            STG_E_READFAULT);
+                    }
+
+                    ULONG written = 0U;
+                    HRESULT hr = destination->Write(
+                        &buffer[0], chunk, &written);
+
+                    // The bytes are read whether or not the write took them
+                    position_ += chunk;
+                    sequential_end_ = position_;
+                    bytes_read_out->QuadPart += chunk;
+                    bytes_written_out->QuadPart += written;
+
+                    if (FAILED(hr))
+                    {
+                        throw com_error_from_interface(destination, hr);
+                    }
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "CopyTo", "mapped_file_stream");
+        }
+
+        /// Nothing is ever written so there is nothing to commit.
+        virtual HRESULT STDMETHODCALLTYPE Commit(DWORD /*commit_flags*/)
+        {
+            return S_OK;
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE Revert()
+        {
+            try
+            {
+                throw impl::transactions_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "Revert", "mapped_file_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE LockRegion(
+            ULARGE_INTEGER /*offset*/, ULARGE_INTEGER /*extent*/,
+            DWORD /*lock_type*/)
+        {
+            try
+            {
+                throw impl::locking_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "LockRegion", "mapped_file_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE UnlockRegion(
+            ULARGE_INTEGER /*offset*/, ULARGE_INTEGER /*extent*/,
+            DWORD /*lock_type*/)
+        {
+            try
+            {
+                throw impl::locking_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "UnlockRegion", "mapped_file_stream");
+        }
+
+        /**
+         * Get the size, times and, unless `STATFLAG_NONAME` is given, the
+         * path the stream was opened with.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Stat(
+            STATSTG* attributes_out, DWORD stat_flag)
+        {
+            try
+            {
+                if (!attributes_out)
+                {
+                    throw com_error("STATSTG not given", STG_E_INVALIDPOINTER);
+                }
+
+                *attributes_out = STATSTG();
+
+                attributes_out->type = STGTY_STREAM;
+                attributes_out->cbSize.QuadPart = view_->size();
+                attributes_out->grfMode = STGM_READ | STGM_SHARE_DENY_WRITE;
+
+                if (!::GetFileTime(
+                        view_->file(), &attributes_out->ctime,
+                        &attributes_out->atime, &attributes_out->mtime))
+                {
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                }
+
+                // Must be last as, after we allocate, any failure will leak
+                // memory
+                if (!(stat_flag & STATFLAG_NONAME))
+                {
+                    size_t buffer_size_in_bytes =
+                        (view_->path().size() + 1) * sizeof(wchar_t);
+
+                    attributes_out->pwcsName = static_cast<LPOLESTR>(
+                        ::CoTaskMemAlloc(buffer_size_in_bytes));
+                    if (!attributes_out->pwcsName)
+                    {
+                        throw com_error(
+                            "Unable to allocate memory for stream name",
+                            STG_E_INSUFFICIENTMEMORY);
+                    }
+
+                    HRESULT hr = ::StringCbCopyW(
+                        attributes_out->pwcsName, buffer_size_in_bytes,
+                        view_->path().c_str());
+                    if (FAILED(hr))
+                    {
+                        ::CoTaskMemFree(attributes_out->pwcsName);
+                        attributes_out->pwcsName = NULL;
+                        throw com_error(
+                            "Unable to copy stream name to STATSTG", hr);
+                    }
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Stat", "mapped_file_stream");
+        }
+
+        /**
+         * New stream over the same mapping, starting at this stream's seek
+         * position but moving independently of it.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Clone(IStream** stream_out)
+        {
+            if (stream_out)
+            {
+                *stream_out = NULL;
+            }
+
+            try
+            {
+                if (!stream_out)
+                {
+                    throw com_error(
+                        "No out-pointer given", STG_E_INVALIDPOINTER);
+                }
+
+                com_ptr<IStream> clone =
+                    new mapped_file_stream(*view_, position_);
+                *stream_out = clone.detach();
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Clone", "mapped_file_stream");
+        }
+
+    private:
+        mapped_file_stream(impl::file_view& view, ULONGLONG position)
+            : view_(&view), position_(position),
+            sequential_end_(position), readahead_end_(position)
+        {
+            view_->add_ref();
+        }
+
+        mapped_file_stream(const mapped_file_stream&);
+        mapped_file_stream& operator=(const mapped_file_stream&);
+
+        ULONGLONG remaining() const
+        {
+            return (position_ < view_->size()) ?
+                view_->size() - position_ : 0U;
+        }
+
+        /**
+         * Keep the prefetched range ahead of a sequential reader that is
+         * about to read `count` bytes.
+         *
+         * The next range is requested once the reader is within half a
+         * window of the end of the last one, so the memory manager has time
+         * to bring it in.  Reads after a seek elsewhere are not sequential
+         * and prefetch nothing.
+         */
+        void read_ahead(ULONG count)
+        {
+            if (position_ != sequential_end_)
+            {
+                readahead_end_ = position_;
+                return;
+            }
+
+            const ULONGLONG window = COMET_MAPPED_FILE_READAHEAD;
+
+            if (position_ + count + window / 2 > readahead_end_ &&
+                readahead_end_ < view_->size())
+            {
+                ULONGLONG start = max(readahead_end_, position_);
+                ULONGLONG end = min(position_ + count + window, view_->size());
+                if (start < end)
+                {
+                    view_->prefetch(start, end - start);
+                    readahead_end_ = end;
+                }
+            }
+        }
+
+        impl::file_view* view_;
+        ULONGLONG position_;
+        ULONGLONG sequential_end_;
+        ULONGLONG readahead_end_;
+    };
+
+    //@}
+}
+
+#endif
@@ -0,0 +1,693 @@
+/** \file
+  * IStream over memory, with cheap clones.
+  *
+  * See \ref cometmemorystream.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_MEMORY_STREAM_H
+#define COMET_MEMORY_STREAM_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // com_error
+#include <comet/handle_except.h> // COMET_CATCH_CLASS_INTERFACE_BOUNDARY
+#include <comet/ptr.h> // com_ptr
+#include <comet/server.h> // simple_object
+#include <comet/stream_common.h> // seek_position, ...
+
+#include <algorithm> // upper_bound
+#include <cstring> // memcpy, memset
+#include <deque>
+#include <limits> // numeric_limits
+#include <vector>
+
+/** \page cometmemorystream Memory stream
+    memory_stream is an IStream over memory owned by the stream, for
+    serialising to and from memory without going through an HGLOBAL.
+
+    The bytes are held in a list of chunks.  When the stream outgrows them a
+    new chunk, at least as big as all the existing ones, is added, so
+    growing never copies what has already been written.
+
+    `Clone` is cheap: the clone shares the original's chunks until either
+    stream is written to, at which point the writer takes a copy of its
+    own.
+
+    When serialisation is finished, the bytes can be taken from the stream
+    rather than read out of it:
+
+    \code
+        memory_stream* buffer = new memory_stream(expected_size);
+        com_ptr<IStream> stream = buffer;
+
+        persist->Save(stream.in(), TRUE) | raise_exception;
+
+        std::vector<unsigned char> bytes;
+        buffer->release_bytes(bytes);
+    \endcode
+
+    `release_bytes` hands over the one chunk without copying if everything
+    fitted in the first chunk, as it does when the stream was created with a
+    big enough size.  Otherwise it joins the chunks together.  To take
+    any number of chunks without copying, use `release_chunks`.
+
+    Going the other way, a stream can be created around existing bytes,
+    again without copying them, to load an object from them.
+*/
+
+/**
+ * Smallest chunk a memory_stream allocates when it needs more room.
+ */
+#ifndef COMET_MEMORY_STREAM_CHUNK_SIZE
+#define COMET_MEMORY_STREAM_CHUNK_SIZE 65536
+#endif
+
+namespace comet {
+
+    /// Bytes of a memory_stream in order.  The chunks are full.
+    typedef std::deque< std::vector<unsigned char> > memory_stream_chunks;
+
+    namespace impl {
+
+        /** Bytes of a memory_stream, shared by its clones until written.
+         * \internal
+         */
+        class memory_stream_storage
+        {
+        public:
+            memory_stream_storage() : rc_(1), size_(0U) {}
+
+            void add_ref() { InterlockedIncrement(&rc_); }
+            void release() { if (InterlockedDecrement(&rc_) == 0) delete this; }
+
+            /// Is another stream reading these bytes?
+            bool shared() const { return rc_ > 1; }
+
+            ULONGLONG size() const { return size_; }
+
+            ULONGLONG capacity() const
+            {
+                return (chunks_.empty()) ?
+                    0U : starts_.back() + chunks_.back().size();
+            }
+
+            /// Make room for at least `capacity` bytes.
+            void reserve(ULONGLONG capacity)
+            {
+                if (capacity > (std::numeric_limits<size_t>::max)())
+                {
+                    throw com_error(
+                        "Stream too large for memory", STG_E_MEDIUMFULL);
+                }
+
+                ULONGLONG current = this->capacity();
+                if (capacity <= current)
+                    return;
+
+                // Geometric growth keeps the chunk count logarithmic
+                ULONGLONG chunk = max(
+                    max(
+                        capacity - current,
+                        static_cast<ULONGLONG>(
+                            COMET_MEMORY_STREAM_CHUNK_SIZE)),
+                    current);
+                chunk = min(
+                    chunk,
+                    static_cast<ULONGLONG>(
+                        (std::numeric_limits<size_t>::max)()) - current);
+
+                chunks_.push_back(std::vector<unsigned char>());
+                try
+                {
+                    chunks_.back().resize(static_cast<size_t>(chunk));
+                    starts_.push_back(current);
+                }
+                catch (...)
+                {
+                    chunks_.pop_back();
+                    throw;
+                }
+            }
+
+            /// Take bytes without copying them.
+            void adopt(std::vector<unsigned char>& bytes)
+            {
+                if (bytes.empty())
+                    return;
+
+                chunks_.push_back(std::vector<unsigned char>());
+                chunks_.back().swap(bytes);
+                starts_.push_back(0U);
+                size_ = chunks_.back().size();
+            }
+
+            /** Copy `count` bytes from `position`, which must be in range. */
+            void read(ULONGLONG position, void* buffer, size_t count) const
+            {
+                unsigned char* out = static_cast<unsigned char*>(buffer);
+                for (size_t i = find(position); count != 0U; ++i)
+                {
+                    size_t offset = static_cast<size_t>(position - starts_[i]);
+                    size_t piece = min(chunks_[i].size() - offset, count);
+                    std::memcpy(out, &chunks_[i][offset], piece);
+
+                    out += piece;
+                    position += piece;
+                    count -= piece;
+                }
+            }
+
+            /**
+             * Copy bytes in at `position`, growing as needed.  If `data` is
+             * NULL, write zeros.
+             */
+            void write(ULONGLONG position, const void* data, size_t count)
+            {
+                if (count == 0U)
+                    return;
+
+                reserve(position + count);
+
+                // Bytes between the old end and a write beyond it read as
+                // zero, but may hold data from before a shrinking SetSize
+                if (position > size_)
+                    write(size_, NULL, static_cast<size_t>(position - size_));
+
+                const unsigned char* in =
+                    static_cast<const unsigned char*>(data);
+                ULONGLONG end = position + count;
+                for (size_t i = find(position); count != 0U; ++i)
+                {
+                    size_t offset = static_cast<size_t>(position - starts_[i]);
+                    size_t piece = min(chunks_[i].size() - offset, count);
+                    if (in)
+                    {
+                        std::memcpy(&chunks_[i][offset], in, piece);
+                        in += piece;
+                    }
+                    else
+                    {
+                        std::memset(&chunks_[i][offset], 0, piece);
+                    }
+
+                    position += piece;
+                    count -= piece;
+                }
+
+                size_ = max(size_, end);
+            }
+
+            void resize(ULONGLONG size)
+            {
+                if (size > size_)
+                {
+                    ULONGLONG growth = size - size_;
+                    if (growth > (std::numeric_limits<size_t>::max)())
+                    {
+                        throw com_error(
+                            "Stream too large for memory", STG_E_MEDIUMFULL);
+                    }
+                    write(size_, NULL, static_cast<size_t>(growth));
+                }
+                size_ = size;
+            }
+
+            /**
+             * Chunk `index`, how many of its bytes hold stream data and
+             * where in the stream it starts.
+             */
+            const unsigned char* chunk(
+                size_t index, size_t& length, ULONGLONG& start) const
+            {
+                start = starts_[index];
+                length = static_cast<size_t>(
+                    min(
+                        static_cast<ULONGLONG>(chunks_[index].size()),
+                        size_ - start));
+                return &chunks_[index][0];
+            }
+
+            /// Index of the chunk holding `position`, which must be in range.
+            size_t find(ULONGLONG position) const
+            {
+                return (std::upper_bound(
+                    starts_.begin(), starts_.end(), position) -
+                    starts_.begin()) - 1;
+            }
+
+            /// Copy of the stream data in a single chunk.
+            memory_stream_storage* copy() const
+            {
+                memory_stream_storage* duplicate = new memory_stream_storage;
+                try
+                {
+                    duplicate->reserve(size_);
+                    if (size_ != 0U)
+                        read(0U, &duplicate->chunks_[0][0],
+                             static_cast<size_t>(size_));
+                    duplicate->size_ = size_;
+                }
+                catch (...)
+                {
+                    duplicate->release();
+                    throw;
+                }
+                return duplicate;
+            }
+
+            /// Hand over the chunks, trimmed to the stream data.
+            void release_chunks(memory_stream_chunks& chunks_out)
+            {
+                while (!chunks_.empty() && starts_.back() >= size_)
+                {
+                    chunks_.pop_back();
+                    starts_.pop_back();
+                }
+
+                if (!chunks_.empty())
+                {
+                    chunks_.back().resize(
+                        static_cast<size_t>(size_ - starts_.back()));
+                }
+
+                chunks_out.clear();
+                chunks_out.swap(chunks_);
+                starts_.clear();
+                size_ = 0U;
+            }
+
+        private:
+            ~memory_stream_storage() {}
+
+            memory_stream_storage(const memory_stream_storage&);
+            memory_stream_storage& operator=(const memory_stream_storage&);
+
+            long volatile rc_;
+            memory_stream_chunks chunks_;
+            std::vector<ULONGLONG> starts_;
+            ULONGLONG size_;
+        };
+    }
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /** \class memory_stream  memory_stream.h comet/memory_stream.h
+      * IStream over chunks of memory, with copy-on-write clones.
+      * See \ref cometmemorystream.
+      */
+    class memory_stream : public simple_object<IStream>
+    {
+    public:
+        /**
+         * Create an empty stream.
+         *
+         * \param capacity  Minimum size of the first chunk.  Everything
+         *                  written up to this size can be released
+         *                  without copying.
+         */
+        explicit memory_stream(size_t capacity=0)
+            : storage_(new impl::memory_stream_storage), position_(0U)
+        {
+            try
+            {
+                storage_->reserve(capacity);
+            }
+            catch (...)
+            {
+                storage_->release();
+                throw;
+            }
+        }
+
+        /**
+         * Create a stream holding `bytes`, taking them without copying.
+         * `bytes` is left empty.  The seek position starts at the beginning.
+         */
+        explicit memory_stream(std::vector<unsigned char>& bytes)
+            : storage_(new impl::memory_stream_storage), position_(0U)
+        {
+            storage_->adopt(bytes);
+        }
+
+        ~memory_stream()
+        {
+            storage_->release();
+        }
+
+        /**
+         * Take the stream's bytes in a single vector, leaving the stream
+         * empty.
+         *
+         * Copies nothing if the bytes are all in one chunk and no clone is
+         * sharing them.  Otherwise the bytes are copied into one vector.
+         */
+        void release_bytes(std::vector<unsigned char>& bytes_out)
+        {
+            memory_stream_chunks chunks;
+            release_chunks(chunks);
+
+            if (chunks.size() == 1U)
+            {
+                bytes_out.swap(chunks.front());
+            }
+            else
+            {
+                std::vector<unsigned char> bytes;
+                for (size_t i = 0; i < chunks.size(); ++i)
+                {
+                    bytes.insert(
+                        bytes.end(), chunks[i].begin(), chunks[i].end());
+                }
+                bytes_out.swap(bytes);
+            }
+        }
+
+        /**
+         * Take the stream's bytes as the chunks holding them, leaving the
+         * stream empty.
+         *
+         * Copies nothing unless a clone is sharing the bytes.
+         */
+        void release_chunks(memory_stream_chunks& chunks_out)
+        {
+            make_unique();
+            storage_->release_chunks(chunks_out);
+            position_ = 0U;
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE Read(
+            void* buffer, ULONG buffer_size, ULONG* read_count_out)
+        {
+            if (read_count_out)
+            {
+                *read_count_out = 0U;
+            }
+
+            try
+            {
+                if (!buffer)
+                {
+                    throw com_error("No buffer given", STG_E_INVALIDPOINTER);
+                }
+
+                ULONG count = static_cast<ULONG>(
+                    min(static_cast<ULONGLONG>(buffer_size), remaining()));
+                if (count != 0U)
+                {
+                    storage_->read(position_, buffer, count);
+                    position_ += count;
+                }
+
+                if (read_count_out)
+                {
+                    *read_count_out = count;
+                }
+
+                return (count < buffer_size) ? S_FALSE : S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Read", "memory_stream");
+        }
+
+        /**
+         * Write at the seek position, growing the stream if needed.
+         *
+         * Writing beyond the end fills the gap with zeros.  If a clone
+         * shares the bytes, this stream first takes its own copy.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Write(
+            const void* data, ULONG data_size, ULONG* written_count_out)
+        {
+            if (written_count_out)
+            {
+                *written_count_out = 0U;
+            }
+
+            try
+            {
+                if (!data)
+                {
+                    throw com_error("Buffer not given", STG_E_INVALIDPOINTER);
+                }
+
+                make_unique();
+                storage_->write(position_, data, data_size);
+                position_ += data_size;
+
+                if (written_count_out)
+                {
+                    *written_count_out = data_size;
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Write", "memory_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE Seek(
+            LARGE_INTEGER offset, DWORD origin,
+            ULARGE_INTEGER* new_position_out)
+        {
+            if (new_position_out)
+            {
+                new_position_out->QuadPart = position_;
+            }
+
+            try
+            {
+                position_ = impl::seek_position(
+                    position_, storage_->size(), offset, origin);
+
+                if (new_position_out)
+                {
+                    new_position_out->QuadPart = position_;
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Seek", "memory_stream");
+        }
+
+        /**
+         * Grow, with zeros, or truncate the stream.  The seek position
+         * doesn't move.
+         */
+        virtual HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER new_size)
+        {
+            try
+            {
+                make_unique();
+                storage_->resize(new_size.QuadPart);
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("SetSize", "memory_stream");
+        }
+
+        /**
+         * Write bytes from the seek position to another stream.
+         *
+         * Each chunk is passed straight to the destination's `Write`.
+         */
+        virtual HRESULT STDMETHODCALLTYPE CopyTo(
+            IStream* destination, ULARGE_INTEGER amount,
+            ULARGE_INTEGER* bytes_read_out, ULARGE_INTEGER* bytes_written_out)
+        {
+            ULARGE_INTEGER dummy_read_out;
+            if (!bytes_read_out)
+            {
+                bytes_read_out = &dummy_read_out;
+            }
+            bytes_read_out->QuadPart = 0U;
+
+            ULARGE_INTEGER dummy_written_out;
+            if (!bytes_written_out)
+            {
+                bytes_written_out = &dummy_written_out;
+            }
+            bytes_written_out->QuadPart = 0U;
+
+            try
+            {
+                if (!destination)
+                {
+                    throw com_error(
+                        "Destination stream not given", STG_E_INVALIDPOINTER);
+                }
+
+                ULONGLONG total = min(amount.QuadPart, remaining());
+                while (bytes_read_out->QuadPart < total)
+                {
+                    size_t length;
+                    ULONGLONG start;
+                    const unsigned char* chunk = storage_->chunk(
+                        storage_->find(position_), length, start);
+                    size_t offset = static_cast<size_t>(position_ - start);
+
+                    ULONG piece = static_cast<ULONG>(
+                        min(
+                            min(
+                                static_cast<ULONGLONG>(length - offset),
+                                total - bytes_read_out->QuadPart),
+                            static_cast<ULONGLONG>(
+                                (std::numeric_limits<ULONG>::max)())));
+
+                    ULONG written = 0U;
+                    HRESULT hr = destination->Write(
+                        chunk + offset, piece, &written);
+
+                    position_ += piece;
+                    bytes_read_out->QuadPart += piece;
+                    bytes_written_out->QuadPart += written;
+
+                    if (FAILED(hr))
+                    {
+                        throw com_error_from_interface(destination, hr);
+                    }
+                }
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("CopyTo", "memory_stream");
+        }
+
+        /// Writes go straight to memory so there is nothing to commit.
+        virtual HRESULT STDMETHODCALLTYPE Commit(DWORD /*commit_flags*/)
+        {
+            return S_OK;
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE Revert()
+        {
+            try
+            {
+                throw impl::transactions_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Revert", "memory_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE LockRegion(
+            ULARGE_INTEGER /*offset*/, ULARGE_INTEGER /*extent*/,
+            DWORD /*lock_type*/)
+        {
+            try
+            {
+                throw impl::locking_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "LockRegion", "memory_stream");
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE UnlockRegion(
+            ULARGE_INTEGER /*offset*/, ULARGE_INTEGER /*extent*/,
+            DWORD /*lock_type*/)
+        {
+            try
+            {
+                throw impl::locking_not_supported();
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "UnlockRegion", "memory_stream");
+        }
+
+        /**
+         * Get the size of the stream.  Memory streams have no name, so
+         * `pwcsName` is always NULL.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Stat(
+            STATSTG* attributes_out, DWORD /*stat_flag*/)
+        {
+            try
+            {
+                if (!attributes_out)
+                {
+                    throw com_error("STATSTG not given", STG_E_INVALIDPOINTER);
+                }
+
+                *attributes_out = STATSTG();
+
+                attributes_out->type = STGTY_STREAM;
+                attributes_out->cbSize.QuadPart = storage_->size();
+                attributes_out->grfMode = STGM_READWRITE;
+
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Stat", "memory_stream");
+        }
+
+        /**
+         * New stream sharing this one's bytes, starting at this stream's
+         * seek position but moving independently of it.
+         *
+         * Nothing is copied until one of the streams is written to.
+         */
+        virtual HRESULT STDMETHODCALLTYPE Clone(IStream** stream_out)
+        {
+            if (stream_out)
+            {
+                *stream_out = NULL;
+            }
+
+            try
+            {
+                if (!stream_out)
+                {
+                    throw com_error(
+                        "No out-pointer given", STG_E_INVALIDPOINTER);
+                }
+
+                com_ptr<IStream> clone =
+                    new memory_stream(*storage_, position_);
+                *stream_out = clone.detach();
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Clone", "memory_stream");
+        }
+
+    private:
+        memory_stream(impl::memory_stream_storage& storage, ULONGLONG position)
+            : storage_(&storage), position_(position)
+        {
+            storage_->add_ref();
+        }
+
+        memory_stream(const memory_stream&);
+        memory_stream& operator=(const memory_stream&);
+
+        /// Take a copy of the bytes if a clone shares them.
+        void make_unique()
+        {
+            if (storage_->shared())
+            {
+                impl::memory_stream_storage* copy = storage_->copy();
+                storage_->release();
+                storage_ = copy;
+            }
+        }
+
+        ULONGLONG remaining() const
+        {
+            return (position_ < storage_->size()) ?
+                storage_->size() - position_ : 0U;
+        }
+
+        impl::memory_stream_storage* storage_;
+        ULONGLONG position_;
+    };
+
+    //@}
+}
+
+#endif
@@ -228,6 +228,12 @@ namespace comet {
             return rc_ != 0 || activity_;
         }
 
+        /// Number of outstanding module locks.
+        long lock_count() const
+        {
+            return rc_;
+        }
+
         /// Reset the activity marker.
         void reset_activity_flag()
         {
@@ -0,0 +1,963 @@
+/** \file
+  * Chunked binary serialisation of variant_t and safearray_t via IStream.
+  *
+  * See \ref cometserialise.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_SERIALISE_H
+#define COMET_SERIALISE_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // com_error, com_error_from_interface
+#include <comet/ptr.h> // com_ptr
+#include <comet/safearray.h> // safearray_t
+#include <comet/variant.h> // variant_t
+
+#include <algorithm> // max, min
+#include <cstring> // memcpy, memset
+#include <limits> // numeric_limits
+#include <stdexcept> // runtime_error
+#include <vector>
+
+/** \page cometserialise Variant serialisation
+    variant_writer and variant_reader move variant_t and safearray_t values
+    to and from an IStream in a compact binary form.  Any IStream will do,
+    including the C++ streams wrapped by comet::adapt_stream.
+
+    Data passes through a single fixed-size buffer, so peak memory does not
+    depend on the size of the array being written or read.  Arrays can be
+    produced and consumed one element at a time, without ever holding the
+    whole array in memory:
+
+    \code
+        variant_writer writer(adapt_stream(file));
+        writer.begin_array(VT_VARIANT, row_count);
+        for (size_t i = 0; i < row_count; ++i)
+            writer.write(next_row());
+        writer.end_array();
+        writer.flush();
+    \endcode
+
+    \code
+        variant_reader reader(adapt_stream(file));
+        VARTYPE vt; size_t count; long lb;
+        reader.begin_array(vt, count, lb);
+        variant_t row;
+        for (size_t i = 0; i < count; ++i)
+        {
+            reader.read(row);
+            process_row(row);
+        }
+        reader.end_array();
+    \endcode
+
+    Each value is written as its VARTYPE followed by its payload.  Scalars
+    are written as their raw (little-endian) bytes, BSTRs as a byte count
+    followed by the string bytes and one-dimensional arrays as an element
+    count and lower bound followed by the elements.  Elements of a
+    VT_VARIANT array carry their own VARTYPE, so arrays may nest.
+
+    Interface pointers, records and VT_BYREF values cannot be serialised.
+
+    variant_reader doesn't trust the stream.  Arrays nested more than
+    impl::SERIALISE_MAX_DEPTH deep are rejected, and arrays and strings are
+    allocated no more than impl::SERIALISE_TRUSTED_SIZE bytes ahead of the
+    data actually read, so a corrupt length runs into the end of the stream
+    instead of exhausting memory.
+ */
+
+namespace comet {
+
+namespace impl {
+
+    static const size_t SERIALISE_CHUNK_SIZE = 4096;
+
+    static const ULONG SERIALISE_NULL_BSTR = 0xFFFFFFFF;
+
+    /// Deepest nesting of arrays variant_reader accepts.
+    static const size_t SERIALISE_MAX_DEPTH = 64;
+
+    /// Most bytes variant_reader allocates for an array or string before
+    /// the stream has shown that it holds them.
+    static const size_t SERIALISE_TRUSTED_SIZE = 1024 * 1024;
+
+    /**
+     * Size in bytes of a serialised fixed-size payload, or 0 if values
+     * of the given type have variable size or are not supported.
+     */
+    inline size_t serialised_scalar_size(VARTYPE vt)
+    {
+        switch (vt)
+        {
+        case VT_I1:
+        case VT_UI1:
+            return 1;
+        case VT_I2:
+        case VT_UI2:
+        case VT_BOOL:
+            return 2;
+        case VT_I4:
+        case VT_UI4:
+        case VT_INT:
+        case VT_UINT:
+        case VT_R4:
+        case VT_ERROR:
+            return 4;
+        case VT_I8:
+        case VT_UI8:
+        case VT_R8:
+        case VT_CY:
+        case VT_DATE:
+            return 8;
+        case VT_DECIMAL:
+            return sizeof(DECIMAL);
+        default:
+            return 0;
+        }
+    }
+
+    inline bool is_serialisable_element_type(VARTYPE vt)
+    {
+        return vt == VT_VARIANT || vt == VT_BSTR ||
+            serialised_scalar_size(vt) != 0;
+    }
+
+    inline bool is_serialisable_type(VARTYPE vt)
+    {
+        if (vt & VT_ARRAY)
+            return (vt & ~(VT_ARRAY | VT_TYPEMASK)) == 0 &&
+                is_serialisable_element_type(
+                    static_cast<VARTYPE>(vt & VT_TYPEMASK));
+        else
+            return vt == VT_EMPTY || vt == VT_NULL || vt == VT_BSTR ||
+                serialised_scalar_size(vt) != 0;
+    }
+
+    struct serialise_frame
+    {
+        serialise_frame(VARTYPE element_vt, size_t remaining)
+            : element_vt(element_vt), remaining(remaining) {}
+
+        VARTYPE element_vt;
+        size_t remaining;
+    };
+
+    /**
+     * Bookkeeping for arrays being streamed element by element.
+     */
+    class serialise_frames
+    {
+    public:
+        bool in_array() const
+        {
+            return !m_frames.empty();
+        }
+
+        VARTYPE element_vt() const
+        {
+            return m_frames.back().element_vt;
+        }
+
+        /// Number of arrays in progress.
+        size_t depth() const
+        {
+            return m_frames.size();
+        }
+
+        /// Account for one element about to be written to or read from the
+        /// innermost array.
+        void consume_element()
+        {
+            if (m_frames.empty())
+                return;
+
+            if (m_frames.back().remaining == 0)
+                throw std::runtime_error(
+                    "More elements than declared for array");
+
+            --m_frames.back().remaining;
+        }
+
+        void push(VARTYPE element_vt, size_t count)
+        {
+            m_frames.push_back(serialise_frame(element_vt, count));
+        }
+
+        void pop()
+        {
+            if (m_frames.empty())
+                throw std::runtime_error("No array in progress");
+
+            if (m_frames.back().remaining != 0)
+                throw std::runtime_error(
+                    "Fewer elements than declared for array");
+
+            m_frames.pop_back();
+        }
+
+    private:
+        std::vector<serialise_frame> m_frames;
+    };
+
+    /**
+     * Copies a VARIANT's DECIMAL without the bytes that overlap the VARTYPE.
+     */
+    inline DECIMAL decimal_payload(const VARIANT& v)
+    {
+        DECIMAL d = V_DECIMAL(&v);
+        d.wReserved = 0;
+        return d;
+    }
+
+}
+
+/*! \addtogroup COMType
+ */
+//@{
+
+/**
+ * Write variant_t and safearray_t values to an IStream.
+ *
+ * Output is accumulated in a buffer of `chunk_size` bytes and written to the
+ * stream each time the buffer fills.  Payloads bigger than the buffer, such
+ * as long strings, go straight to the stream.  Call flush() when finished to
+ * write out the last partial chunk; the destructor also flushes but has to
+ * ignore any error doing so.
+ *
+ * \sa variant_reader, \ref cometserialise
+ */
+class variant_writer
+{
+public:
+
+    explicit variant_writer(
+        const com_ptr<IStream>& stream,
+        size_t chunk_size=impl::SERIALISE_CHUNK_SIZE)
+        : m_stream(stream), m_buffer((chunk_size) ? chunk_size : 1),
+        m_used(0)
+    {
+        if (!m_stream)
+            throw com_error("No stream given", E_POINTER);
+    }
+
+    ~variant_writer() throw()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception&)
+        {}
+    }
+
+    /**
+     * Write a value.
+     *
+     * Outside an array, or inside a VT_VARIANT array, the value is written
+     * along with its type.  Inside an array of any other type the value is
+     * converted to the element type, if necessary, and only its payload is
+     * written.
+     */
+    void write(const variant_t& value)
+    {
+        m_frames.consume_element();
+
+        if (m_frames.in_array() && m_frames.element_vt() != VT_VARIANT)
+        {
+            VARTYPE element_vt = m_frames.element_vt();
+            if (value.get_vt() == element_vt)
+            {
+                write_payload(value.get());
+            }
+            else
+            {
+                variant_t converted(value, element_vt);
+                write_payload(converted.get());
+            }
+        }
+        else
+        {
+            write_value(value.get());
+        }
+    }
+
+    /**
+     * Write a whole array.
+     *
+     * Equivalent to writing each element between begin_array() and
+     * end_array() but without the per-element conversion checks.
+     */
+    template<typename T>
+    void write(const safearray_t<T>& array)
+    {
+        write_array(
+            array.in(), static_cast<VARTYPE>(safearray_t<T>::traits::vt));
+    }
+
+    /**
+     * Start streaming an array of `count` elements of type `element_vt`.
+     *
+     * Exactly `count` calls to write() must follow before the matching call
+     * to end_array().  Arrays begun inside a VT_VARIANT array nest.
+     */
+    void begin_array(VARTYPE element_vt, size_t count, long lower_bound=0)
+    {
+        if (!impl::is_serialisable_element_type(element_vt))
+            throw com_error(
+                "Array element type cannot be serialised", DISP_E_BADVARTYPE);
+        if (count > (std::numeric_limits<ULONG>::max)())
+            throw std::overflow_error("Array too big to serialise");
+
+        begin_nested_array(element_vt);
+
+        write_raw(static_cast<ULONG>(count));
+        write_raw(static_cast<LONG>(lower_bound));
+
+        m_frames.push(element_vt, count);
+    }
+
+    /**
+     * Finish the innermost array started with begin_array().
+     *
+     * \throw std::runtime_error if fewer elements were written than declared.
+     */
+    void end_array()
+    {
+        m_frames.pop();
+    }
+
+    /// Write any buffered bytes to the stream.
+    void flush()
+    {
+        if (m_used > 0)
+        {
+            size_t used = m_used;
+            m_used = 0;
+            write_to_stream(&m_buffer[0], used);
+        }
+    }
+
+private:
+
+    /// Account for an array about to be written and write its type tag.
+    void begin_nested_array(VARTYPE element_vt)
+    {
+        if (m_frames.in_array() && m_frames.element_vt() != VT_VARIANT)
+            throw std::runtime_error(
+                "Arrays can only be nested inside VT_VARIANT arrays");
+
+        m_frames.consume_element();
+
+        write_raw(static_cast<VARTYPE>(VT_ARRAY | element_vt));
+    }
+
+    void write_array(SAFEARRAY* psa, VARTYPE element_vt)
+    {
+        if (!impl::is_serialisable_element_type(element_vt))
+            throw com_error(
+                "Array element type cannot be serialised", DISP_E_BADVARTYPE);
+
+        begin_nested_array(element_vt);
+        write_array_payload(psa, element_vt);
+    }
+
+    void write_value(const VARIANT& value)
+    {
+        if (!impl::is_serialisable_type(V_VT(&value)))
+            throw com_error("Type cannot be serialised", DISP_E_BADVARTYPE);
+
+        write_raw(V_VT(&value));
+        write_payload(value);
+    }
+
+    void write_payload(const VARIANT& value)
+    {
+        VARTYPE vt = V_VT(&value);
+
+        if (vt & VT_ARRAY)
+        {
+            write_array_payload(
+                V_ARRAY(&value), static_cast<VARTYPE>(vt & VT_TYPEMASK));
+        }
+        else if (vt == VT_DECIMAL)
+        {
+            DECIMAL d = impl::decimal_payload(value);
+            write_bytes(&d, sizeof(d));
+        }
+        else
+        {
+            write_element(vt, &V_UI1(&value));
+        }
+    }
+
+    /// Write one element given a pointer to its raw storage.
+    void write_element(VARTYPE vt, const void* raw)
+    {
+        switch (vt)
+        {
+        case VT_EMPTY:
+        case VT_NULL:
+            break;
+        case VT_BSTR:
+            write_bstr(*static_cast<const BSTR*>(raw));
+            break;
+        case VT_VARIANT:
+            write_value(*static_cast<const VARIANT*>(raw));
+            break;
+        default:
+            {
+                size_t size = impl::serialised_scalar_size(vt);
+                if (size == 0)
+                    throw com_error(
+                        "Type cannot be serialised", DISP_E_BADVARTYPE);
+                write_bytes(raw, size);
+            }
+        }
+    }
+
+    void write_bstr(BSTR s)
+    {
+        if (s == NULL)
+        {
+            write_raw(impl::SERIALISE_NULL_BSTR);
+        }
+        else
+        {
+            ULONG byte_count = ::SysStringByteLen(s);
+            write_raw(byte_count);
+            write_bytes(s, byte_count);
+        }
+    }
+
+    void write_array_payload(SAFEARRAY* psa, VARTYPE element_vt)
+    {
+        if (!impl::is_serialisable_element_type(element_vt))
+            throw com_error(
+                "Array element type cannot be serialised", DISP_E_BADVARTYPE);
+
+        if (psa == NULL)
+        {
+            write_raw(ULONG(0));
+            write_raw(LONG(0));
+            return;
+        }
+
+        if (::SafeArrayGetDim(psa) != 1)
+            throw std::runtime_error(
+                "Only one-dimensional arrays can be serialised");
+
+        ULONG count = psa->rgsabound[0].cElements;
+        write_raw(count);
+        write_raw(psa->rgsabound[0].lLbound);
+
+        void* data;
+        ::SafeArrayAccessData(psa, &data) | raise_exception;
+        try
+        {
+            size_t element_size = ::SafeArrayGetElemsize(psa);
+            size_t scalar_size = impl::serialised_scalar_size(element_vt);
+
+            if (scalar_size != 0 && scalar_size == element_size &&
+                element_vt != VT_DECIMAL)
+            {
+                // Fixed-size elements are already laid out exactly as we
+                // serialise them
+                write_bytes(data, scalar_size * count);
+            }
+            else
+            {
+                const unsigned char* element =
+                    static_cast<const unsigned char*>(data);
+                for (ULONG i = 0; i < count; ++i, element += element_size)
+                {
+                    if (element_vt == VT_DECIMAL)
+                    {
+                        DECIMAL d =
+                            *reinterpret_cast<const DECIMAL*>(element);
+                        d.wReserved = 0;
+                        write_bytes(&d, sizeof(d));
+                    }
+                    else
+                    {
+                        write_element(element_vt, element);
+                    }
+                }
+            }
+        }
+        catch (...)
+        {
+            ::SafeArrayUnaccessData(psa);
+            throw;
+        }
+        ::SafeArrayUnaccessData(psa) | raise_exception;
+    }
+
+    template<typename T>
+    void write_raw(const T& value)
+    {
+        write_bytes(&value, sizeof(value));
+    }
+
+    void write_bytes(const void* data, size_t size)
+    {
+        if (size == 0)
+            return;
+
+        if (size > m_buffer.size() - m_used)
+        {
+            flush();
+
+            if (size >= m_buffer.size())
+            {
+                write_to_stream(data, size);
+                return;
+            }
+        }
+
+        std::memcpy(&m_buffer[m_used], data, size);
+        m_used += size;
+    }
+
+    void write_to_stream(const void* data, size_t size)
+    {
+        const char* next = static_cast<const char*>(data);
+        while (size > 0)
+        {
+            ULONG chunk = static_cast<ULONG>(
+                (std::min)(size, size_t((std::numeric_limits<ULONG>::max)())));
+            ULONG written = 0;
+            HRESULT hr = m_stream->Write(next, chunk, &written);
+            if (FAILED(hr))
+                throw com_error_from_interface(m_stream, hr);
+            if (written != chunk)
+                throw com_error("Unable to complete write", STG_E_MEDIUMFULL);
+
+            next += written;
+            size -= written;
+        }
+    }
+
+    variant_writer(const variant_writer&);
+    variant_writer& operator=(const variant_writer&);
+
+    com_ptr<IStream> m_stream;
+    std::vector<unsigned char> m_buffer;
+    size_t m_used;
+    impl::serialise_frames m_frames;
+};
+
+/**
+ * Read variant_t and safearray_t values written by variant_writer.
+ *
+ * The stream is read in chunks of `chunk_size` bytes, so the stream's
+ * position will generally be ahead of the last value returned.
+ *
+ * \sa variant_writer, \ref cometserialise
+ */
+class variant_reader
+{
+public:
+
+    explicit variant_reader(
+        const com_ptr<IStream>& stream,
+        size_t chunk_size=impl::SERIALISE_CHUNK_SIZE)
+        : m_stream(stream), m_buffer((chunk_size) ? chunk_size : 1),
+        m_next(0), m_end(0), m_depth(0)
+    {
+        if (!m_stream)
+            throw com_error("No stream given", E_POINTER);
+    }
+
+    /**
+     * Read the next value.
+     *
+     * Nested arrays are read in full.  Inside an array begun with
+     * begin_array(), this reads the next element.
+     */
+    void read(variant_t& value_out)
+    {
+        m_frames.consume_element();
+
+        VARTYPE vt;
+        if (m_frames.in_array() && m_frames.element_vt() != VT_VARIANT)
+            vt = m_frames.element_vt();
+        else
+            read_raw(vt);
+
+        variant_t value;
+        read_payload(vt, *value.out());
+        value.swap(value_out);
+    }
+
+    /// Read the next value as an array of type `T`, converting if needed.
+    template<typename T>
+    void read(safearray_t<T>& array_out)
+    {
+        variant_t value;
+        read(value);
+        array_out.detach_from(value);
+    }
+
+    /**
+     * Start reading an array element by element.
+     *
+     * Exactly `count_out` calls to read() should follow before the matching
+     * call to end_array().
+     */
+    void begin_array(
+        VARTYPE& element_vt_out, size_t& count_out, long& lower_bound_out)
+    {
+        m_frames.consume_element();
+
+        VARTYPE vt;
+        if (m_frames.in_array() && m_frames.element_vt() != VT_VARIANT)
+            vt = m_frames.element_vt();
+        else
+            read_raw(vt);
+
+        if (!(vt & VT_ARRAY))
+            throw com_error("Next value is not an array", DISP_E_TYPEMISMATCH);
+
+        VARTYPE element_vt = static_cast<VARTYPE>(vt & VT_TYPEMASK);
+        if (!impl::is_serialisable_element_type(element_vt))
+            throw com_error("Corrupt array element type", DISP_E_BADVARTYPE);
+
+        check_depth();
+
+        ULONG count;
+        LONG lower_bound;
+        read_raw(count);
+        read_raw(lower_bound);
+
+        m_frames.push(element_vt, count);
+
+        element_vt_out = element_vt;
+        count_out = count;
+        lower_bound_out = lower_bound;
+    }
+
+    /**
+     * Finish the innermost array started with begin_array().
+     *
+     * \throw std::runtime_error if fewer elements were read than declared.
+     */
+    void end_array()
+    {
+        m_frames.pop();
+    }
+
+private:
+
+    /// Read a value of type `vt` into an empty VARIANT.
+    void read_payload(VARTYPE vt, VARIANT& value_out)
+    {
+        if (!impl::is_serialisable_type(vt))
+            throw com_error("Corrupt value type", DISP_E_BADVARTYPE);
+
+        if (vt & VT_ARRAY)
+        {
+            V_ARRAY(&value_out) =
+                read_array_payload(static_cast<VARTYPE>(vt & VT_TYPEMASK));
+            V_VT(&value_out) = vt;
+        }
+        else if (vt == VT_DECIMAL)
+        {
+            read_bytes(&V_DECIMAL(&value_out), sizeof(DECIMAL));
+            V_VT(&value_out) = VT_DECIMAL;
+        }
+        else
+        {
+            read_element(vt, &V_UI1(&value_out));
+            V_VT(&value_out) = vt;
+        }
+    }
+
+    /// Read one element into its raw storage, which must be zeroed.
+    void read_element(VARTYPE vt, void* raw)
+    {
+        switch (vt)
+        {
+        case VT_EMPTY:
+        case VT_NULL:
+            break;
+        case VT_BSTR:
+            *static_cast<BSTR*>(raw) = read_bstr();
+            break;
+        case VT_VARIANT:
+            {
+                VARIANT& element = *static_cast<VARIANT*>(raw);
+                VARTYPE element_vt;
+                read_raw(element_vt);
+                read_payload(element_vt, element);
+            }
+            break;
+        default:
+            {
+                size_t size = impl::serialised_scalar_size(vt);
+                if (size == 0)
+                    throw com_error("Corrupt value type", DISP_E_BADVARTYPE);
+                read_bytes(raw, size);
+            }
+        }
+    }
+
+    BSTR read_bstr()
+    {
+        ULONG byte_count;
+        read_raw(byte_count);
+        if (byte_count == impl::SERIALISE_NULL_BSTR)
+            return NULL;
+
+        if (byte_count > impl::SERIALISE_TRUSTED_SIZE)
+            return read_long_bstr(byte_count);
+
+        BSTR s = ::SysAllocStringByteLen(NULL, byte_count);
+        if (s == NULL)
+            throw std::bad_alloc();
+
+        try
+        {
+            read_bytes(s, byte_count);
+        }
+        catch (...)
+        {
+            ::SysFreeString(s);
+            throw;
+        }
+
+        return s;
+    }
+
+    /// Read a string whose length is too big to allocate on trust.
+    BSTR read_long_bstr(ULONG byte_count)
+    {
+        std::vector<char> bytes;
+        while (bytes.size() < byte_count)
+        {
+            size_t read_so_far = bytes.size();
+            bytes.resize((std::min)(
+                size_t(byte_count),
+                (std::max)(2 * read_so_far, impl::SERIALISE_TRUSTED_SIZE)));
+            read_bytes(&bytes[read_so_far], bytes.size() - read_so_far);
+        }
+
+        BSTR s = ::SysAllocStringByteLen(&bytes[0], byte_count);
+        if (s == NULL)
+            throw std::bad_alloc();
+        return s;
+    }
+
+    /// Reject an array nested deeper than SERIALISE_MAX_DEPTH.
+    void check_depth() const
+    {
+        if (m_frames.depth() + m_depth >= impl::SERIALISE_MAX_DEPTH)
+            throw com_error(
+                "Arrays nested too deeply",
+                HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+
+    SAFEARRAY* read_array_payload(VARTYPE element_vt)
+    {
+        if (!impl::is_serialisable_element_type(element_vt))
+            throw com_error("Corrupt array element type", DISP_E_BADVARTYPE);
+
+        check_depth();
+
+        ULONG count;
+        LONG lower_bound;
+        read_raw(count);
+        read_raw(lower_bound);
+
+        ++m_depth;
+        SAFEARRAY* psa;
+        try
+        {
+            psa = read_array_elements(element_vt, lower_bound, count);
+        }
+        catch (...)
+        {
+            --m_depth;
+            throw;
+        }
+        --m_depth;
+
+        return psa;
+    }
+
+    /**
+     * Read `count` elements into a new vector.
+     *
+     * The vector starts at no more than SERIALISE_TRUSTED_SIZE bytes and
+     * doubles as elements arrive, so it never gets far ahead of the stream.
+     */
+    SAFEARRAY* read_array_elements(
+        VARTYPE element_vt, LONG lower_bound, ULONG count)
+    {
+        // Not SafeArrayCreateVector: its arrays are fixed size
+        SAFEARRAYBOUND bound = { 0, lower_bound };
+        SAFEARRAY* psa = ::SafeArrayCreate(element_vt, 1, &bound);
+        if (psa == NULL)
+            throw std::bad_alloc();
+
+        // New elements are zeroed so, if we fail part way, destroying the
+        // array releases exactly the elements read so far
+        try
+        {
+            size_t element_size = ::SafeArrayGetElemsize(psa);
+            size_t scalar_size = impl::serialised_scalar_size(element_vt);
+            ULONG trusted = static_cast<ULONG>((std::max)(
+                impl::SERIALISE_TRUSTED_SIZE / element_size, size_t(1)));
+
+            ULONG done = 0;
+            while (done < count)
+            {
+                ULONG grown = (done < trusted) ? trusted : done;
+                ULONG size = (count - done > grown) ? done + grown : count;
+
+                bound.cElements = size;
+                ::SafeArrayRedim(psa, &bound) | raise_exception;
+
+                void* data;
+                ::SafeArrayAccessData(psa, &data) | raise_exception;
+                try
+                {
+                    unsigned char* element =
+                        static_cast<unsigned char*>(data) +
+                        done * element_size;
+                    std::memset(element, 0, (size - done) * element_size);
+
+                    if (scalar_size != 0 && scalar_size == element_size)
+                    {
+                        read_bytes(element, scalar_size * (size - done));
+                    }
+                    else
+                    {
+                        for (ULONG i = done; i < size;
+                             ++i, element += element_size)
+                            read_element(element_vt, element);
+                    }
+                }
+                catch (...)
+                {
+                    ::SafeArrayUnaccessData(psa);
+                    throw;
+                }
+                ::SafeArrayUnaccessData(psa) | raise_exception;
+
+                done = size;
+            }
+        }
+        catch (...)
+        {
+            ::SafeArrayDestroy(psa);
+            throw;
+        }
+
+        return psa;
+    }
+
+    template<typename T>
+    void read_raw(T& value_out)
+    {
+        read_bytes(&value_out, sizeof(value_out));
+    }
+
+    void read_bytes(void* data, size_t size)
+    {
+        char* next = static_cast<char*>(data);
+
+        size_t buffered = (std::min)(size, m_end - m_next);
+        if (buffered > 0)
+        {
+            std::memcpy(next, &m_buffer[m_next], buffered);
+            m_next += buffered;
+            next += buffered;
+            size -= buffered;
+        }
+
+        if (size >= m_buffer.size())
+        {
+            // Too big to be worth staging through the buffer
+            read_from_stream(next, size);
+        }
+        else if (size > 0)
+        {
+            fill_buffer(size);
+            std::memcpy(next, &m_buffer[m_next], size);
+            m_next += size;
+        }
+    }
+
+    /// Refill the empty buffer with at least `minimum` bytes.
+    void fill_buffer(size_t minimum)
+    {
+        m_next = 0;
+        m_end = 0;
+
+        while (m_end < minimum)
+        {
+            ULONG read_count = 0;
+            HRESULT hr = m_stream->Read(
+                &m_buffer[m_end], static_cast<ULONG>(m_buffer.size() - m_end),
+                &read_count);
+            if (FAILED(hr))
+                throw com_error_from_interface(m_stream, hr);
+            if (read_count == 0)
+                throw com_error(
+                    "Unexpected end of stream",
+                    HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+
+            m_end += read_count;
+        }
+    }
+
+    void read_from_stream(void* data, size_t size)
+    {
+        char* next = static_cast<char*>(data);
+        while (size > 0)
+        {
+            ULONG chunk = static_cast<ULONG>(
+                (std::min)(size, size_t((std::numeric_limits<ULONG>::max)())));
+            ULONG read_count = 0;
+            HRESULT hr = m_stream->Read(next, chunk, &read_count);
+            if (FAILED(hr))
+                throw com_error_from_interface(m_stream, hr);
+            if (read_count == 0)
+                throw com_error(
+                    "Unexpected end of stream",
+                    HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+
+            next += read_count;
+            size -= read_count;
+        }
+    }
+
+    variant_reader(const variant_reader&);
+    variant_reader& operator=(const variant_reader&);
+
+    com_ptr<IStream> m_stream;
+    std::vector<unsigned char> m_buffer;
+    size_t m_next;
+    size_t m_end;
+    size_t m_depth; ///< Arrays being read by read_array_payload().
+    impl::serialise_frames m_frames;
+};
+
+//@}
+
+}
+
+#endif
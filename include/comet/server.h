@@ -39,8 +39,8 @@
 #include <comet/module.h>
 
 /** \page cometclassfactory Comet Class Factories
- * Comet currently has support for \ref cometclassfactorystandard (non-aggregating), \ref cometclassfactoryaggregating and
- * \ref cometclassfactorysingleton class factories.  As there has been no demand for custom
+ * Comet currently has support for \ref cometclassfactorystandard (non-aggregating), \ref cometclassfactoryaggregating,
+ * \ref cometclassfactorysingleton and \ref cometclassfactorypooled class factories.  As there has been no demand for custom
  * class factories yet, there is currently no support for them.
  *
  * The different class-factories are enabled by specialising the
@@ -77,6 +77,24 @@
  *
  * More complex requirements are anticipated, however they have not been
  * implemented.
+ *
+ * \section cometclassfactorypooled Pooled
+ *
+ * The trigger class for the pooled class-factory is comet::pooled_coclass.
+ *
+ * The pooled class-factory keeps a number of objects constructed ahead of
+ * time and hands one out on each CreateInstance call, so an expensive
+ * constructor doesn't hold up the client.  The pool is filled when the
+ * class factory is first used and topped up after each activation on a
+ * Windows thread-pool thread.  If the pool is empty, CreateInstance
+ * constructs an object as the standard class-factory does.
+ * pooled_coclass::pool_metrics() reports how many activations were served
+ * from the pool.
+ *
+ * Pooled objects are constructed on a thread in the multithreaded
+ * apartment, whatever their thread model, so their constructors may load
+ * data but must not create objects tied to an apartment.  Objects waiting
+ * in the pool do not hold a lock on the module.
  */
     /*! \defgroup Server Server implementation details.
      */
@@ -130,7 +148,7 @@ namespace comet {
 
     namespace impl {
 
-        enum factory_type_t { ft_standard, ft_aggregateable, ft_singleton };
+        enum factory_type_t { ft_standard, ft_aggregateable, ft_singleton, ft_pooled };
 
         inline void create_record_info( const IID& lib_guid, const IID& rec_guid, unsigned short major_version, unsigned short minor_version, IRecordInfo*& ri )
         {
@@ -707,6 +725,247 @@ namespace comet {
         private:
     };
 
+    /*!\addtogroup Server
+     */
+    //@{
+
+    /// Activation statistics of a pooled_coclass.
+    struct activation_pool_metrics
+    {
+        ULONGLONG hits;   ///< Activations served from the pool.
+        ULONGLONG misses; ///< Activations that found the pool empty.
+        size_t ready;     ///< Objects waiting in the pool now.
+    };
+
+    //@}
+
+    namespace impl {
+
+        /** Objects of one pooled coclass constructed ahead of activation.
+         * \internal
+         */
+        template<typename T> class activation_pool
+        {
+        public:
+            static activation_pool& instance()
+            {
+                static activation_pool* volatile pool_ = NULL;
+
+                activation_pool* pool = pool_;
+                if (!pool)
+                {
+                    // Left for the process to reclaim: a pooled object
+                    // may be activated until the module is unloaded
+                    activation_pool* created = new activation_pool();
+                    pool = impl::publish_once(pool_, created);
+                    if (pool == created)
+                        module().add_object_to_dispose(
+                            create_object_disposer(pool));
+                }
+                return *pool;
+            }
+
+            /// Top up the pool on a thread-pool thread, unless already doing so.
+            void refill()
+            {
+                {
+                    auto_cs lock(cs_);
+                    if (refilling_ || stopping_)
+                        return;
+
+                    refilling_ = true;
+                    ::ResetEvent(idle_.get());
+                }
+
+                if (!::QueueUserWorkItem(
+                        &activation_pool::refill_proc, this, WT_EXECUTEDEFAULT))
+                {
+                    auto_cs lock(cs_);
+                    refilling_ = false;
+                    ::SetEvent(idle_.get());
+                }
+            }
+
+            /// A ready object, with a reference count of 0, or NULL.
+            T* take()
+            {
+                T* t = 0;
+                {
+                    auto_cs lock(cs_);
+                    if (ready_.empty())
+                    {
+                        ++misses_;
+                    }
+                    else
+                    {
+                        t = ready_.back();
+                        ready_.pop_back();
+                        ++hits_;
+                    }
+                }
+                refill();
+                return t;
+            }
+
+            activation_pool_metrics metrics() const
+            {
+                auto_cs lock(cs_);
+                activation_pool_metrics result;
+                result.hits = hits_;
+                result.misses = misses_;
+                result.ready = ready_.size();
+                return result;
+            }
+
+            // Called by object_disposer on module terminate.
+            void object_dispose()
+            {
+                {
+                    // No refill can start once stopping_ is set
+                    auto_cs lock(cs_);
+                    stopping_ = true;
+                }
+                ::WaitForSingleObject(idle_.get(), INFINITE);
+
+                // Also waits for refill_proc to leave cs_
+                auto_cs lock(cs_);
+                for (size_t i = 0; i < ready_.size(); ++i)
+                    delete ready_[i];
+                ready_.clear();
+
+                // Once stopping_ is set nothing else uses idle_
+                idle_.close();
+            }
+
+        private:
+            activation_pool()
+                : refilling_(false),
+                  idle_(auto_attach(::CreateEvent(0, true, true, 0))),
+                  stopping_(false), hits_(0), misses_(0)
+            {}
+
+            static DWORD WINAPI refill_proc(void* param)
+            {
+                activation_pool* pool = static_cast<activation_pool*>(param);
+
+                bool more;
+                do
+                {
+                    HRESULT hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+                    bool filled = pool->fill();
+                    if (SUCCEEDED(hr))
+                        ::CoUninitialize();
+
+                    more = pool->finish_refill(filled);
+                } while (more);
+
+                // Nothing may touch the pool or the module's code after
+                // finish_refill() signals idle_: the module may be unloading
+                return 0;
+            }
+
+            /**
+             * Signal idle_ unless objects were taken while fill() was
+             * running, in which case refill_proc must fill the pool again.
+             * Deciding under cs_ means a concurrent take() either sees
+             * refilling_ still set and leaves the refill to this thread, or
+             * sees it clear and starts another.
+             */
+            bool finish_refill(bool filled)
+            {
+                auto_cs lock(cs_);
+                if (filled && !stopping_ && ready_.size() < size_t(T::pool_size))
+                    return true;
+
+                refilling_ = false;
+                ::SetEvent(idle_.get());
+                return false;
+            }
+
+            bool needs_filling() const
+            {
+                auto_cs lock(cs_);
+                return !stopping_ && ready_.size() < size_t(T::pool_size);
+            }
+
+            /// Returns false if a constructor threw.
+            bool fill()
+            {
+                while (needs_filling())
+                {
+                    T* t;
+                    try {
+                        t = new T;
+                    }
+                    catch (...)
+                    {
+                        // Leave it to CreateInstance to report the error
+                        return false;
+                    }
+
+                    auto_cs lock(cs_);
+                    if (stopping_)
+                    {
+                        delete t;
+                        break;
+                    }
+                    ready_.push_back(t);
+                }
+                return true;
+            }
+
+            activation_pool(const activation_pool&);
+            activation_pool& operator=(const activation_pool&);
+
+            critical_section cs_;
+            std::vector<T*> ready_;
+            bool refilling_;
+            auto_handle idle_; ///< Set when no refill_proc is queued/running.
+            bool stopping_;
+            ULONGLONG hits_;
+            ULONGLONG misses_;
+        };
+    }
+
+    /// Class factory that hands out objects constructed ahead of time.
+    template<typename T, bool LOCK_MODULE> class class_factory_pooled : public class_factory_base<T, LOCK_MODULE>
+    {
+    public:
+        class_factory_pooled()
+        {
+            impl::activation_pool<T>::instance().refill();
+        }
+
+        STDMETHOD(CreateInstance)(::IUnknown *pUnkOuter, REFIID riid, void **ppv)
+        {
+            if (pUnkOuter) return CLASS_E_NOAGGREGATION;
+            *ppv = 0;
+
+            if (!LOCK_MODULE) module().lock();
+
+            T* t = impl::activation_pool<T>::instance().take();
+            if (!t)
+            {
+                try {
+                    t = new T;
+                }
+                catch (...)
+                {
+                    if (!LOCK_MODULE) module().unlock();
+                    return handle_exception( bstr_t(L"CreateInstance(") + bstr_t(uuid_t::create_const_reference(riid),true ) + ")" );
+                }
+            }
+
+            t->AddRef();
+            HRESULT hr = t->QueryInterface(riid, ppv);
+            t->Release();
+
+            if (!LOCK_MODULE) module().unlock();
+
+            return hr;
+        }
+    };
+
 
     /*!\addtogroup Objects
      */
@@ -968,6 +1227,33 @@ namespace comet {
         long rc_;
         impl::cmd_t *dispose_;
     };
+
+    /** \struct pooled_coclass  server.h comet/server.h
+      * Implement a coclass whose objects are constructed ahead of activation.
+      * See \ref cometclassfactorypooled.
+      * \code
+      * template<>
+      * class coclass_implementation<CoMyClass>
+      *     : public pooled_coclass<CoMyClass, 4>
+      * {
+      *     // ....
+      * };
+      * \endcode
+      * \param POOL_SIZE Number of objects to keep ready.
+      */
+    template<typename T, size_t POOL_SIZE, enum thread_model::thread_model_t TM = thread_model::Apartment>
+    struct ATL_NO_VTABLE pooled_coclass : public coclass<T, TM>
+    {
+        typedef pooled_coclass coclass_type;
+        enum { factory_type = impl::ft_pooled };
+        enum { pool_size = POOL_SIZE };
+
+        /// Activation statistics for this coclass.
+        static activation_pool_metrics pool_metrics()
+        {
+            return impl::activation_pool< coclass_implementation<T> >::instance().metrics();
+        }
+    };
     //@}
 
 
@@ -1222,6 +1508,14 @@ namespace comet {
                     typedef class_factory_singleton<CLASS, LOCK_MODULE> is_factory;
                 };
             };
+            template<> struct factory_builder<ft_pooled>
+            {
+                template<typename CLASS, bool LOCK_MODULE>
+                struct factory
+                {
+                    typedef class_factory_pooled<CLASS, LOCK_MODULE> is_factory;
+                };
+            };
 
             template<typename CLASS, bool LOCK_MODULE>
             struct factory_type
@@ -1299,6 +1593,10 @@ namespace comet {
         {
             typedef class_factory_singleton<CLASS, LOCK_MODULE> is_factory;
         };
+        template<typename CLASS, bool LOCK_MODULE> struct factory_builder_aux<ft_pooled,CLASS, LOCK_MODULE>
+        {
+            typedef class_factory_pooled<CLASS, LOCK_MODULE> is_factory;
+        };
 
 
         template<typename CLASS, bool FACTORY_LOCK_MODULE> struct entry_builder<false, CLASS, FACTORY_LOCK_MODULE>
@@ -0,0 +1,168 @@
+/** \file
+  * _NewEnum style COM enumerator over an immutable snapshot of items that
+  * clones share.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_SNAPSHOT_ENUM_H
+#define COMET_SNAPSHOT_ENUM_H
+
+#include <comet/config.h>
+
+#include <comet/enum_common.h>
+#include <comet/ptr.h>
+#include <comet/server.h>
+
+namespace comet {
+
+    namespace impl {
+
+        /**
+         * Container contents frozen when an enumeration is created.
+         *
+         * Held through COM reference counting so that the enumeration and
+         * all its clones share one copy, on any thread, and the last to be
+         * released frees it.
+         */
+        template<typename C>
+        class enum_snapshot : public simple_object<nil>
+        {
+        public:
+            explicit enum_snapshot(const C& contents) : contents_(contents) {}
+
+            const C& contents() const
+            {
+                return contents_;
+            }
+
+        private:
+            const C contents_;
+        };
+
+        template<typename C>
+        class snapshot_enum_source
+        {
+        public:
+            typedef typename C::const_iterator const_iterator;
+
+            explicit snapshot_enum_source(const C& contents)
+                : contents_(0), it_()
+            {
+                enum_snapshot<C>* snapshot = new enum_snapshot<C>(contents);
+                owner_ = snapshot;
+                contents_ = &snapshot->contents();
+                it_ = begin();
+            }
+
+            const_iterator begin()
+            {
+                return contents_->begin();
+            }
+
+            const_iterator end()
+            {
+                return contents_->end();
+            }
+
+            const_iterator& current()
+            {
+                return it_;
+            }
+
+        private:
+
+            // Not copy-assignable
+            snapshot_enum_source& operator=(const snapshot_enum_source&);
+
+            com_ptr< ::IUnknown> owner_;
+            const C* contents_;
+            const_iterator it_;
+        };
+
+    }
+
+    /**
+     * Implements _NewEnum style COM object on top of a private copy of a
+     * collection.
+     *
+     * The collection is copied once, when the enumeration is created, so
+     * later changes to the original don't affect it.  Clones share that copy
+     * rather than making their own, so Clone is O(1) however large the
+     * collection.
+     *
+     * \param Itf Enumeration Interface.
+     * \param C STL Style container.
+     * \param T Iteration Element type
+     * \param CONVERTER Converts container element to \p T type. (std::identity<C::value_type>)
+     * \sa make_snapshot_enumeration
+     */
+    template<
+        typename Itf, typename C, typename T,
+        typename CONVERTER=std::identity<COMET_STRICT_TYPENAME C::value_type> >
+    class snapshot_enumeration :
+        public impl::enumeration<
+            Itf, T, CONVERTER, impl::snapshot_enum_source<C> >
+    {
+    public:
+        snapshot_enumeration(
+            const C& container, const CONVERTER& converter=CONVERTER())
+            : enumeration(
+                impl::snapshot_enum_source<C>(container), converter) {}
+
+    private:
+        snapshot_enumeration(const snapshot_enumeration&);
+        snapshot_enumeration& operator=(const snapshot_enumeration&);
+    };
+
+    /**
+     * Snapshot Enumeration creation helper.
+     *
+     * Creates the enumeration with the element type specified by the
+     * enumerated_type_of policy.  To specify the element type explicitly, use
+     * snapshot_enumeration directly.
+     *
+     * \tparam ET  Enumeration Type e.g. IEnumVARIANT.
+     * \tparam C   Collection type (inferred from @a container parameter).
+     *
+     * \param container  STL collection to take a snapshot of.
+     */
+    template<typename ET, typename C>
+    inline com_ptr<ET> make_snapshot_enumeration(const C& container)
+    {
+        typedef typename enumerated_type_of<ET>::is T;
+        typedef std::identity<COMET_STRICT_TYPENAME C::value_type> CONVERTER;
+        return new snapshot_enumeration<ET, C, T, CONVERTER>(container);
+    }
+
+    /**
+     * Snapshot Enumeration creation helper with custom converter.
+     *
+     * \tparam ET        Enumeration Type e.g. IEnumVARIANT.
+     * \tparam C         Collection type (inferred from @a container).
+     * \tparam CONVERTER Converter type (inferred from @a converter).
+     *
+     * \param container  STL collection to take a snapshot of.
+     * \param converter  Custom converter.
+     */
+    template<typename ET, typename C, typename CONVERTER>
+    inline com_ptr<ET> make_snapshot_enumeration(
+        const C& container, const CONVERTER& converter)
+    {
+        typedef typename enumerated_type_of<ET>::is T;
+        return new snapshot_enumeration<ET, C, T, CONVERTER>(
+            container, converter);
+    }
+}
+
+#endif
@@ -0,0 +1,356 @@
+/** \file
+  * Asynchronous calls into a single-threaded apartment.
+  *
+  * See \ref cometstadispatcher.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_STA_DISPATCHER_H
+#define COMET_STA_DISPATCHER_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // raise_exception
+#include <comet/git.h> // GIT, GIT_cookie
+#include <comet/ptr.h>
+#include <comet/thread_pool.h> // future, impl::pool_task_t
+
+#include <tchar.h> // _T
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L \
+    && defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+#define COMET_COROUTINES
+#include <coroutine>
+#include <ctxtcall.h> // IContextCallback
+#endif
+
+/** \page cometstadispatcher STA dispatcher
+    A call from another apartment into an object in a single-threaded
+    apartment goes through a proxy, and the calling thread blocks until the
+    STA's message loop gets round to the call.  sta_dispatcher instead
+    posts the call to the STA's message loop and returns at once with a
+    future for its result, so a worker thread can carry on, or start calls
+    on several STAs, while the calls are serviced.
+
+    The dispatcher is created on the STA thread, which must go on pumping
+    messages.  Other threads refer to the object by its GIT cookie; the
+    call runs on the STA thread where the cookie gives back the object
+    itself rather than a proxy:
+
+    \code
+        // On the STA thread
+        sta_dispatcher dispatcher;
+        GIT_cookie<IFoo> foo = git.register_interface(object);
+
+        // On any thread
+        struct get_count
+        {
+            long operator()(IFoo* foo) const
+            {
+                long count;
+                foo->get_Count(&count) | raise_exception;
+                return count;
+            }
+        };
+
+        future<long> count = dispatcher.invoke<long>(foo, get_count());
+    \endcode
+
+    The dispatcher may be used from any thread but must be destroyed on
+    the STA thread.  Calls still waiting then are run before it goes.
+
+    With a compiler supporting C++20 coroutines (and _WIN32_WINNT at least
+    0x0600), a future can be awaited instead:
+
+    \code
+        long count = co_await dispatcher.invoke<long>(foo, get_count());
+    \endcode
+
+    Awaited on an STA thread, the coroutine resumes on that thread once the
+    call completes, so the thread must go on pumping messages meanwhile.
+    Awaited on any other thread, including an MTA thread, it resumes on a
+    Windows thread-pool thread instead.  co_await throws any exception the
+    call threw.
+*/
+
+namespace comet {
+
+    namespace impl {
+
+        /** Fetches an interface from the GIT and calls a function object
+         * with it.
+         * \internal
+         */
+        template<typename R, typename Itf, typename F>
+        class git_call
+        {
+        public:
+            git_call(GIT& git, const GIT_cookie<Itf>& object, const F& call)
+                : git_(&git), object_(object), call_(call) {}
+
+            R operator()()
+            {
+                com_ptr<Itf> object = git_->get_interface(object_);
+                return call_(object.raw());
+            }
+
+        private:
+            GIT* git_;
+            GIT_cookie<Itf> object_;
+            F call_;
+        };
+
+        const UINT sta_dispatch_message = WM_APP;
+
+        inline LRESULT CALLBACK sta_dispatch_proc(
+            HWND window, UINT message, WPARAM wparam, LPARAM lparam)
+        {
+            if (message == sta_dispatch_message)
+            {
+                pool_task* task = reinterpret_cast<pool_task*>(lparam);
+                task->run();
+                task->release();
+                return 0;
+            }
+            return ::DefWindowProc(window, message, wparam, lparam);
+        }
+
+#ifdef COMET_COROUTINES
+        /**
+         * COM context of the calling thread if it is in a single-threaded
+         * apartment, otherwise NULL.  The caller releases it.
+         */
+        inline IContextCallback* sta_context()
+        {
+            IComThreadingInfo* info = 0;
+            if (FAILED(::CoGetObjectContext(
+                    IID_IComThreadingInfo, reinterpret_cast<void**>(&info))))
+                return 0;
+
+            APTTYPE type;
+            HRESULT hr = info->GetCurrentApartmentType(&type);
+            info->Release();
+            if (FAILED(hr) || (type != APTTYPE_STA && type != APTTYPE_MAINSTA))
+                return 0;
+
+            IContextCallback* context = 0;
+            if (FAILED(::CoGetObjectContext(
+                    IID_IContextCallback, reinterpret_cast<void**>(&context))))
+                return 0;
+            return context;
+        }
+
+        /** Resumes a coroutine when a future completes, in the apartment
+         * that awaited it if that was an STA.
+         * \internal
+         */
+        template<typename R> class future_awaiter
+        {
+        public:
+            explicit future_awaiter(const future<R>& result)
+                : result_(result), context_(0), wait_(0) {}
+
+            ~future_awaiter()
+            {
+                if (wait_)
+                    ::CloseThreadpoolWait(wait_);
+                if (context_)
+                    context_->Release();
+            }
+
+            bool await_ready() const
+            {
+                return result_.ready();
+            }
+
+            void await_suspend(std::coroutine_handle<> caller)
+            {
+                caller_ = caller;
+                context_ = sta_context();
+                wait_ = ::CreateThreadpoolWait(&future_awaiter::on_done, this, 0);
+                if (!wait_)
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                ::SetThreadpoolWait(wait_, result_.completion_event(), 0);
+            }
+
+            R await_resume() const
+            {
+                return result_.get();
+            }
+
+        private:
+            static void CALLBACK on_done(
+                PTP_CALLBACK_INSTANCE, void* awaiter, PTP_WAIT, TP_WAIT_RESULT)
+            {
+                // Resuming may destroy the awaiter, so take what is needed
+                future_awaiter* self = static_cast<future_awaiter*>(awaiter);
+                std::coroutine_handle<> caller = self->caller_;
+                IContextCallback* context = self->context_;
+                self->context_ = 0;
+
+                if (!context)
+                {
+                    caller.resume();
+                    return;
+                }
+
+                // The call into the STA needs COM on this thread, which the
+                // thread pool expects back as it was
+                HRESULT init = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+
+                ComCallData data = { 0, 0, caller.address() };
+                HRESULT hr = context->ContextCallback(
+                    &future_awaiter::resume_in_context, &data,
+                    iid_no_reentrancy(), 5, 0);
+                context->Release();
+
+                // The apartment has gone, which leaves nowhere better
+                if (FAILED(hr))
+                    caller.resume();
+
+                if (SUCCEEDED(init))
+                    ::CoUninitialize();
+            }
+
+            static HRESULT CALLBACK resume_in_context(ComCallData* data)
+            {
+                std::coroutine_handle<>::from_address(
+                    data->pUserDefined).resume();
+                return S_OK;
+            }
+
+            /// ICallbackWithNoReentrancyToApplicationSTA, which stops the
+            /// STA running unrelated calls while it resumes the coroutine.
+            static REFIID iid_no_reentrancy()
+            {
+                static const IID iid = { 0x0A299774, 0x3E4E, 0xFC42,
+                    { 0x1D, 0x9D, 0x72, 0xCE, 0xE1, 0x05, 0xCA, 0x57 } };
+                return iid;
+            }
+
+            future<R> result_;
+            std::coroutine_handle<> caller_;
+            IContextCallback* context_;
+            PTP_WAIT wait_;
+        };
+#endif
+    }
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /** \class sta_dispatcher  sta_dispatcher.h comet/sta_dispatcher.h
+      * Posts calls to the message loop of the single-threaded apartment
+      * that created it.
+      * See \ref cometstadispatcher.
+      */
+    class sta_dispatcher
+    {
+    public:
+        /// Create on the STA thread that is to run the calls.
+        sta_dispatcher() : window_(0)
+        {
+            HINSTANCE module = 0;
+            ::GetModuleHandleEx(
+                GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                reinterpret_cast<LPCTSTR>(&impl::sta_dispatch_proc), &module);
+
+            WNDCLASSEX window_class = { sizeof(WNDCLASSEX) };
+            window_class.lpfnWndProc = &impl::sta_dispatch_proc;
+            window_class.hInstance = module;
+            window_class.lpszClassName = class_name();
+            if (!::RegisterClassEx(&window_class) &&
+                ::GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
+                raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+
+            window_ = ::CreateWindowEx(
+                0, class_name(), 0, 0, 0, 0, 0, 0, HWND_MESSAGE, 0, module, 0);
+            if (!window_)
+                raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+        }
+
+        /// Destroy on the STA thread, after running the calls still waiting.
+        ~sta_dispatcher()
+        {
+            MSG msg;
+            while (::PeekMessage(
+                       &msg, window_, impl::sta_dispatch_message,
+                       impl::sta_dispatch_message, PM_REMOVE))
+                ::DispatchMessage(&msg);
+
+            ::DestroyWindow(window_);
+        }
+
+        /**
+         * Call a function object on the STA thread.
+         *
+         * \tparam R    Type `call()` returns, which may be void.
+         * \param call  Function object called with no arguments.  Copied.
+         */
+        template<typename R, typename F>
+        future<R> post(const F& call)
+        {
+            impl::pool_task_t<R, F>* task = new impl::pool_task_t<R, F>(call);
+            future<R> result(task);
+            if (!::PostMessage(
+                    window_, impl::sta_dispatch_message, 0,
+                    reinterpret_cast<LPARAM>(task)))
+            {
+                task->release();
+                raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+            }
+            return result;
+        }
+
+        /**
+         * Call a function object with an object on the STA thread.
+         *
+         * \tparam R      Type `call(Itf*)` returns, which may be void.
+         * \param object  GIT cookie of an object belonging to the STA.
+         * \param call    Function object taking `Itf*`.  Copied.
+         */
+        template<typename R, typename Itf, typename F>
+        future<R> invoke(const GIT_cookie<Itf>& object, const F& call)
+        {
+            return post<R>(impl::git_call<R, Itf, F>(git_, object, call));
+        }
+
+    private:
+        static const TCHAR* class_name()
+        {
+            return _T("comet_sta_dispatcher");
+        }
+
+        sta_dispatcher(const sta_dispatcher&);
+        sta_dispatcher& operator=(const sta_dispatcher&);
+
+        HWND window_;
+        GIT git_;
+    };
+
+    //@}
+
+#ifdef COMET_COROUTINES
+    /// Await the result of a task or dispatched call.
+    template<typename R>
+    inline impl::future_awaiter<R> operator co_await(const future<R>& result)
+    {
+        return impl::future_awaiter<R>(result);
+    }
+#endif
+}
+
+#endif
@@ -24,6 +24,7 @@
 #include <comet/bstr.h> // bstr_t
 #include <comet/error.h> // com_error
 #include <comet/handle_except.h> // COMET_CATCH_CLASS_INTERFACE_BOUNDARY
+#include <comet/ptr.h> // com_ptr, com_cast
 #include <comet/server.h> // simple_object
 
 #include <cassert> // assert
@@ -33,11 +34,79 @@
 
 #include <strsafe.h> // StringCbCopyW
 
+/**
+ * Default number of bytes a buffered stream adapter lets accumulate in the
+ * wrapped stream's buffer before flushing it.
+ *
+ * @see adapt_stream_buffered
+ */
+#ifndef COMET_STREAM_FLUSH_THRESHOLD
+#define COMET_STREAM_FLUSH_THRESHOLD 65536
+#endif
+
+/**
+ * Most bytes `CopyTo` moves between the source and destination at a time.
+ *
+ * Counts are updated, and an adapted destination considers flushing, once
+ * per chunk.  Must be less than the largest ULONG.
+ */
+#ifndef COMET_STREAM_COPY_CHUNK_SIZE
+#define COMET_STREAM_COPY_CHUNK_SIZE 65536
+#endif
+
 namespace comet {
 
 namespace impl {
 
-    static const size_t COPY_CHUNK_SIZE = 512;
+    static const size_t COPY_CHUNK_SIZE = COMET_STREAM_COPY_CHUNK_SIZE;
+
+    /**
+     * Direct access to the C++ stream wrapped by an adapted stream.
+     *
+     * Lets `CopyTo` from one adapter to another move bytes straight from
+     * one stream buffer to the other rather than through `IStream::Write`.
+     *
+     * The interface deals in C++ objects so it has no proxy and is only
+     * offered to callers passing the same module tag: a C++ stream cannot
+     * be shared with a module that may be built against another CRT.
+     */
+    struct ATL_NO_VTABLE stream_splice_target : public ::IUnknown
+    {
+        /**
+         * Wrapped stream, ready to write at the adapter's position, or NULL
+         * if it cannot be written to directly.
+         */
+        virtual std::ostream* STDMETHODCALLTYPE begin_splice(
+            const void* module_tag) = 0;
+
+        /**
+         * Account for bytes put directly into the stream since
+         * `begin_splice`, flushing it as `Write` would.
+         */
+        virtual HRESULT STDMETHODCALLTYPE end_splice(ULONG written) = 0;
+    };
+
+    /** Address unique to the module that includes this header. */
+    inline const void* splice_module_tag()
+    {
+        static const char tag = 0;
+        return &tag;
+    }
+
+}
+
+template<> struct comtype<impl::stream_splice_target>
+{
+    static const IID& uuid() throw()
+    {
+        static const IID iid = { 0x60c0597a, 0x9a3b, 0x4d88,
+            { 0x9e, 0xbc, 0x03, 0x18, 0x93, 0x12, 0x16, 0x99 } };
+        return iid;
+    }
+    typedef ::IUnknown base;
+};
+
+namespace impl {
 
     /**
      * Used to clear stream failure on exiting a scope.
@@ -127,9 +196,40 @@ namespace impl {
         }
     }
 
+    /**
+     * Check that writes made to the stream succeeded, flushing it first if
+     * `flush` is set.
+     */
+    inline void finish_ostream_write(std::ostream& stream, bool flush)
+    {
+        if (flush)
+        {
+            try
+            {
+                stream.flush();
+            }
+            catch (const std::exception& e)
+            {
+                throw com_error(e.what(), STG_E_MEDIUMFULL);
+            }
+        }
+
+        if (!stream.good())
+        {
+            throw com_error("Writing to stream failed", STG_E_MEDIUMFULL);
+        }
+    }
+
+    /**
+     * Write to the stream and, if `flush` is set, flush it.
+     *
+     * Without the flush, errors only show up here if the write overflows the
+     * stream's buffer.  Otherwise they are reported by whichever later
+     * call flushes the stream.
+     */
     inline void do_ostream_write(
         std::ostream& stream, const void* buffer, ULONG buffer_size_in_bytes,
-        ULONG& bytes_written_out)
+        ULONG& bytes_written_out, bool flush)
     {
         // If there is an error we cannot get a reliable write count, even
         // if we were to use stream.rdbuf()->sputn, because the failure
@@ -144,21 +244,89 @@ namespace impl {
             reinterpret_cast<const char*>(buffer),
             buffer_size_in_bytes / sizeof(std::ostream::char_type));
 
+        finish_ostream_write(stream, flush);
+
+        bytes_written_out = buffer_size_in_bytes;
+    }
+
+    /**
+     * Set `badbit` as a failing stream operation would, even if the stream
+     * is set to throw on it.
+     */
+    inline void mark_stream_bad(std::ios& stream)
+    {
         try
         {
-            stream.flush();
+            stream.setstate(std::ios_base::badbit);
         }
-        catch (const std::exception& e)
+        catch (const std::exception&)
+        {}
+    }
+
+    /**
+     * Move up to `count` characters from one stream's buffer to another's.
+     *
+     * The characters go straight from the source's get area to the
+     * destination's put area, the stream buffers only being called on to
+     * refill or empty those areas.
+     *
+     * Both counts are correct even if this throws.  A character read but
+     * not written, because writing failed, counts only as read.  Reaching
+     * the end of the source sets its `eofbit`, as reading would.
+     */
+    inline void splice_streams(
+        std::istream& source, std::ostream& destination, ULONG count,
+        ULONG& read_out, ULONG& written_out)
+    {
+        typedef std::istream::traits_type traits_type;
+
+        read_out = 0U;
+        written_out = 0U;
+
+        std::streambuf& in = *source.rdbuf();
+        std::streambuf& out = *destination.rdbuf();
+
+        bool reading = true;
+        try
         {
-            throw com_error(e.what(), STG_E_MEDIUMFULL);
-        }
+            while (read_out < count)
+            {
+                reading = true;
+                traits_type::int_type c = in.sbumpc();
+                if (traits_type::eq_int_type(c, traits_type::eof()))
+                {
+                    source.setstate(std::ios_base::eofbit);
+                    return;
+                }
+                ++read_out;
 
-        if (stream.good())
+                reading = false;
+                if (traits_type::eq_int_type(
+                        out.sputc(traits_type::to_char_type(c)),
+                        traits_type::eof()))
+                {
+                    break;
+                }
+                ++written_out;
+            }
+        }
+        catch (const std::exception& e)
         {
-            bytes_written_out = buffer_size_in_bytes;
+            if (reading)
+            {
+                mark_stream_bad(source);
+                throw std::runtime_error("Reading from stream failed");
+            }
+            else
+            {
+                mark_stream_bad(destination);
+                throw com_error(e.what(), STG_E_MEDIUMFULL);
+            }
         }
-        else
+
+        if (written_out < read_out)
         {
+            mark_stream_bad(destination);
             throw com_error("Writing to stream failed", STG_E_MEDIUMFULL);
         }
     }
@@ -423,7 +591,8 @@ namespace impl {
 
         void do_write(
             const void* /*buffer*/,
-            ULONG /*buffer_size_in_bytes*/, ULONG& bytes_written_out)
+            ULONG /*buffer_size_in_bytes*/, ULONG& bytes_written_out,
+            bool /*flush*/)
         {
             bytes_written_out = 0U;
             throw com_error(
@@ -461,6 +630,22 @@ namespace impl {
                 STG_E_ACCESSDENIED);
         }
 
+        std::istream* splice_source()
+        {
+            return &m_stream;
+        }
+
+        std::ostream* splice_destination()
+        {
+            return NULL;
+        }
+
+        void end_splice(bool /*flush*/)
+        {
+            throw com_error(
+                "std::istream does not support writing", STG_E_ACCESSDENIED);
+        }
+
     private:
         stream_traits(const stream_traits&);
         stream_traits& operator=(const stream_traits&);
@@ -485,10 +670,11 @@ namespace impl {
 
         void do_write(
             const void* buffer,
-            ULONG buffer_size_in_bytes, ULONG& bytes_written_out)
+            ULONG buffer_size_in_bytes, ULONG& bytes_written_out, bool flush)
         {
             do_ostream_write(
-                m_stream, buffer, buffer_size_in_bytes, bytes_written_out);
+                m_stream, buffer, buffer_size_in_bytes, bytes_written_out,
+                flush);
         }
 
         void do_seek(
@@ -524,6 +710,21 @@ namespace impl {
             }
         }
 
+        std::istream* splice_source()
+        {
+            return NULL;
+        }
+
+        std::ostream* splice_destination()
+        {
+            return &m_stream;
+        }
+
+        void end_splice(bool flush)
+        {
+            finish_ostream_write(m_stream, flush);
+        }
+
     private:
         stream_traits(const stream_traits&);
         stream_traits& operator=(const stream_traits&);
@@ -551,18 +752,7 @@ namespace impl {
         {
             bytes_read_out = 0U;
 
-            // sync reading position with writing position, which was the last
-            // one used and is allowed to be different in C++ streams but
-            // not COM IStreams
-            if (m_last_op == write)
-            {
-                m_stream.seekg(m_stream.tellp());
-                // We ignore errors syncing the positions as even iostreams may
-                // not be seekable at all
-
-                m_last_op = read;
-            }
-            assert(m_last_op == read);
+            sync_for_read();
 
             do_istream_read(
                 m_stream, buffer, buffer_size_in_bytes, bytes_read_out);
@@ -570,25 +760,15 @@ namespace impl {
 
         void do_write(
             const void* buffer, ULONG buffer_size_in_bytes,
-            ULONG& bytes_written_out)
+            ULONG& bytes_written_out, bool flush)
         {
             bytes_written_out = 0U;
 
-            // sync writing position with reading position, which was the last
-            // one used and is allowed to be different in C++ streams but
-            // not COM IStreams
-            if (m_last_op == read)
-            {
-                m_stream.seekp(m_stream.tellg());
-                // We ignore errors syncing the positions as even iostreams may
-                // not be seekable at all
-
-                m_last_op = write;
-            }
-            assert(m_last_op == write);
+            sync_for_write();
 
             do_ostream_write(
-                m_stream, buffer, buffer_size_in_bytes, bytes_written_out);
+                m_stream, buffer, buffer_size_in_bytes, bytes_written_out,
+                flush);
         }
 
         void do_seek(
@@ -668,10 +848,63 @@ namespace impl {
             }
         }
 
+        std::istream* splice_source()
+        {
+            sync_for_read();
+            return &m_stream;
+        }
+
+        std::ostream* splice_destination()
+        {
+            sync_for_write();
+            return &m_stream;
+        }
+
+        void end_splice(bool flush)
+        {
+            finish_ostream_write(m_stream, flush);
+        }
+
     private:
         stream_traits(const stream_traits&);
         stream_traits& operator=(const stream_traits&);
 
+        /**
+         * Sync reading position with writing position, which was the last
+         * one used and is allowed to be different in C++ streams but
+         * not COM IStreams.
+         */
+        void sync_for_read()
+        {
+            if (m_last_op == write)
+            {
+                m_stream.seekg(m_stream.tellp());
+                // We ignore errors syncing the positions as even iostreams may
+                // not be seekable at all
+
+                m_last_op = read;
+            }
+            assert(m_last_op == read);
+        }
+
+        /**
+         * Sync writing position with reading position, which was the last
+         * one used and is allowed to be different in C++ streams but
+         * not COM IStreams.
+         */
+        void sync_for_write()
+        {
+            if (m_last_op == read)
+            {
+                m_stream.seekp(m_stream.tellg());
+                // We ignore errors syncing the positions as even iostreams may
+                // not be seekable at all
+
+                m_last_op = write;
+            }
+            assert(m_last_op == write);
+        }
+
         Stream& m_stream;
         last_stream_operation m_last_op;
     };
@@ -698,9 +931,14 @@ namespace impl {
      * on the underlying stream.  Fatal errors (`badbit`) and end-of-file
      * (`eofbit`) are left unchanged and remain visible in the underlying
      * stream.
+     *
+     * With a non-zero flush threshold, `Write` only flushes the wrapped
+     * stream once that many bytes have been written since the last flush.
+     * `Commit` and destruction flush whatever is left.
      */
     template<typename Stream>
-    class adapted_stream : public simple_object<IStream>
+    class adapted_stream :
+        public simple_object<IStream, stream_splice_target>
     {
     private:
 
@@ -712,9 +950,33 @@ namespace impl {
 
     public:
 
-        adapted_stream(Stream& stream, const bstr_t& optional_name)
+        adapted_stream(
+            Stream& stream, const bstr_t& optional_name,
+            size_t flush_threshold=0)
             : m_stream(stream), m_traits(stream),
-            m_optional_name(optional_name) {}
+            m_optional_name(optional_name),
+            m_flush_threshold(flush_threshold), m_unflushed(0U) {}
+
+        /**
+         * Flush any writes still in the wrapped stream's buffer.
+         *
+         * A destructor cannot report errors so these are lost.  Callers of
+         * a buffered adapter that need to know the data arrived must call
+         * `Commit` before releasing it.
+         */
+        ~adapted_stream()
+        {
+            if (m_unflushed != 0U)
+            {
+                try
+                {
+                    stream_failure_cleanser<Stream> state_resetter(m_stream);
+                    m_traits.do_flush();
+                }
+                catch (const std::exception&)
+                {}
+            }
+        }
 
         /**
          * Fill the given buffer with data read from the wrapped C++ stream.
@@ -824,6 +1086,12 @@ namespace impl {
          * Therefore, best performance is obtained if this method is called with
          * as much data as possible for the fewest number of flushes.
          *
+         * A buffered adapter (see `adapt_stream_buffered`) only flushes once
+         * the bytes written since the last flush reach its threshold.  Until
+         * then, data may sit in the stream's buffer and an error writing it
+         * out is reported by the call that does flush: a later `Write` (as
+         * `STG_E_MEDIUMFULL`, as here) or `Commit`.
+         *
          * @param [in] data
          *     Bytes to write to the controlled sequence.
          *
@@ -891,7 +1159,11 @@ namespace impl {
                     written_count_out = &dummy_written_count;
                 }
 
-                m_traits.do_write(data, data_size, *written_count_out);
+                bool flush = m_unflushed + data_size >= m_flush_threshold;
+
+                m_traits.do_write(data, data_size, *written_count_out, flush);
+
+                m_unflushed = (flush) ? 0U : m_unflushed + data_size;
 
                 if (*written_count_out < data_size)
                 {
@@ -1031,7 +1303,7 @@ namespace impl {
                         // Force the stream to expand by writing NUL at
                         // new extent
                         ULONG bytes_written;
-                        m_traits.do_write("\0", 1, bytes_written);
+                        m_traits.do_write("\0", 1, bytes_written, true);
                         assert(bytes_written == 1);
                     }
                 }
@@ -1070,55 +1342,27 @@ namespace impl {
                         "Destination stream not given", STG_E_INVALIDPOINTER);
                 }
 
-                std::vector<unsigned char> buffer(COPY_CHUNK_SIZE);
-
-                // Perform copy operation in chunks COPY_CHUNK bytes big
-                // The chunk must be less than the biggest ULONG in size
-                // because of the limits of the Read/Write API.  Of course
-                // it will be in any case as it would be insane to use more
-                // memory than that, but we make sure anyway using the first
-                // min comparison
-                do {
-                    ULONG next_chunk_size =
-                        static_cast<ULONG>(
-                            min(
-                                (std::numeric_limits<ULONG>::max)(),
-                                min(
-                                    amount.QuadPart - bytes_read_out->QuadPart,
-                                    buffer.size())));
-
-                    ULONG read_this_round = 0U;
-                    ULONG written_this_round = 0U;
-
-                    // These two take care of updating the total on each pass
-                    // round the loop as well as on termination, exception or
-                    // natural.
-                    //
-                    // The means the out counts are valid even in the failure
-                    // case. MSDN says they don't have to be but, as we can,
-                    // we might as well
-                    impl::byte_count_incrementer read_incrementer(
-                        bytes_read_out, read_this_round);
-
-                    impl::byte_count_incrementer write_incrementer(
-                        bytes_written_out, written_this_round);
-
-                    m_traits.do_read(
-                        &buffer[0], next_chunk_size, read_this_round);
-                    HRESULT hr = destination->Write(
-                        &buffer[0], read_this_round, &written_this_round);
-                    if (FAILED(hr))
-                    {
-                        throw com_error_from_interface(destination, hr);
-                    }
-
-                    if (read_this_round < next_chunk_size)
-                    {
-                        // EOF
-                        break;
-                    }
+                // If the destination is another adapter, move the bytes
+                // between the C++ streams directly
+                com_ptr<stream_splice_target> target(com_cast(destination));
+                std::ostream* destination_stream = (!target.is_null()) ?
+                    target->begin_splice(splice_module_tag()) : NULL;
+                std::istream* source_stream = (destination_stream) ?
+                    m_traits.splice_source() : NULL;
 
-                } while (amount.QuadPart > bytes_read_out->QuadPart);
+                if (source_stream && source_stream->good() &&
+                    source_stream->rdbuf() != destination_stream->rdbuf())
+                {
+                    splice_to(
+                        *source_stream, *destination_stream, target.get(),
+                        amount, bytes_read_out, bytes_written_out);
+                }
+                else
+                {
+                    write_to(
+                        destination, amount, bytes_read_out,
+                        bytes_written_out);
+                }
 
                 return S_OK;
             }
@@ -1139,6 +1383,7 @@ namespace impl {
 
             try
             {
+                m_unflushed = 0U;
                 m_traits.do_flush();
                 return S_OK;
             }
@@ -1276,20 +1521,177 @@ namespace impl {
             COMET_CATCH_CLASS_INTERFACE_BOUNDARY("Clone", "adapted_stream");
         }
 
+        virtual std::ostream* STDMETHODCALLTYPE begin_splice(
+            const void* module_tag)
+        {
+            try
+            {
+                if (module_tag != splice_module_tag())
+                {
+                    return NULL;
+                }
+
+                std::ostream* stream = m_traits.splice_destination();
+                return (stream && stream->good()) ? stream : NULL;
+            }
+            catch (const std::exception&)
+            {
+                return NULL;
+            }
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE end_splice(ULONG written)
+        {
+            stream_failure_cleanser<Stream> state_resetter(m_stream);
+
+            try
+            {
+                bool flush = m_unflushed + written >= m_flush_threshold;
+
+                m_traits.end_splice(flush);
+
+                m_unflushed = (flush) ? 0U : m_unflushed + written;
+                return S_OK;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY("CopyTo", "adapted_stream");
+        }
+
     private:
 
+        /**
+         * Copy by reading chunks into a buffer and writing them to the
+         * destination.
+         */
+        void write_to(
+            IStream* destination, ULARGE_INTEGER amount,
+            ULARGE_INTEGER* bytes_read_out, ULARGE_INTEGER* bytes_written_out)
+        {
+            // No bigger than needed, as small copies are common
+            std::vector<unsigned char> buffer(
+                (amount.QuadPart < COPY_CHUNK_SIZE) ?
+                static_cast<size_t>(amount.QuadPart) + 1 : COPY_CHUNK_SIZE);
+
+            // Perform copy operation in chunks COPY_CHUNK bytes big
+            // The chunk must be less than the biggest ULONG in size
+            // because of the limits of the Read/Write API.  Of course
+            // it will be in any case as it would be insane to use more
+            // memory than that, but we make sure anyway using the first
+            // min comparison
+            do {
+                ULONG next_chunk_size =
+                    static_cast<ULONG>(
+                        min(
+                            (std::numeric_limits<ULONG>::max)(),
+                            min(
+                                amount.QuadPart - bytes_read_out->QuadPart,
+                                buffer.size())));
+
+                ULONG read_this_round = 0U;
+                ULONG written_this_round = 0U;
+
+                // These two take care of updating the total on each pass
+                // round the loop as well as on termination, exception or
+                // natural.
+                //
+                // The means the out counts are valid even in the failure
+                // case. MSDN says they don't have to be but, as we can,
+                // we might as well
+                impl::byte_count_incrementer read_incrementer(
+                    bytes_read_out, read_this_round);
+
+                impl::byte_count_incrementer write_incrementer(
+                    bytes_written_out, written_this_round);
+
+                m_traits.do_read(
+                    &buffer[0], next_chunk_size, read_this_round);
+                HRESULT hr = destination->Write(
+                    &buffer[0], read_this_round, &written_this_round);
+                if (FAILED(hr))
+                {
+                    throw com_error_from_interface(destination, hr);
+                }
+
+                if (read_this_round < next_chunk_size)
+                {
+                    // EOF
+                    break;
+                }
+
+            } while (amount.QuadPart > bytes_read_out->QuadPart);
+        }
+
+        /**
+         * Copy by moving chunks straight from our stream's buffer to the
+         * buffer of another adapter's stream.
+         *
+         * The destination flushes after each chunk if `Write` would have,
+         * so errors and counts are as `write_to` would give.
+         */
+        void splice_to(
+            std::istream& source, std::ostream& destination,
+            stream_splice_target* target, ULARGE_INTEGER amount,
+            ULARGE_INTEGER* bytes_read_out, ULARGE_INTEGER* bytes_written_out)
+        {
+            do {
+                ULONG next_chunk_size =
+                    static_cast<ULONG>(
+                        min(
+                            amount.QuadPart - bytes_read_out->QuadPart,
+                            COPY_CHUNK_SIZE));
+
+                ULONG read_this_round = 0U;
+                ULONG written_this_round = 0U;
+
+                impl::byte_count_incrementer read_incrementer(
+                    bytes_read_out, read_this_round);
+
+                impl::byte_count_incrementer write_incrementer(
+                    bytes_written_out, written_this_round);
+
+                // Bytes only count as written once the destination has
+                // accepted them, as they would be by its Write
+                ULONG spliced = 0U;
+                splice_streams(
+                    source, destination, next_chunk_size, read_this_round,
+                    spliced);
+
+                HRESULT hr = target->end_splice(spliced);
+                if (FAILED(hr))
+                {
+                    throw com_error_from_interface(target, hr);
+                }
+
+                written_this_round = spliced;
+
+                if (read_this_round < next_chunk_size)
+                {
+                    // EOF
+                    break;
+                }
+
+            } while (amount.QuadPart > bytes_read_out->QuadPart);
+        }
+
         Stream& m_stream;
         stream_traits_type m_traits;
         bstr_t m_optional_name;
+        size_t m_flush_threshold;
+        ULONGLONG m_unflushed;
     };
 
     template<typename StreamPtr>
-    class adapted_stream_pointer : public simple_object<IStream>
+    class adapted_stream_pointer :
+        public simple_object<IStream, stream_splice_target>
     {
     public:
 
-        adapted_stream_pointer(StreamPtr stream, const bstr_t& optional_name)
-            : m_stream(stream), m_inner(adapt_stream(*m_stream, optional_name))
+        adapted_stream_pointer(
+            StreamPtr stream, const bstr_t& optional_name,
+            size_t flush_threshold=0)
+            : m_stream(stream),
+            m_inner(
+                adapt_stream_buffered(
+                    *m_stream, flush_threshold, optional_name))
         {}
 
         // The forwarded methods must return their HRESULT by throwing and
@@ -1495,6 +1897,29 @@ namespace impl {
                 "Clone", "adapted_stream_pointer");
         }
 
+        virtual std::ostream* STDMETHODCALLTYPE begin_splice(
+            const void* module_tag)
+        {
+            com_ptr<stream_splice_target> inner(com_cast(m_inner));
+            return (!inner.is_null()) ?
+                inner->begin_splice(module_tag) : NULL;
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE end_splice(ULONG written)
+        {
+            try
+            {
+                com_ptr<stream_splice_target> inner(try_cast(m_inner));
+                HRESULT hr = inner->end_splice(written);
+                if (FAILED(hr))
+                    throw com_error_from_interface(inner, hr);
+
+                return hr;
+            }
+            COMET_CATCH_CLASS_INTERFACE_BOUNDARY(
+                "CopyTo", "adapted_stream_pointer");
+        }
+
     private:
 
         StreamPtr m_stream;
@@ -1536,6 +1961,35 @@ inline com_ptr<IStream> adapt_stream(
     return new impl::adapted_stream<Stream>(stream, optional_name);
 }
 
+/**
+ * Wrap COM IStream interface around C++ IOStream, flushing only once
+ * `flush_threshold` bytes have been written since the last flush.
+ *
+ * `adapt_stream` flushes the C++ stream on every `Write` so that write
+ * errors are reported by the `Write` that caused them.  For a client writing
+ * a large stream in small chunks, that is a system call per chunk.  This
+ * adapter leaves the data in the C++ stream's buffer until the threshold is
+ * reached, `Commit` is called or the last reference is released.
+ *
+ * Error reporting is otherwise unchanged: a `Write` that fails, including
+ * one that fails flushing earlier data, returns `STG_E_MEDIUMFULL` and a
+ * written count of zero.  Errors flushing on release cannot be reported at
+ * all, so call `Commit` when you need to know that the data arrived.
+ *
+ * A threshold of zero flushes on every `Write`, as `adapt_stream` does.
+ *
+ * The caller must ensure that the C++ IOStream remains valid until the
+ * last reference to the returned wrapper is released.
+ */
+template<typename Stream>
+inline com_ptr<IStream> adapt_stream_buffered(
+    Stream& stream, size_t flush_threshold=COMET_STREAM_FLUSH_THRESHOLD,
+    const bstr_t& optional_name=bstr_t())
+{
+    return new impl::adapted_stream<Stream>(
+        stream, optional_name, flush_threshold);
+}
+
 /**
  * Wrap COM IStream interface around pointer (usually smart) to C++ IOStream.
  *
@@ -1561,6 +2015,24 @@ inline com_ptr<IStream> adapt_stream_pointer(
         stream_pointer, optional_name);
 }
 
+/**
+ * Wrap COM IStream interface around pointer (usually smart) to C++ IOStream,
+ * flushing only once `flush_threshold` bytes have been written since the
+ * last flush.
+ *
+ * This is to `adapt_stream_pointer` what `adapt_stream_buffered` is to
+ * `adapt_stream`.
+ */
+template<typename StreamPtr>
+inline com_ptr<IStream> adapt_stream_pointer_buffered(
+    StreamPtr stream_pointer,
+    size_t flush_threshold=COMET_STREAM_FLUSH_THRESHOLD,
+    const bstr_t& optional_name=bstr_t())
+{
+    return new impl::adapted_stream_pointer<StreamPtr>(
+        stream_pointer, optional_name, flush_threshold);
+}
+
 }
 
 #endif
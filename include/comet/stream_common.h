@@ -0,0 +1,92 @@
+/** \file
+  * Code common to IStream implementations.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_STREAM_COMMON_H
+#define COMET_STREAM_COMMON_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // com_error
+
+#include <limits> // numeric_limits
+
+namespace comet {
+
+    namespace impl {
+
+        /**
+         * Position `offset` bytes from `origin` in a stream of `size` bytes
+         * whose seek position is `position`, as IStream::Seek defines it.
+         *
+         * Positions past the end are allowed.
+         *
+         * \throw com_error STG_E_INVALIDFUNCTION if `origin` isn't a
+         *        STREAM_SEEK value or the new position would be before the
+         *        start of the stream or beyond the range of LONGLONG.
+         */
+        inline ULONGLONG seek_position(
+            ULONGLONG position, ULONGLONG size, LARGE_INTEGER offset,
+            DWORD origin)
+        {
+            LONGLONG base;
+            if (origin == STREAM_SEEK_SET)
+            {
+                base = 0;
+            }
+            else if (origin == STREAM_SEEK_CUR)
+            {
+                base = static_cast<LONGLONG>(position);
+            }
+            else if (origin == STREAM_SEEK_END)
+            {
+                base = static_cast<LONGLONG>(size);
+            }
+            else
+            {
+                throw com_error(
+                    "Unrecognised stream seek origin", STG_E_INVALIDFUNCTION);
+            }
+
+            if (offset.QuadPart < -base)
+            {
+                throw com_error(
+                    "Seek before start of stream", STG_E_INVALIDFUNCTION);
+            }
+            else if (offset.QuadPart >
+                (std::numeric_limits<LONGLONG>::max)() - base)
+            {
+                throw com_error("Seek offset too large", STG_E_INVALIDFUNCTION);
+            }
+
+            return static_cast<ULONGLONG>(base + offset.QuadPart);
+        }
+
+        /// Error for IStream::Revert on a stream without transactions.
+        inline com_error transactions_not_supported()
+        {
+            return com_error("Transactions not supported", E_NOTIMPL);
+        }
+
+        /// Error for IStream::LockRegion and UnlockRegion on a stream
+        /// without locking.
+        inline com_error locking_not_supported()
+        {
+            return com_error("Locking not supported", STG_E_INVALIDFUNCTION);
+        }
+    }
+}
+
+#endif
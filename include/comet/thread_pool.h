@@ -0,0 +1,550 @@
+/** \file
+  * Pool of worker threads that share out queued tasks by work stealing.
+  *
+  * See \ref cometthreadpool.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_THREAD_POOL_H
+#define COMET_THREAD_POOL_H
+
+#include <comet/config.h>
+
+#include <comet/error.h> // com_error, raise_exception
+#include <comet/handle.h> // auto_handle
+#include <comet/threading.h> // critical_section, thread
+
+#include <algorithm> // swap
+#include <climits> // LONG_MAX
+#include <deque>
+#include <memory> // auto_ptr
+#include <stdexcept> // runtime_error
+#include <string>
+#include <vector>
+
+/** \page cometthreadpool Thread pool
+    thread_pool runs function objects on a fixed set of worker threads and
+    hands back a future for each one's result:
+
+    \code
+        struct checksum
+        {
+            explicit checksum(const std::vector<BYTE>& data) : data(data) {}
+            long operator()() const { ... }
+            std::vector<BYTE> data;
+        };
+
+        thread_pool pool;
+        future<long> sum = pool.submit<long>(checksum(data));
+        ...
+        long result = sum.get();
+    \endcode
+
+    Each worker has its own queue.  A task submitted from outside the pool
+    goes on the queues in turn, and a task submitted by a running task goes
+    on its own worker's queue, where it is likely to find the data its
+    parent left in the cache.  A worker takes its newest task first.  When
+    its queue is empty it steals the oldest task from another worker's
+    queue, so the work evens out without a single shared queue for every
+    thread to contend on.
+
+    If a task throws, future::get() throws in the thread that asks for the
+    result.  A com_error is rethrown as it was; any other exception is
+    rethrown as a std::runtime_error with the same message.
+
+    Workers can join a COM apartment, set by pool_apartment.  Workers in
+    single-threaded apartments pump messages while they wait for work, so
+    objects created by their tasks can be called from other apartments.
+    Such objects are only reachable between tasks, though, and must be
+    released by the task or the pool that created them.
+
+    Don't wait on a future from inside a task of the same pool unless other
+    workers are free to run the task waited for.
+*/
+
+namespace comet {
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /// COM apartment that thread_pool workers join.
+    enum pool_apartment
+    {
+        /// Don't initialise COM.
+        pool_apartment_none,
+
+        /// Join the multithreaded apartment.
+        pool_apartment_mta,
+
+        /// Each worker is a single-threaded apartment and pumps messages
+        /// while it waits.
+        pool_apartment_sta
+    };
+
+    //@}
+
+    namespace impl {
+
+        /** Task queued on a thread_pool.
+         * \internal
+         */
+        class pool_task
+        {
+        public:
+            pool_task() : rc_(1) {}
+            virtual ~pool_task() {}
+
+            virtual void run() = 0;
+
+            void add_ref() { InterlockedIncrement(&rc_); }
+            void release() { if (InterlockedDecrement(&rc_) == 0) delete this; }
+
+        private:
+            pool_task(const pool_task&);
+            pool_task& operator=(const pool_task&);
+
+            long rc_;
+        };
+
+        /// Result of a task.  R must be default-constructible.
+        template<typename R> struct task_value
+        {
+            template<typename F> void compute(F& task) { value = task(); }
+            R get() const { return value; }
+
+            R value;
+        };
+
+        template<> struct task_value<void>
+        {
+            template<typename F> void compute(F& task) { task(); }
+            void get() const {}
+        };
+
+        /** Outcome of a task, shared by the task and its futures.
+         * \internal
+         */
+        template<typename R> class task_state : public pool_task
+        {
+        public:
+            task_state() : failed_(false)
+            {
+                done_ = auto_attach(::CreateEvent(0, true, false, 0));
+                if (!done_)
+                    raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+            }
+
+            bool wait(DWORD timeout) const
+            {
+                return ::WaitForSingleObject(done_, timeout) == WAIT_OBJECT_0;
+            }
+
+            HANDLE done_event() const
+            {
+                return done_;
+            }
+
+            R get() const
+            {
+                wait(INFINITE);
+                if (com_error_.get())
+                    throw *com_error_;
+                if (failed_)
+                    throw std::runtime_error(error_);
+                return value_.get();
+            }
+
+        protected:
+            template<typename F> void complete(F& task)
+            {
+                try
+                {
+                    value_.compute(task);
+                }
+                catch (const com_error& e)
+                {
+                    com_error_.reset(new com_error(e));
+                }
+                catch (const std::exception& e)
+                {
+                    failed_ = true;
+                    error_ = e.what();
+                }
+                catch (...)
+                {
+                    failed_ = true;
+                    error_ = "Unknown exception in thread_pool task";
+                }
+                ::SetEvent(done_);
+            }
+
+        private:
+            task_value<R> value_;
+            std::auto_ptr<com_error> com_error_;
+            bool failed_;
+            std::string error_;
+            auto_handle done_;
+        };
+
+        template<typename R, typename F>
+        class pool_task_t : public task_state<R>
+        {
+        public:
+            explicit pool_task_t(const F& task) : task_(task) {}
+
+            void run() { this->complete(task_); }
+
+        private:
+            F task_;
+        };
+
+        /** One worker's tasks.
+         * \internal
+         */
+        struct work_queue
+        {
+            critical_section cs;
+            std::deque<pool_task*> tasks;
+        };
+
+        /** Worker thread that runs an owner's task loop.
+         * \internal
+         */
+        template<typename Owner> class pool_worker : public thread
+        {
+        public:
+            pool_worker(Owner& owner, size_t index)
+                : owner_(owner), index_(index) {}
+
+        private:
+            DWORD thread_main()
+            {
+                owner_.run(index_);
+                return 0;
+            }
+
+            Owner& owner_;
+            size_t index_;
+        };
+    }
+
+    /*! \addtogroup Misc
+     */
+    //@{
+
+    /** \class future  thread_pool.h comet/thread_pool.h
+      * Result of a task submitted to a thread_pool.
+      *
+      * Copies refer to the same result.
+      */
+    template<typename R> class future
+    {
+    public:
+        /// Future for no task; only assignment and is_null() are allowed.
+        future() : state_(0) {}
+
+        explicit future(impl::task_state<R>* state) : state_(state)
+        {
+            state_->add_ref();
+        }
+
+        future(const future& other) : state_(other.state_)
+        {
+            if (state_)
+                state_->add_ref();
+        }
+
+        future& operator=(const future& other)
+        {
+            future copy(other);
+            std::swap(state_, copy.state_);
+            return *this;
+        }
+
+        ~future()
+        {
+            if (state_)
+                state_->release();
+        }
+
+        bool is_null() const
+        {
+            return state_ == 0;
+        }
+
+        /// Has the task finished?
+        bool ready() const
+        {
+            return state_->wait(0);
+        }
+
+        /// Wait for the task to finish.  Returns false on timeout.
+        bool wait(DWORD timeout=INFINITE) const
+        {
+            return state_->wait(timeout);
+        }
+
+        /// Wait for the task and return its result or throw its exception.
+        R get() const
+        {
+            return state_->get();
+        }
+
+        /**
+         * Manual-reset event signalled when the task finishes.
+         * For waiting on together with other handles; don't reset it.
+         */
+        HANDLE completion_event() const
+        {
+            return state_->done_event();
+        }
+
+    private:
+        impl::task_state<R>* state_;
+    };
+
+    /** \class thread_pool  thread_pool.h comet/thread_pool.h
+      * Fixed set of worker threads that run submitted function objects.
+      * See \ref cometthreadpool.
+      */
+    class thread_pool
+    {
+    public:
+        /**
+         * Start the worker threads.
+         *
+         * \param worker_count  Number of workers; 0 means one per processor.
+         * \param apartment     COM apartment each worker joins.
+         */
+        explicit thread_pool(
+            size_t worker_count=0, pool_apartment apartment=pool_apartment_mta)
+            : apartment_(apartment), next_queue_(0), stopping_(false),
+              tls_(TLS_OUT_OF_INDEXES)
+        {
+            if (worker_count == 0)
+            {
+                SYSTEM_INFO info;
+                ::GetSystemInfo(&info);
+                worker_count = info.dwNumberOfProcessors;
+            }
+
+            tls_ = ::TlsAlloc();
+            work_signal_ = auto_attach(::CreateSemaphore(0, 0, LONG_MAX, 0));
+            if (tls_ == TLS_OUT_OF_INDEXES || !work_signal_)
+            {
+                HRESULT hr = HRESULT_FROM_WIN32(::GetLastError());
+                if (tls_ != TLS_OUT_OF_INDEXES)
+                    ::TlsFree(tls_);
+                raise_exception(hr);
+            }
+
+            try
+            {
+                for (size_t i = 0; i < worker_count; ++i)
+                    queues_.push_back(new impl::work_queue());
+
+                for (size_t i = 0; i < worker_count; ++i)
+                {
+                    workers_.push_back(new worker_type(*this, i));
+                    if (!workers_.back()->start())
+                        raise_exception(HRESULT_FROM_WIN32(::GetLastError()));
+                }
+            }
+            catch (...)
+            {
+                stop();
+                throw;
+            }
+        }
+
+        /// Run the tasks already submitted, then stop the workers.
+        ~thread_pool()
+        {
+            stop();
+        }
+
+        /**
+         * Queue a task.
+         *
+         * \tparam R    Type `task()` returns, which may be void.
+         * \param task  Function object called with no arguments.  Copied.
+         */
+        template<typename R, typename F>
+        future<R> submit(const F& task)
+        {
+            impl::pool_task_t<R, F>* queued = new impl::pool_task_t<R, F>(task);
+            future<R> result(queued);
+            push(queued);
+            return result;
+        }
+
+        /// Number of worker threads.
+        size_t size() const
+        {
+            return workers_.size();
+        }
+
+    private:
+        typedef impl::pool_worker<thread_pool> worker_type;
+        friend class impl::pool_worker<thread_pool>;
+
+        /// Takes ownership of `task`.
+        void push(impl::pool_task* task)
+        {
+            // Tasks submitted by a worker stay with it unless stolen
+            size_t index = reinterpret_cast<size_t>(::TlsGetValue(tls_));
+            if (index == 0)
+                index = static_cast<size_t>(
+                    InterlockedIncrement(&next_queue_)) % queues_.size();
+            else
+                --index;
+
+            {
+                auto_cs lock(queues_[index]->cs);
+                queues_[index]->tasks.push_back(task);
+            }
+            ::ReleaseSemaphore(work_signal_, 1, 0);
+        }
+
+        /// Newest task from the worker's own queue, or the oldest from
+        /// another's.
+        impl::pool_task* take(size_t index)
+        {
+            {
+                impl::work_queue& own = *queues_[index];
+                auto_cs lock(own.cs);
+                if (!own.tasks.empty())
+                {
+                    impl::pool_task* task = own.tasks.back();
+                    own.tasks.pop_back();
+                    return task;
+                }
+            }
+
+            for (size_t i = 1; i < queues_.size(); ++i)
+            {
+                impl::work_queue& victim =
+                    *queues_[(index + i) % queues_.size()];
+                auto_cs lock(victim.cs);
+                if (!victim.tasks.empty())
+                {
+                    impl::pool_task* task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    return task;
+                }
+            }
+
+            return 0;
+        }
+
+        /// Task loop run by each worker thread.
+        void run(size_t index)
+        {
+            ::TlsSetValue(tls_, reinterpret_cast<void*>(index + 1));
+
+            HRESULT hr = S_FALSE;
+            if (apartment_ == pool_apartment_mta)
+                hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+            else if (apartment_ == pool_apartment_sta)
+                hr = ::CoInitializeEx(0, COINIT_APARTMENTTHREADED);
+
+            for (;;)
+            {
+                impl::pool_task* task = take(index);
+                if (task)
+                {
+                    task->run();
+                    task->release();
+                    continue;
+                }
+
+                if (stopping_)
+                    break;
+
+                wait_for_work();
+            }
+
+            if (apartment_ != pool_apartment_none && SUCCEEDED(hr))
+                ::CoUninitialize();
+        }
+
+        void wait_for_work()
+        {
+            if (apartment_ != pool_apartment_sta)
+            {
+                ::WaitForSingleObject(work_signal_, INFINITE);
+                return;
+            }
+
+            HANDLE signal = work_signal_;
+            if (::MsgWaitForMultipleObjects(
+                    1, &signal, FALSE, INFINITE, QS_ALLINPUT) ==
+                WAIT_OBJECT_0 + 1)
+            {
+                MSG msg;
+                while (::PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
+                {
+                    ::TranslateMessage(&msg);
+                    ::DispatchMessage(&msg);
+                }
+            }
+        }
+
+        void stop()
+        {
+            stopping_ = true;
+            if (work_signal_)
+                ::ReleaseSemaphore(
+                    work_signal_, static_cast<LONG>(workers_.size()), 0);
+
+            for (size_t i = 0; i < workers_.size(); ++i)
+            {
+                if (workers_[i]->handle())
+                    workers_[i]->wait();
+                delete workers_[i];
+            }
+            workers_.clear();
+
+            for (size_t i = 0; i < queues_.size(); ++i)
+            {
+                // Only left if a worker failed to start
+                for (size_t j = 0; j < queues_[i]->tasks.size(); ++j)
+                    queues_[i]->tasks[j]->release();
+                delete queues_[i];
+            }
+            queues_.clear();
+
+            if (tls_ != TLS_OUT_OF_INDEXES)
+                ::TlsFree(tls_);
+            tls_ = TLS_OUT_OF_INDEXES;
+        }
+
+        thread_pool(const thread_pool&);
+        thread_pool& operator=(const thread_pool&);
+
+        const pool_apartment apartment_;
+        long next_queue_;
+        volatile bool stopping_;
+        DWORD tls_;
+
+        std::vector<impl::work_queue*> queues_;
+        auto_handle work_signal_;
+        std::vector<worker_type*> workers_;
+    };
+
+    //@}
+}
+
+#endif
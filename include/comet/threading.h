@@ -111,6 +111,31 @@ private:
     locking_ptr& operator=(const locking_ptr&);
 };
 
+namespace impl {
+
+    /** Publish `candidate` in `slot` unless another thread already has.
+     *
+     * For objects created on first use by whichever thread gets there
+     * first.  A constant-initialised static pointer is safe to race on,
+     * unlike a function-local static object before C++11.  Racing threads
+     * may each create a candidate, and all but the published one are
+     * deleted, so creating one must have no effect outside the object.
+     *
+     * \returns The published object.
+     */
+    template<typename T>
+    inline T* publish_once(T* volatile& slot, T* candidate)
+    {
+        T* published = static_cast<T*>(InterlockedCompareExchangePointer(
+            reinterpret_cast<void* volatile*>(&slot), candidate, 0));
+        if (published == 0)
+            return candidate;
+
+        delete candidate;
+        return published;
+    }
+}
+
 class thread
 {
 private:
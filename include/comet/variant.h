@@ -27,7 +27,9 @@
 #include <comet/bstr.h>
 #include <comet/currency.h>
 
+#include <cmath> // floor, fmod
 #include <iostream>
+#include <limits> // numeric_limits
 
 #pragma warning(push)
 #pragma warning(disable : 4127)
@@ -54,6 +56,9 @@
     func() const                                                    \
     {                                                                \
         if (V_VT(this) == VT_##vartype) return V_##vartype(this);    \
+        type fast_result;                                            \
+        if (impl::fast_change_type(get(), fast_result))              \
+            return fast_result;                                      \
         variant_t v(*this, VT_##vartype);                            \
         return V_##vartype(v.get_var());                            \
     }                                                                \
@@ -124,6 +129,640 @@ namespace comet {
             }
         }
 
+        /**
+         * \name Inline conversions.
+         *
+         * Conversions between numeric types that don't depend on the locale
+         * are done inline rather than by VariantChangeTypeEx.  Each function
+         * returns false, leaving the result unset, if the value doesn't fit
+         * the target type so that the caller can fall back to
+         * VariantChangeTypeEx and get the same error it always did.
+         */
+        //@{
+
+        template<typename T>
+        inline bool numeric_from_signed(LONGLONG x, T& out)
+        {
+            if (std::numeric_limits<T>::is_signed)
+            {
+                if (x < static_cast<LONGLONG>((std::numeric_limits<T>::min)()) ||
+                    x > static_cast<LONGLONG>((std::numeric_limits<T>::max)()))
+                    return false;
+            }
+            else
+            {
+                if (x < 0 ||
+                    static_cast<ULONGLONG>(x) >
+                    static_cast<ULONGLONG>((std::numeric_limits<T>::max)()))
+                    return false;
+            }
+
+            out = static_cast<T>(x);
+            return true;
+        }
+
+        template<typename T>
+        inline bool numeric_from_unsigned(ULONGLONG x, T& out)
+        {
+            if (x > static_cast<ULONGLONG>((std::numeric_limits<T>::max)()))
+                return false;
+
+            out = static_cast<T>(x);
+            return true;
+        }
+
+        /// Rounds half to even, as VariantChangeTypeEx does.
+        template<typename T>
+        inline bool numeric_from_real(double x, T& out)
+        {
+            if (x != x) // NaN
+                return false;
+
+            double rounded = std::floor(x);
+            double fraction = x - rounded;
+            if (fraction > 0.5 ||
+                (fraction == 0.5 && std::fmod(rounded, 2.0) != 0.0))
+                rounded += 1.0;
+
+            // max() + 1 is exact for types narrower than 64 bits.  For the
+            // 64-bit types, max() itself rounds up to the next power of two.
+            if (rounded < static_cast<double>((std::numeric_limits<T>::min)()) ||
+                rounded >= static_cast<double>((std::numeric_limits<T>::max)()) + 1.0)
+                return false;
+
+            out = static_cast<T>(rounded);
+            return true;
+        }
+
+        /// VARIANT_TRUE is -1 so only signed types take it inline.
+        template<typename T>
+        inline bool numeric_from_bool(VARIANT_BOOL x, T& out)
+        {
+            if (!std::numeric_limits<T>::is_signed)
+                return false;
+
+            out = static_cast<T>((x != COMET_VARIANT_FALSE) ? -1 : 0);
+            return true;
+        }
+
+        inline bool numeric_from_signed(LONGLONG x, double& out)
+        {
+            out = static_cast<double>(x);
+            return true;
+        }
+
+        inline bool numeric_from_unsigned(ULONGLONG x, double& out)
+        {
+            out = static_cast<double>(x);
+            return true;
+        }
+
+        inline bool numeric_from_real(double x, double& out)
+        {
+            out = x;
+            return true;
+        }
+
+        inline bool numeric_from_bool(VARIANT_BOOL x, double& out)
+        {
+            out = (x != COMET_VARIANT_FALSE) ? -1.0 : 0.0;
+            return true;
+        }
+
+        inline bool numeric_from_signed(LONGLONG x, float& out)
+        {
+            out = static_cast<float>(x);
+            return true;
+        }
+
+        inline bool numeric_from_unsigned(ULONGLONG x, float& out)
+        {
+            out = static_cast<float>(x);
+            return true;
+        }
+
+        inline bool numeric_from_real(double x, float& out)
+        {
+            // NaN and out-of-range values fail both comparisons
+            if (!(x >= -(std::numeric_limits<float>::max)() &&
+                  x <= (std::numeric_limits<float>::max)()))
+                return false;
+
+            out = static_cast<float>(x);
+            return true;
+        }
+
+        inline bool numeric_from_bool(VARIANT_BOOL x, float& out)
+        {
+            out = (x != COMET_VARIANT_FALSE) ? -1.0f : 0.0f;
+            return true;
+        }
+
+        inline bool numeric_from_signed(LONGLONG x, bool& out)
+        {
+            out = (x != 0);
+            return true;
+        }
+
+        inline bool numeric_from_unsigned(ULONGLONG x, bool& out)
+        {
+            out = (x != 0);
+            return true;
+        }
+
+        inline bool numeric_from_real(double x, bool& out)
+        {
+            if (x != x) // NaN
+                return false;
+
+            out = (x != 0.0);
+            return true;
+        }
+
+        inline bool numeric_from_bool(VARIANT_BOOL x, bool& out)
+        {
+            out = (x != COMET_VARIANT_FALSE);
+            return true;
+        }
+
+        /**
+         * \name Inline string parsing.
+         *
+         * VariantChangeTypeEx looks up the locale's number settings and
+         * runs a general-purpose parser every time it converts a string.
+         * Plain decimal numbers in the common formats are parsed here
+         * instead, using separators read once per locale and then cached.
+         * As with the numeric conversions, anything not handled inline is
+         * left to VariantChangeTypeEx.
+         */
+        //@{
+
+#ifndef COMET_NUMBER_FORMAT_CACHE_SIZE
+#define COMET_NUMBER_FORMAT_CACHE_SIZE 8
+#endif
+
+        /// Separators used by a locale when parsing numbers.
+        struct number_format
+        {
+            LCID lcid;
+            wchar_t decimal_separator;
+            wchar_t thousands_separator; ///< NUL if the locale has none.
+            bool supported; ///< Whether the inline parser can handle it.
+            volatile LONG state;
+        };
+
+        /// Return a single-character locale setting or NUL if the setting is
+        /// longer.
+        inline wchar_t single_char_locale_info(LCID lcid, LCTYPE type)
+        {
+            wchar_t buffer[8];
+            int length = ::GetLocaleInfoW(lcid, type, buffer, 8);
+            return (length == 2) ? buffer[0] : L'\0';
+        }
+
+        /**
+         * Locale's number settings, read on first use.
+         *
+         * The cache is a fixed table of slots that are filled once and
+         * never change afterwards, so lookups need no lock.  Returns NULL
+         * if all the slots are taken by other locales.
+         *
+         * \note Changes to the user's regional settings are not noticed
+         *       once a locale has been cached.
+         */
+        inline const number_format* cached_number_format(LCID lcid)
+        {
+            enum { empty_slot = 0, filling_slot = 1, ready_slot = 2 };
+
+            // Zero-initialised before any code runs, so no race on first use
+            static number_format cache[COMET_NUMBER_FORMAT_CACHE_SIZE];
+
+            for (int i = 0; i < COMET_NUMBER_FORMAT_CACHE_SIZE; ++i)
+            {
+                number_format& slot = cache[i];
+
+                LONG state = slot.state;
+                if (state == ready_slot)
+                {
+                    if (slot.lcid == lcid)
+                        return &slot;
+                    continue;
+                }
+
+                // If another thread is filling this slot, we can't wait for
+                // it so look for another
+                if (::InterlockedCompareExchange(
+                    &slot.state, filling_slot, empty_slot) != empty_slot)
+                    continue;
+
+                slot.lcid = lcid;
+                slot.decimal_separator =
+                    single_char_locale_info(lcid, LOCALE_SDECIMAL);
+                slot.thousands_separator =
+                    single_char_locale_info(lcid, LOCALE_STHOUSAND);
+                slot.supported =
+                    slot.decimal_separator != L'\0' &&
+                    slot.decimal_separator != slot.thousands_separator &&
+                    single_char_locale_info(lcid, LOCALE_SNEGATIVESIGN) == L'-';
+
+                // Full barrier: the fields are visible before the state
+                ::InterlockedExchange(&slot.state, ready_slot);
+                return &slot;
+            }
+
+            return NULL;
+        }
+
+        /// Plain decimal number as digits and a power of ten.
+        struct parsed_number
+        {
+            ULONGLONG mantissa;
+            int exponent;
+            bool negative;
+            bool integral; ///< No fraction or exponent was given.
+        };
+
+        /**
+         * Parse an optional '-', digits optionally grouped by the thousands
+         * separator, an optional fraction and an optional exponent.
+         *
+         * No whitespace, currency symbols or other decoration is accepted
+         * and at most 19 significant digits are taken.
+         */
+        inline bool parse_number(
+            const wchar_t* text, size_t length, const number_format& format,
+            parsed_number& out)
+        {
+            const wchar_t* p = text;
+            const wchar_t* end = text + length;
+
+            out.mantissa = 0;
+            out.exponent = 0;
+            out.negative = false;
+            out.integral = true;
+
+            if (p != end && *p == L'-')
+            {
+                out.negative = true;
+                ++p;
+            }
+
+            int significant_digits = 0;
+            bool seen_digit = false;
+            bool in_fraction = false;
+
+            for (; p != end; ++p)
+            {
+                wchar_t c = *p;
+                if (c >= L'0' && c <= L'9')
+                {
+                    seen_digit = true;
+                    if (out.mantissa != 0 || c != L'0')
+                    {
+                        if (significant_digits == 19)
+                            return false;
+
+                        out.mantissa = out.mantissa * 10 + (c - L'0');
+                        ++significant_digits;
+                    }
+
+                    if (in_fraction)
+                        --out.exponent;
+                }
+                else if (!in_fraction && c == format.decimal_separator)
+                {
+                    in_fraction = true;
+                    out.integral = false;
+                }
+                else if (!in_fraction && c != L'\0' &&
+                    c == format.thousands_separator && seen_digit &&
+                    p + 1 != end && p[1] >= L'0' && p[1] <= L'9')
+                {
+                    // Grouping only between digits
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            if (!seen_digit)
+                return false;
+
+            if (p != end && (*p == L'e' || *p == L'E'))
+            {
+                ++p;
+                out.integral = false;
+
+                bool negative_exponent = false;
+                if (p != end && (*p == L'-' || *p == L'+'))
+                {
+                    negative_exponent = (*p == L'-');
+                    ++p;
+                }
+
+                if (p == end)
+                    return false;
+
+                int exponent = 0;
+                for (; p != end; ++p)
+                {
+                    if (*p < L'0' || *p > L'9' || exponent > 9999)
+                        return false;
+                    exponent = exponent * 10 + (*p - L'0');
+                }
+
+                out.exponent += negative_exponent ? -exponent : exponent;
+            }
+
+            return p == end;
+        }
+
+        /// Parse a BSTR using the number settings of the thread's locale.
+        inline bool parse_number(BSTR text, parsed_number& out)
+        {
+            UINT length = ::SysStringLen(text);
+            if (length == 0)
+                return false;
+
+            const number_format* format =
+                cached_number_format(::GetThreadLocale());
+            if (format == NULL || !format->supported)
+                return false;
+
+            return parse_number(text, length, *format, out);
+        }
+
+        /**
+         * Exact conversion to double.  Mantissas up to 2^53 and powers of
+         * ten up to 10^22 are both exact doubles, so one multiplication or
+         * division gives the correctly rounded result.
+         */
+        inline bool real_from_parsed(const parsed_number& number, double& out)
+        {
+            static const double powers_of_ten[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                1e21, 1e22 };
+
+            if (number.mantissa > (ULONGLONG(1) << 53) ||
+                number.exponent < -22 || number.exponent > 22)
+                return false;
+
+            double value = static_cast<double>(number.mantissa);
+            if (number.exponent < 0)
+                value /= powers_of_ten[-number.exponent];
+            else
+                value *= powers_of_ten[number.exponent];
+
+            out = (number.negative && value != 0.0) ? -value : value;
+            return true;
+        }
+
+        /// Integer targets only take strings without a fraction or exponent.
+        template<typename T>
+        inline bool numeric_from_string(BSTR text, T& out)
+        {
+            parsed_number number;
+            if (!parse_number(text, number) || !number.integral)
+                return false;
+
+            if (!number.negative)
+                return numeric_from_unsigned(number.mantissa, out);
+
+            const ULONGLONG most_negative = ULONGLONG(1) << 63;
+            if (number.mantissa > most_negative)
+                return false;
+            else if (number.mantissa == most_negative)
+                return numeric_from_signed(
+                    (std::numeric_limits<LONGLONG>::min)(), out);
+            else
+                return numeric_from_signed(
+                    -static_cast<LONGLONG>(number.mantissa), out);
+        }
+
+        inline bool numeric_from_string(BSTR text, double& out)
+        {
+            parsed_number number;
+            return parse_number(text, number) &&
+                real_from_parsed(number, out);
+        }
+
+        inline bool numeric_from_string(BSTR text, float& out)
+        {
+            parsed_number number;
+            double value;
+            return parse_number(text, number) &&
+                real_from_parsed(number, value) &&
+                numeric_from_real(value, out);
+        }
+
+        /// Strings such as "True" are localised so leave them to OLE.
+        inline bool numeric_from_string(BSTR, bool&)
+        {
+            return false;
+        }
+
+        /// Currency is exact to four decimal places; more are left to OLE to
+        /// round.
+        inline bool currency_from_string(BSTR text, CY& out)
+        {
+            parsed_number number;
+            if (!parse_number(text, number))
+                return false;
+
+            int scale = number.exponent + 4;
+            if (scale < 0 || scale > 18)
+                return false;
+
+            ULONGLONG value = number.mantissa;
+            for (; scale > 0; --scale)
+            {
+                if (value > (std::numeric_limits<ULONGLONG>::max)() / 10)
+                    return false;
+                value *= 10;
+            }
+
+            const ULONGLONG most_negative = ULONGLONG(1) << 63;
+            if (number.negative)
+            {
+                if (value > most_negative)
+                    return false;
+                out.int64 = (value == most_negative) ?
+                    (std::numeric_limits<LONGLONG>::min)() :
+                    -static_cast<LONGLONG>(value);
+            }
+            else
+            {
+                if (value >= most_negative)
+                    return false;
+                out.int64 = static_cast<LONGLONG>(value);
+            }
+
+            return true;
+        }
+
+        inline bool parse_fixed_digits(
+            const wchar_t*& p, const wchar_t* end, int count, int& out)
+        {
+            out = 0;
+            for (int i = 0; i < count; ++i, ++p)
+            {
+                if (p == end || *p < L'0' || *p > L'9')
+                    return false;
+                out = out * 10 + (*p - L'0');
+            }
+            return true;
+        }
+
+        /**
+         * Dates in ISO 8601 form, "YYYY-MM-DD" optionally followed by
+         * " hh:mm" or " hh:mm:ss", mean the same in every locale.  Other
+         * forms are left to OLE.
+         */
+        inline bool date_from_string(BSTR text, DATE& out)
+        {
+            const wchar_t* p = text;
+            const wchar_t* end = text + ::SysStringLen(text);
+
+            int year, month, day;
+            if (!parse_fixed_digits(p, end, 4, year) ||
+                p == end || *p++ != L'-' ||
+                !parse_fixed_digits(p, end, 2, month) ||
+                p == end || *p++ != L'-' ||
+                !parse_fixed_digits(p, end, 2, day))
+                return false;
+
+            int hour = 0, minute = 0, second = 0;
+            bool has_time = (p != end);
+            if (has_time)
+            {
+                if (*p++ != L' ' ||
+                    !parse_fixed_digits(p, end, 2, hour) ||
+                    p == end || *p++ != L':' ||
+                    !parse_fixed_digits(p, end, 2, minute))
+                    return false;
+
+                if (p != end &&
+                    (*p++ != L':' || !parse_fixed_digits(p, end, 2, second)))
+                    return false;
+
+                if (p != end || hour > 23 || minute > 59 || second > 59)
+                    return false;
+            }
+
+            static const int days_in_month[] = {
+                31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+            if (year < 100 || month < 1 || month > 12 || day < 1)
+                return false;
+
+            bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+            int month_length =
+                days_in_month[month - 1] + ((month == 2 && leap) ? 1 : 0);
+            if (day > month_length)
+                return false;
+
+            datetime_t date(
+                year, month, day, has_time ? hour : -1, minute, second);
+            if (!date.valid())
+                return false;
+
+            out = date.get();
+            return true;
+        }
+
+        //@}
+
+        /**
+         * Convert a numeric, boolean or string VARIANT to `T` without calling
+         * VariantChangeTypeEx.
+         *
+         * \return false if the conversion must be left to
+         *         VariantChangeTypeEx.
+         */
+        template<typename T>
+        inline bool fast_change_type(const VARIANT& v, T& out)
+        {
+            switch (V_VT(&v))
+            {
+            case VT_EMPTY:
+                return numeric_from_signed(0, out);
+            case VT_I1:
+                return numeric_from_signed(V_I1(&v), out);
+            case VT_I2:
+                return numeric_from_signed(V_I2(&v), out);
+            case VT_I4:
+                return numeric_from_signed(V_I4(&v), out);
+            case VT_INT:
+                return numeric_from_signed(V_INT(&v), out);
+            case VT_I8:
+                return numeric_from_signed(V_I8(&v), out);
+            case VT_UI1:
+                return numeric_from_unsigned(V_UI1(&v), out);
+            case VT_UI2:
+                return numeric_from_unsigned(V_UI2(&v), out);
+            case VT_UI4:
+                return numeric_from_unsigned(V_UI4(&v), out);
+            case VT_UINT:
+                return numeric_from_unsigned(V_UINT(&v), out);
+            case VT_UI8:
+                return numeric_from_unsigned(V_UI8(&v), out);
+            case VT_R4:
+                return numeric_from_real(V_R4(&v), out);
+            case VT_R8:
+                return numeric_from_real(V_R8(&v), out);
+            case VT_BOOL:
+                return numeric_from_bool(V_BOOL(&v), out);
+            case VT_BSTR:
+                return numeric_from_string(V_BSTR(&v), out);
+            default:
+                return false;
+            }
+        }
+
+        inline bool fast_change_type(const VARIANT&, DECIMAL&)
+        {
+            return false;
+        }
+
+        //@}
+
+        /**
+         * Whether a VARIANT of this type owns nothing outside itself, so that
+         * copying it is a memcpy and clearing it just resets the type.
+         * Strings, interfaces, arrays, records and references are left to
+         * VariantCopy and VariantClear.
+         */
+        inline bool is_plain_data(VARTYPE vt) throw()
+        {
+            switch (vt)
+            {
+            case VT_EMPTY:
+            case VT_NULL:
+            case VT_I1:
+            case VT_I2:
+            case VT_I4:
+            case VT_I8:
+            case VT_INT:
+            case VT_UI1:
+            case VT_UI2:
+            case VT_UI4:
+            case VT_UI8:
+            case VT_UINT:
+            case VT_R4:
+            case VT_R8:
+            case VT_CY:
+            case VT_DATE:
+            case VT_BOOL:
+            case VT_ERROR:
+            case VT_DECIMAL:
+                return true;
+            default:
+                return false;
+            }
+        }
+
     };
 
     template<typename Itf> class com_ptr;
@@ -148,6 +787,13 @@ namespace comet {
 
         void create(const VARIANT& v) throw(com_error)
         {
+            if (impl::is_plain_data(V_VT(&v)))
+            {
+                // DECIMAL overlaps the whole VARIANT so copy all of it
+                memcpy(this, &v, sizeof(VARIANT));
+                return;
+            }
+
             HRESULT hr = ::VariantCopy(this, const_cast<VARIANT*>(&v));
             if (FAILED(hr)) {
                 ::VariantClear(this);
@@ -295,6 +941,12 @@ namespace comet {
     private:
         void clear() COMET_THROWS_ASSERT
         {
+            if (impl::is_plain_data(V_VT(this)))
+            {
+                V_VT(this) = VT_EMPTY;
+                return;
+            }
+
             HRESULT hr = ::VariantClear(this);
             COMET_ASSERT(SUCCEEDED(hr));
             /* Avoid C4189 */ hr;
@@ -348,6 +1000,8 @@ namespace comet {
         operator bool() const throw()
         {
             if (V_VT(this) == VT_BOOL) return (V_BOOL(this) != COMET_VARIANT_FALSE);
+            bool fast_result;
+            if (impl::fast_change_type(get(), fast_result)) return fast_result;
             variant_t v(*this, VT_BOOL);
             return (V_BOOL(&v) != COMET_VARIANT_FALSE);
         }
@@ -569,6 +1223,10 @@ namespace comet {
         currency_t as_curency() const
         {
             if (V_VT(this) == VT_CY) return V_CY(this);
+            CY fast_result;
+            if (V_VT(this) == VT_BSTR &&
+                impl::currency_from_string(V_BSTR(this), fast_result))
+                return fast_result;
             variant_t v(*this, VT_CY);
             return V_CY(v.get_var());
         }
@@ -595,6 +1253,10 @@ namespace comet {
         operator datetime_t() const
         {
             if (V_VT(this) == VT_DATE) return datetime_t(V_DATE(this));
+            DATE fast_result;
+            if (V_VT(this) == VT_BSTR &&
+                impl::date_from_string(V_BSTR(this), fast_result))
+                return datetime_t(fast_result);
             variant_t v(*this, VT_DATE);
             return datetime_t(V_DATE(v.get_var()));
         }
@@ -0,0 +1,238 @@
+/** \file
+  * Bulk conversion of variant arrays into typed columns.
+  *
+  * See \ref cometvariantcolumn.
+  */
+/*
+ * This material is provided "as is", with absolutely no warranty
+ * expressed or implied. Any use is at your own risk. Permission to
+ * use or copy this software for any purpose is hereby granted without
+ * fee, provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ *
+ * This header is part of Comet version 2.
+ * https://github.com/alamaison/comet
+ */
+
+#ifndef COMET_VARIANT_COLUMN_H
+#define COMET_VARIANT_COLUMN_H
+
+#include <comet/config.h>
+
+#include <comet/bstr.h> // bstr_t
+#include <comet/safearray.h> // safearray_t
+#include <comet/variant.h> // variant_t, impl::fast_change_type
+
+#include <vector>
+
+/** \page cometvariantcolumn Variant columns
+    convert_column() turns a safearray_t<variant_t> of cells into a
+    std::vector of a single type in one pass.  It is intended for large
+    batches, such as rows of a spreadsheet range, where converting each
+    cell with variant_t::as_double() and friends would spend most of its
+    time on per-call overhead and exceptions.
+
+    Cells that cannot be converted do not throw.  Instead their bit is set
+    in a failure bitmap and the column holds a default value in that
+    position:
+
+    \code
+        safearray_t<variant_t> cells = ...;
+        std::vector<double> values;
+        std::vector<bool> failed;
+        if (convert_column(cells, values, failed) != 0)
+        {
+            // Some cells were not numbers; check failed[i]
+        }
+    \endcode
+
+    The numeric column types are double, float, LONGLONG, long, int and
+    short; bstr_t columns are also supported.  When every cell already has
+    the column's own VARTYPE the values are copied out in a plain loop with
+    no per-cell type dispatch.
+*/
+
+namespace comet {
+
+    namespace impl {
+
+        /// VARTYPE whose payload is exactly the column type, if any.
+        template<typename T> struct column_type
+        {
+            enum { vt = VT_EMPTY };
+        };
+
+        template<> struct column_type<double>
+        {
+            enum { vt = VT_R8 };
+            static double payload(const VARIANT& v) { return V_R8(&v); }
+        };
+
+        template<> struct column_type<float>
+        {
+            enum { vt = VT_R4 };
+            static float payload(const VARIANT& v) { return V_R4(&v); }
+        };
+
+        template<> struct column_type<LONGLONG>
+        {
+            enum { vt = VT_I8 };
+            static LONGLONG payload(const VARIANT& v) { return V_I8(&v); }
+        };
+
+        template<> struct column_type<long>
+        {
+            enum { vt = VT_I4 };
+            static long payload(const VARIANT& v) { return V_I4(&v); }
+        };
+
+        // VariantChangeTypeEx doesn't support VT_INT so int, like long, is
+        // held as VT_I4.
+        template<> struct column_type<int>
+        {
+            enum { vt = VT_I4 };
+            static int payload(const VARIANT& v) { return V_I4(&v); }
+        };
+
+        template<> struct column_type<short>
+        {
+            enum { vt = VT_I2 };
+            static short payload(const VARIANT& v) { return V_I2(&v); }
+        };
+
+        /// VARTYPE shared by all the cells or VT_EMPTY if they differ.
+        inline VARTYPE uniform_vt(const VARIANT* cells, size_t count)
+        {
+            if (count == 0)
+                return VT_EMPTY;
+
+            VARTYPE vt = V_VT(&cells[0]);
+            for (size_t i = 1; i < count; ++i)
+            {
+                if (V_VT(&cells[i]) != vt)
+                    return VT_EMPTY;
+            }
+            return vt;
+        }
+
+        /// Contiguous cells of a variant array.
+        inline const VARIANT* column_cells(const safearray_t<variant_t>& cells)
+        {
+            return cells.is_empty() ?
+                NULL : &cells[cells.lower_bound()].get();
+        }
+
+        /// Fallback for cells the inline conversions don't handle.
+        template<typename T>
+        inline bool ole_change_type(const VARIANT& cell, T& out)
+        {
+            VARIANT converted;
+            ::VariantInit(&converted);
+            if (FAILED(::VariantChangeTypeEx(
+                &converted, const_cast<VARIANT*>(&cell), ::GetThreadLocale(),
+                0, static_cast<VARTYPE>(column_type<T>::vt))))
+                return false;
+
+            out = column_type<T>::payload(converted);
+            return true;
+        }
+
+        template<typename T>
+        inline bool convert_cell(const VARIANT& cell, T& out)
+        {
+            return fast_change_type(cell, out) || ole_change_type(cell, out);
+        }
+
+        inline bool convert_cell(const VARIANT& cell, bstr_t& out)
+        {
+            if (V_VT(&cell) == VT_BSTR)
+            {
+                out = bstr_t(V_BSTR(&cell), ::SysStringLen(V_BSTR(&cell)));
+                return true;
+            }
+
+            VARIANT converted;
+            ::VariantInit(&converted);
+            if (FAILED(::VariantChangeTypeEx(
+                &converted, const_cast<VARIANT*>(&cell), ::GetThreadLocale(),
+                0, VT_BSTR)))
+                return false;
+
+            out = auto_attach(V_BSTR(&converted));
+            return true;
+        }
+
+        template<typename T>
+        inline size_t convert_mixed_cells(
+            const VARIANT* cells, size_t count, std::vector<T>& column,
+            std::vector<bool>& failed)
+        {
+            size_t failures = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!convert_cell(cells[i], column[i]))
+                {
+                    column[i] = T();
+                    failed[i] = true;
+                    ++failures;
+                }
+            }
+            return failures;
+        }
+
+        template<typename T>
+        inline size_t convert_cells(
+            const VARIANT* cells, size_t count, std::vector<T>& column,
+            std::vector<bool>& failed)
+        {
+            if (uniform_vt(cells, count) == column_type<T>::vt)
+            {
+                // Every cell already holds a T: nothing can fail
+                for (size_t i = 0; i < count; ++i)
+                    column[i] = column_type<T>::payload(cells[i]);
+                return 0;
+            }
+
+            return convert_mixed_cells(cells, count, column, failed);
+        }
+
+        inline size_t convert_cells(
+            const VARIANT* cells, size_t count, std::vector<bstr_t>& column,
+            std::vector<bool>& failed)
+        {
+            return convert_mixed_cells(cells, count, column, failed);
+        }
+    }
+
+    /*! \addtogroup COMType
+     */
+    //@{
+
+    /**
+     * Convert every cell of a variant array to T.
+     *
+     * On return, `column` and `failed` have one entry per cell in array
+     * order.  A cell that cannot be converted to T has its `failed` bit set
+     * and a default-constructed value in `column`.
+     *
+     * \returns Number of cells that failed to convert.
+     */
+    template<typename T>
+    inline size_t convert_column(
+        const safearray_t<variant_t>& cells, std::vector<T>& column,
+        std::vector<bool>& failed)
+    {
+        size_t count = cells.size();
+        column.resize(count);
+        failed.assign(count, false);
+
+        return impl::convert_cells(
+            impl::column_cells(cells), count, column, failed);
+    }
+
+    //@}
+}
+
+#endif
@@ -21,6 +21,7 @@
 
 #include <comet/config.h>
 
+#include <comet/enum_prefetch.h>
 #include <comet/ptr.h>
 #include <comet/variant.h>
 
@@ -28,17 +29,53 @@
 
 namespace comet {
 
+    namespace impl {
+
+        struct prefetched_variant_policy
+        {
+            static void clear(VARIANT& v) { ::VariantClear(&v); }
+        };
+
+        typedef enum_prefetch<
+            IEnumVARIANT, VARIANT, prefetched_variant_policy>
+            variant_prefetch;
+
+        /// Next VARIANT from the buffer or false at the end.
+        inline bool next_variant(variant_prefetch& source, variant_t& out)
+        {
+            if (source.is_null())
+                return false;
+
+            VARIANT v;
+            if (!source.next(v))
+            {
+                source.reset();
+                return false;
+            }
+
+            variant_t t(auto_attach(v));
+            out.swap(t);
+            return true;
+        }
+    }
+
     /** \class variant_iterator enum.h comet/enum.h
       * STL style iterator for IEnumVariant interface.
+      *
+      * Elements are fetched one at a time, or in batches of the size given
+      * to the constructor or of COMET_ENUM_PREFETCH_SIZE if that is
+      * defined.
       */
     class variant_iterator
     {
-        com_ptr<IEnumVARIANT> enum_;
+        impl::variant_prefetch enum_;
         variant_t ce_;
     public:
         /** Constructor.
           */
-        variant_iterator( const com_ptr<IEnumVARIANT>& e ) : enum_(e) {
+        variant_iterator( const com_ptr<IEnumVARIANT>& e,
+                          size_t batch_size=COMET_ENUM_PREFETCH_SIZE )
+            : enum_(e, batch_size) {
             next();
         }
 
@@ -74,26 +111,28 @@ namespace comet {
         }
     private:
         void next() {
-            if (enum_) {
-                unsigned long x = 0;
-                enum_->Next(1, ce_.out(), &x) | raise_exception;
-                if (x == 0) enum_ = 0;
-            }
+            // Don't hold on to the last element past the end
+            if (!impl::next_variant(enum_, ce_))
+                ce_ = variant_t();
         }
     };
 
     /** \class itf_iterator enum.h comet/enum.h
       * STL style Iterator for IEnumVARIANT interface returning a contained
       * interface pointer.
+      *
+      * Elements are fetched in batches like variant_iterator.
       */
     template<typename Itf> class itf_iterator
     {
-        com_ptr<IEnumVARIANT> enum_;
+        impl::variant_prefetch enum_;
         com_ptr<Itf> p_;
     public:
         /** Constructor.
           */
-        itf_iterator( const com_ptr<IEnumVARIANT>& e ) : enum_(e) {
+        itf_iterator( const com_ptr<IEnumVARIANT>& e,
+                      size_t batch_size=COMET_ENUM_PREFETCH_SIZE )
+            : enum_(e, batch_size) {
             next();
         }
 
@@ -107,11 +146,11 @@ namespace comet {
         }
 
         bool operator!=(const itf_iterator& v) {
-            if (v.enum_)
+            if (!v.enum_.is_null())
                 throw std::logic_error(
                     "itf_iterator comparison does not work");
 
-            return enum_ != 0;
+            return !enum_.is_null();
         }
 
         /** Move to next element.
@@ -129,18 +168,14 @@ namespace comet {
         }
     private:
         void next() {
-            if (enum_) {
-                unsigned long x = 0;
-                variant_t v;
-                enum_->Next(1, v.out(), &x) | raise_exception;
-                if (x == 0) {
-                    enum_ = 0;
-                    p_ = 0;
-                }
-                else {
-                    p_ = try_cast(v);
-                }
-            }
+            if (enum_.is_null())
+                return;
+
+            variant_t v;
+            if (impl::next_variant(enum_, v))
+                p_ = try_cast(v);
+            else
+                p_ = 0;
         }
     };
 
@@ -0,0 +1,202 @@
+#include <boost/test/unit_test.hpp>
+
+#include <comet/async_calllog.h> // test subject
+
+#include <comet/thread_pool.h> // thread_pool, future
+#include <comet/tstring.h>
+
+#include <algorithm> // count
+#include <string>
+#include <vector>
+
+using comet::async_call_logger_t;
+using comet::future;
+using comet::source_info_t;
+using comet::tistringstream;
+using comet::thread_pool;
+using comet::tostream;
+using comet::tostringstream;
+using comet::tstring;
+
+using std::vector;
+
+namespace {
+
+    /// Log stream the tests can read back.
+    struct test_log_stream
+    {
+        static tostream* create()
+        {
+            stream = new tostringstream();
+            return stream;
+        }
+
+        static tostringstream* stream;
+    };
+
+    tostringstream* test_log_stream::stream = NULL;
+
+    typedef async_call_logger_t<test_log_stream> logger;
+
+    /// Logged lines mentioning `method`, without the time and thread.
+    vector<tstring> lines_for(const tstring& method)
+    {
+        logger::flush();
+
+        vector<tstring> lines;
+        tstring log = test_log_stream::stream->str();
+        tstring::size_type start = 0;
+        for (;;)
+        {
+            tstring::size_type end = log.find(_T('\n'), start);
+            if (end == tstring::npos)
+                break;
+
+            tstring line = log.substr(start, end - start);
+            if (line.find(method) != tstring::npos)
+                lines.push_back(line.substr(line.find(_T("] ")) + 2));
+            start = end + 1;
+        }
+        return lines;
+    }
+
+    /// Logs a call and its return `count` times.
+    struct log_calls
+    {
+        log_calls(const tstring& method, int count)
+            : method(method), count(count) {}
+
+        void operator()() const
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                logger::log_call(_T("IFoo"), method, _T("1"));
+                logger::log_return(_T("IFoo"), method, _T(""), _T("2"));
+            }
+        }
+
+        tstring method;
+        int count;
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( async_calllog_tests )
+
+BOOST_AUTO_TEST_CASE( call_and_return )
+{
+    BOOST_REQUIRE(logger::can_log_call());
+
+    logger::log_call(_T("IFoo"), _T("Simple"), _T("42, 'bob'"));
+    logger::log_return(_T("IFoo"), _T("Simple"), _T(""), _T("'x'"));
+
+    vector<tstring> lines = lines_for(_T("::Simple"));
+    BOOST_REQUIRE_EQUAL(lines.size(), 2U);
+    BOOST_CHECK(lines[0] == _T("In  IFoo::Simple(42, 'bob')"));
+    BOOST_CHECK(lines[1] == _T("Out IFoo::Simple returned 'x'"));
+}
+
+BOOST_AUTO_TEST_CASE( exception_logged )
+{
+    logger::log_exception(
+        _T("com_error"), _T("Oops"), source_info_t(),
+        source_info_t(L"Thrower", comet::uuid_t(), L"Foo"));
+
+    vector<tstring> lines = lines_for(_T("Foo.Thrower"));
+    BOOST_REQUIRE_EQUAL(lines.size(), 1U);
+    BOOST_CHECK(lines[0] == _T("Err Foo.Thrower com_error: Oops"));
+}
+
+/**
+ * Arguments too long for a record are cut short, and say so.
+ */
+BOOST_AUTO_TEST_CASE( long_arguments_truncated )
+{
+    tstring arguments(2 * COMET_CALLLOG_RECORD_CHARS, _T('a'));
+    logger::log_call(_T("IFoo"), _T("Long"), arguments);
+
+    vector<tstring> lines = lines_for(_T("::Long"));
+    BOOST_REQUIRE_EQUAL(lines.size(), 1U);
+
+    tstring expected = _T("In  IFoo::Long(");
+    expected += arguments.substr(
+        0, COMET_CALLLOG_RECORD_CHARS - 4 - 4) + _T("...)");
+    BOOST_CHECK(lines[0] == expected);
+}
+
+/**
+ * Calls from several threads all arrive, and each thread's calls stay in
+ * order.
+ */
+BOOST_AUTO_TEST_CASE( many_threads )
+{
+    // Few enough per thread never to fill a ring
+    const int calls = COMET_CALLLOG_RING_SIZE / 8;
+
+    thread_pool pool(4);
+    vector< future<void> > done;
+    for (int i = 0; i < 4; ++i)
+        done.push_back(pool.submit<void>(log_calls(_T("Threaded"), calls)));
+    for (size_t i = 0; i < done.size(); ++i)
+        done[i].get();
+
+    vector<tstring> lines = lines_for(_T("::Threaded"));
+    BOOST_REQUIRE_EQUAL(lines.size(), 4U * 2 * calls);
+    BOOST_CHECK_EQUAL(
+        std::count(lines.begin(), lines.end(), _T("In  IFoo::Threaded(1)")),
+        4 * calls);
+
+    // Every In comes before its Out
+    tstring log = test_log_stream::stream->str();
+    BOOST_CHECK_LT(
+        log.find(_T("In  IFoo::Threaded")),
+        log.find(_T("Out IFoo::Threaded")));
+}
+
+/**
+ * Calls logged after the background thread has exited for want of work
+ * start another, and are written.
+ */
+BOOST_AUTO_TEST_CASE( logged_after_writer_idle )
+{
+    log_calls(_T("BeforeIdle"), 1)();
+    BOOST_CHECK_EQUAL(lines_for(_T("::BeforeIdle")).size(), 2U);
+
+    ::Sleep(COMET_CALLLOG_WRITER_IDLE + 4 * COMET_CALLLOG_INTERVAL);
+
+    log_calls(_T("AfterIdle"), 1)();
+    BOOST_CHECK(logger::can_log_call());
+    vector<tstring> lines = lines_for(_T("::AfterIdle"));
+    BOOST_REQUIRE_EQUAL(lines.size(), 2U);
+    BOOST_CHECK(lines[0] == _T("In  IFoo::AfterIdle(1)"));
+    BOOST_CHECK(lines[1] == _T("Out IFoo::AfterIdle returned 2"));
+}
+
+/**
+ * A thread logging more than its ring holds before the writer empties it
+ * loses calls rather than waiting, and the log says how many.
+ */
+BOOST_AUTO_TEST_CASE( full_ring_drops )
+{
+    const int calls = 4 * COMET_CALLLOG_RING_SIZE;
+    log_calls(_T("Flood"), calls)();
+
+    vector<tstring> lines = lines_for(_T("::Flood"));
+
+    // No other test logs enough to drop anything
+    long dropped = 0;
+    tistringstream log(test_log_stream::stream->str());
+    tstring word;
+    while (log >> word)
+    {
+        if (word == _T("Dropped"))
+        {
+            long count;
+            log >> count;
+            dropped += count;
+        }
+    }
+
+    BOOST_CHECK_EQUAL(static_cast<long>(lines.size()) + dropped, 2L * calls);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,272 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/async_cp.h> // test subject
+
+#include <comet/ptr.h>
+#include <comet/server.h> // simple_object
+#include <comet/thread_pool.h> // thread_pool, future
+#include <comet/threading.h> // event
+
+#include <utility> // pair
+#include <vector>
+
+using comet::async_event_firer;
+using comet::com_ptr;
+using comet::event;
+using comet::event_overflow_block;
+using comet::event_overflow_coalesce;
+using comet::event_overflow_drop;
+using comet::event_sink_metrics;
+using comet::future;
+using comet::nil;
+using comet::simple_object;
+using comet::thread_pool;
+
+using std::make_pair;
+using std::vector;
+
+namespace {
+
+    class test_sink : public simple_object<nil> {};
+
+    /// Stands in for a connection point.
+    struct test_source
+    {
+        typedef vector< std::pair<DWORD, com_ptr<IUnknown> > > sinks_snapshot;
+
+        explicit test_source(size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                sinks_.push_back(make_pair(
+                    DWORD(i + 1), com_ptr<IUnknown>(new test_sink())));
+        }
+
+        sinks_snapshot sinks() const { return sinks_; }
+
+        sinks_snapshot sinks_;
+    };
+
+    /// Records the last value delivered, optionally waiting for a gate.
+    struct record_value
+    {
+        record_value(long value, volatile long* last, event* gate=0)
+            : value(value), last(last), gate(gate) {}
+
+        HRESULT operator()(IUnknown*) const
+        {
+            if (gate)
+                gate->wait(5000);
+            ::InterlockedExchange(last, value);
+            return S_OK;
+        }
+
+        long value;
+        volatile long* last;
+        event* gate;
+    };
+
+    /// Fires one event, from whichever thread runs it.
+    template<typename Firer>
+    struct fire_value
+    {
+        fire_value(Firer& firer, long value, volatile long* last)
+            : firer(&firer), value(value), last(last) {}
+
+        void operator()() const
+        {
+            firer->fire(record_value(value, last));
+        }
+
+        Firer* firer;
+        long value;
+        volatile long* last;
+    };
+
+    ULONGLONG total_delivered(const vector<event_sink_metrics>& metrics)
+    {
+        ULONGLONG total = 0;
+        for (size_t i = 0; i < metrics.size(); ++i)
+            total += metrics[i].delivered;
+        return total;
+    }
+
+    template<typename Firer>
+    void wait_for_delivered(const Firer& firer, ULONGLONG count)
+    {
+        for (int i = 0; i < 500; ++i)
+        {
+            if (total_delivered(firer.metrics()) >= count)
+                return;
+            ::Sleep(10);
+        }
+        BOOST_FAIL("events not delivered in time");
+    }
+
+    template<typename Firer>
+    void wait_for_empty_queue(const Firer& firer)
+    {
+        for (int i = 0; i < 500; ++i)
+        {
+            if (firer.metrics().at(0).queue_depth == 0)
+                return;
+            ::Sleep(10);
+        }
+        BOOST_FAIL("queue not emptied in time");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE( async_cp_tests )
+
+BOOST_AUTO_TEST_CASE( delivers_to_every_sink_in_order )
+{
+    test_source source(3);
+    volatile long last = 0;
+    {
+        async_event_firer<IUnknown, test_source> firer(source, 2);
+        for (long i = 1; i <= 10; ++i)
+            firer.fire(record_value(i, &last));
+
+        wait_for_delivered(firer, 30);
+
+        vector<event_sink_metrics> metrics = firer.metrics();
+        BOOST_REQUIRE_EQUAL(metrics.size(), 3U);
+        for (size_t i = 0; i < metrics.size(); ++i)
+        {
+            BOOST_CHECK_EQUAL(metrics[i].delivered, 10U);
+            BOOST_CHECK_EQUAL(metrics[i].dropped, 0U);
+        }
+    }
+    BOOST_CHECK_EQUAL(last, 10);
+}
+
+BOOST_AUTO_TEST_CASE( drop_when_full )
+{
+    test_source source(1);
+    volatile long last = 0;
+    event gate;
+
+    async_event_firer<IUnknown, test_source> firer(
+        source, 1, 1, event_overflow_drop);
+
+    // First event occupies the worker; second fills the queue
+    firer.fire(record_value(1, &last, &gate));
+    wait_for_empty_queue(firer);
+    firer.fire(record_value(2, &last));
+    firer.fire(record_value(3, &last));
+
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).dropped, 1U);
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).max_queue_depth, 1U);
+
+    gate.set();
+    wait_for_delivered(firer, 2);
+    BOOST_CHECK_EQUAL(last, 2);
+}
+
+BOOST_AUTO_TEST_CASE( coalesce_when_full )
+{
+    test_source source(1);
+    volatile long last = 0;
+    event gate;
+
+    async_event_firer<IUnknown, test_source> firer(
+        source, 1, 1, event_overflow_coalesce);
+
+    firer.fire(record_value(1, &last, &gate));
+    wait_for_empty_queue(firer);
+    firer.fire(record_value(2, &last), 7);
+    firer.fire(record_value(3, &last), 7);
+
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).coalesced, 1U);
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).dropped, 0U);
+
+    gate.set();
+    wait_for_delivered(firer, 2);
+    BOOST_CHECK_EQUAL(last, 3);
+}
+
+/**
+ * A producer firing into a full queue waits, and carries on once the
+ * worker takes an event off the queue.
+ */
+BOOST_AUTO_TEST_CASE( block_when_full )
+{
+    typedef async_event_firer<IUnknown, test_source> firer_type;
+
+    test_source source(1);
+    volatile long last = 0;
+    event gate;
+
+    firer_type firer(source, 1, 1, event_overflow_block);
+
+    // First event occupies the worker; second fills the queue
+    firer.fire(record_value(1, &last, &gate));
+    wait_for_empty_queue(firer);
+    firer.fire(record_value(2, &last));
+
+    thread_pool producer(1);
+    future<void> fired =
+        producer.submit<void>(fire_value<firer_type>(firer, 3, &last));
+    BOOST_CHECK(!fired.wait(300));
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).queue_depth, 1U);
+
+    gate.set();
+    BOOST_REQUIRE(fired.wait(5000));
+    fired.get();
+
+    wait_for_delivered(firer, 3);
+    BOOST_CHECK_EQUAL(last, 3);
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).dropped, 0U);
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).max_queue_depth, 1U);
+}
+
+/**
+ * The event that replaces a queued one goes behind events fired before it.
+ */
+BOOST_AUTO_TEST_CASE( coalesced_event_moves_to_back )
+{
+    test_source source(1);
+    volatile long last = 0;
+    event gate;
+
+    async_event_firer<IUnknown, test_source> firer(
+        source, 1, 2, event_overflow_coalesce);
+
+    firer.fire(record_value(1, &last, &gate));
+    wait_for_empty_queue(firer);
+    firer.fire(record_value(2, &last), 7);
+    firer.fire(record_value(3, &last));
+    firer.fire(record_value(4, &last), 7);
+
+    BOOST_CHECK_EQUAL(firer.metrics().at(0).coalesced, 1U);
+
+    gate.set();
+    wait_for_delivered(firer, 3);
+    BOOST_CHECK_EQUAL(last, 4);
+}
+
+BOOST_AUTO_TEST_CASE( coalesce_within_window )
+{
+    test_source source(2);
+    volatile long last = 0;
+
+    async_event_firer<IUnknown, test_source> firer(source, 2);
+    firer.coalesce_within(200);
+
+    for (long i = 1; i <= 5; ++i)
+        firer.fire(record_value(i, &last), 9);
+
+    wait_for_delivered(firer, 2);
+    ::Sleep(300); // nothing more should arrive
+
+    vector<event_sink_metrics> metrics = firer.metrics();
+    BOOST_REQUIRE_EQUAL(metrics.size(), 2U);
+    for (size_t i = 0; i < metrics.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(metrics[i].delivered, 1U);
+        BOOST_CHECK_EQUAL(metrics[i].coalesced, 4U);
+    }
+    BOOST_CHECK_EQUAL(last, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,275 @@
+#include <boost/test/unit_test.hpp>
+
+#include <comet/call_metrics.h> // test subject
+
+#include <comet/thread_pool.h> // thread_pool, future
+#include <comet/threading.h> // thread
+#include <comet/tstring.h>
+
+#include <vector>
+
+using comet::future;
+using comet::impl::latency_buckets;
+using comet::metrics_call_logger;
+using comet::source_info_t;
+using comet::thread_pool;
+using comet::tostringstream;
+using comet::tstring;
+
+using std::vector;
+
+namespace {
+
+    typedef metrics_call_logger logger;
+
+    void call(const tstring& method)
+    {
+        logger::log_call(_T("IFoo"), method, _T(""));
+        logger::log_return(_T("IFoo"), method, _T(""), _T(""));
+    }
+
+    void failed_call(const tstring& method)
+    {
+        logger::log_call(_T("IFoo"), method, _T(""));
+        logger::log_exception(
+            _T("com_error"), _T("Oops"), source_info_t(),
+            source_info_t(method.c_str()));
+    }
+
+    tstring prometheus()
+    {
+        tostringstream out;
+        logger::write_prometheus(out);
+        return out.str();
+    }
+
+    tstring json()
+    {
+        tostringstream out;
+        logger::write_json(out);
+        return out.str();
+    }
+
+    bool contains(const tstring& text, const tstring& part)
+    {
+        return text.find(part) != tstring::npos;
+    }
+
+    /// Makes `count` calls to a method.
+    struct make_calls
+    {
+        make_calls(const tstring& method, int count)
+            : method(method), count(count) {}
+
+        void operator()() const
+        {
+            for (int i = 0; i < count; ++i)
+                call(method);
+        }
+
+        tstring method;
+        int count;
+    };
+
+    /// Thread that makes calls to a method and ends.
+    class calling_thread : public comet::thread
+    {
+    public:
+        calling_thread(const tstring& method, int count)
+            : calls_(method, count) {}
+
+    private:
+        DWORD thread_main()
+        {
+            calls_();
+            return 0;
+        }
+
+        make_calls calls_;
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( call_metrics_tests )
+
+/**
+ * Every value lands in a bucket that holds it, and no bucket is wider than
+ * a sixteenth of its values.
+ */
+BOOST_AUTO_TEST_CASE( bucket_bounds )
+{
+    ULONGLONG values[] = {
+        0U, 1U, 31U, 32U, 33U, 63U, 64U, 1000U, 1234567U, 1000000000U,
+        (ULONGLONG)1 << 40 };
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        size_t bucket = latency_buckets::index(values[i]);
+        BOOST_CHECK_LE(latency_buckets::lower(bucket), values[i]);
+        BOOST_CHECK_GE(latency_buckets::upper(bucket), values[i]);
+        BOOST_CHECK_LE(
+            latency_buckets::upper(bucket) - latency_buckets::lower(bucket),
+            values[i] / 16);
+    }
+
+    BOOST_CHECK_EQUAL(latency_buckets::index(31), 31U);
+    BOOST_CHECK_EQUAL(
+        latency_buckets::index((ULONGLONG)1 << 60),
+        static_cast<size_t>(latency_buckets::count - 1));
+}
+
+BOOST_AUTO_TEST_CASE( buckets_contiguous )
+{
+    for (size_t i = 1; i < latency_buckets::count; ++i)
+    {
+        BOOST_CHECK_EQUAL(
+            latency_buckets::lower(i), latency_buckets::upper(i - 1) + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( counts_calls )
+{
+    BOOST_REQUIRE(logger::can_log_call());
+
+    call(_T("Counted"));
+    call(_T("Counted"));
+    call(_T("Counted"));
+
+    tstring text = prometheus();
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_calls_total{interface=\"IFoo\",method=\"Counted\"} 3\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_errors_total{interface=\"IFoo\",method=\"Counted\"}")
+        _T(" 0\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_duration_seconds_count")
+        _T("{interface=\"IFoo\",method=\"Counted\"} 3\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_duration_seconds")
+        _T("{interface=\"IFoo\",method=\"Counted\",quantile=\"0.99\"} ")));
+}
+
+BOOST_AUTO_TEST_CASE( counts_errors )
+{
+    call(_T("Failing"));
+    failed_call(_T("Failing"));
+
+    tstring text = prometheus();
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_calls_total{interface=\"IFoo\",method=\"Failing\"} 2\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_errors_total{interface=\"IFoo\",method=\"Failing\"}")
+        _T(" 1\n")));
+}
+
+/**
+ * An exception from a method that wasn't logged, such as one of comet's
+ * own objects, doesn't end the call that is being timed.
+ */
+BOOST_AUTO_TEST_CASE( unrelated_exception_ignored )
+{
+    logger::log_call(_T("IFoo"), _T("Outer"), _T(""));
+    logger::log_exception(
+        _T("com_error"), _T("Oops"), source_info_t(),
+        source_info_t(L"Read", comet::uuid_t(), L"memory_stream"));
+    logger::log_return(_T("IFoo"), _T("Outer"), _T(""), _T(""));
+
+    tstring text = prometheus();
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_errors_total{interface=\"IFoo\",method=\"Outer\"}")
+        _T(" 0\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_duration_seconds_count")
+        _T("{interface=\"IFoo\",method=\"Outer\"} 1\n")));
+}
+
+BOOST_AUTO_TEST_CASE( nested_calls )
+{
+    logger::log_call(_T("IFoo"), _T("Parent"), _T(""));
+    call(_T("Child"));
+    call(_T("Child"));
+    logger::log_return(_T("IFoo"), _T("Parent"), _T(""), _T(""));
+
+    tstring text = prometheus();
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_duration_seconds_count")
+        _T("{interface=\"IFoo\",method=\"Parent\"} 1\n")));
+    BOOST_CHECK(contains(
+        text,
+        _T("comet_call_duration_seconds_count")
+        _T("{interface=\"IFoo\",method=\"Child\"} 2\n")));
+}
+
+BOOST_AUTO_TEST_CASE( json_export )
+{
+    call(_T("Jsoned"));
+    failed_call(_T("Jsoned"));
+
+    tstring text = json();
+    BOOST_CHECK(contains(text, _T("{\"methods\":[")));
+    BOOST_CHECK(contains(
+        text,
+        _T("{\"interface\":\"IFoo\",\"method\":\"Jsoned\",")
+        _T("\"calls\":2,\"errors\":1,\"latency_ns\":{\"count\":2,")));
+    BOOST_CHECK(contains(text, _T("\"buckets\":[[")));
+    BOOST_CHECK(text.substr(text.size() - 2) == _T("]}"));
+}
+
+BOOST_AUTO_TEST_CASE( names_escaped )
+{
+    call(_T("Quote\"Back\\slash"));
+
+    BOOST_CHECK(contains(
+        prometheus(), _T("method=\"Quote\\\"Back\\\\slash\"} 1\n")));
+    BOOST_CHECK(contains(
+        json(), _T("\"method\":\"Quote\\\"Back\\\\slash\"")));
+}
+
+/**
+ * Each thread counts separately and the export adds them up.
+ */
+BOOST_AUTO_TEST_CASE( many_threads )
+{
+    thread_pool pool(4);
+    vector< future<void> > done;
+    for (int i = 0; i < 8; ++i)
+        done.push_back(pool.submit<void>(make_calls(_T("Threaded"), 1000)));
+    for (size_t i = 0; i < done.size(); ++i)
+        done[i].get();
+
+    BOOST_CHECK(contains(
+        prometheus(),
+        _T("comet_calls_total{interface=\"IFoo\",method=\"Threaded\"}")
+        _T(" 8000\n")));
+}
+
+/**
+ * Calls made by a thread that has ended are still counted once its
+ * counters are retired.
+ */
+BOOST_AUTO_TEST_CASE( ended_thread_counted )
+{
+    calling_thread caller(_T("Ended"), 5);
+    BOOST_REQUIRE(caller.start());
+    caller.wait();
+
+    BOOST_CHECK(contains(
+        prometheus(),
+        _T("comet_calls_total{interface=\"IFoo\",method=\"Ended\"} 5\n")));
+
+    // Retired by the first export, counted again by the second
+    call(_T("Ended"));
+    BOOST_CHECK(contains(
+        prometheus(),
+        _T("comet_calls_total{interface=\"IFoo\",method=\"Ended\"} 6\n")));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
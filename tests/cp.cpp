@@ -0,0 +1,211 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/cp.h> // test subject
+
+#include <comet/cptraits.h> // cp_nothrow, cp_nothrow_remove
+#include <comet/ptr.h>
+#include <comet/server.h> // simple_object
+#include <comet/thread_pool.h> // thread_pool, future
+
+#include <vector>
+
+using comet::com_ptr;
+using comet::connection_point_impl;
+using comet::cp_nothrow;
+using comet::cp_nothrow_remove;
+using comet::future;
+using comet::nil;
+using comet::simple_object;
+using comet::thread_pool;
+
+using std::vector;
+
+namespace {
+
+    /// Sink that counts the instances alive.
+    class counted_sink : public simple_object<nil>
+    {
+    public:
+        counted_sink() { ::InterlockedIncrement(&live); }
+        ~counted_sink() { ::InterlockedDecrement(&live); }
+
+        static volatile long live;
+    };
+
+    volatile long counted_sink::live = 0;
+
+    class test_object : public simple_object<nil> {};
+
+    /// Connection point with IUnknown sinks, owned by a separate object.
+    class test_point : public connection_point_impl<IUnknown>
+    {
+    public:
+        explicit test_point(IUnknown* parent)
+            : connection_point_impl<IUnknown>(parent) {}
+
+        IConnectionPoint* cp() { return this; }
+    };
+
+    DWORD advise_new_sink(test_point& point)
+    {
+        com_ptr<IUnknown> sink = new counted_sink();
+        DWORD cookie = 0;
+        BOOST_REQUIRE_EQUAL(point.cp()->Advise(sink.in(), &cookie), S_OK);
+        return cookie;
+    }
+
+    /// Event that counts its calls and returns a fixed result.
+    struct count_calls
+    {
+        count_calls(volatile long* calls, HRESULT hr) : calls(calls), hr(hr)
+        {}
+
+        HRESULT operator()(IUnknown* sink) const
+        {
+            // Touches the sink, which must still be alive
+            sink->AddRef();
+            sink->Release();
+            ::InterlockedIncrement(calls);
+            return hr;
+        }
+
+        volatile long* calls;
+        HRESULT hr;
+    };
+
+    /// Fires at the connection point over and over.
+    struct fire_repeatedly
+    {
+        fire_repeatedly(test_point& point, volatile long* calls, int count)
+            : point(&point), calls(calls), count(count) {}
+
+        void operator()() const
+        {
+            cp_nothrow traits;
+            for (int i = 0; i < count; ++i)
+                point->fire(count_calls(calls, S_OK), traits);
+        }
+
+        test_point* point;
+        volatile long* calls;
+        int count;
+    };
+
+    /// Connects and disconnects a new sink over and over.
+    struct advise_repeatedly
+    {
+        advise_repeatedly(test_point& point, volatile long* failures, int count)
+            : point(&point), failures(failures), count(count) {}
+
+        void operator()() const
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                com_ptr<IUnknown> sink = new counted_sink();
+                DWORD cookie;
+                if (point->cp()->Advise(sink.in(), &cookie) != S_OK ||
+                    point->cp()->Unadvise(cookie) != S_OK)
+                    ::InterlockedIncrement(failures);
+            }
+        }
+
+        test_point* point;
+        volatile long* failures;
+        int count;
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( cp_tests )
+
+/**
+ * A snapshot keeps its sinks, and keeps them alive, after they are
+ * unadvised.
+ */
+BOOST_AUTO_TEST_CASE( snapshot_outlives_unadvise )
+{
+    com_ptr<IUnknown> parent = new test_object();
+    test_point point(parent.in());
+    long live = counted_sink::live;
+
+    DWORD first = advise_new_sink(point);
+    DWORD second = advise_new_sink(point);
+    BOOST_CHECK_EQUAL(counted_sink::live, live + 2);
+
+    {
+        test_point::sinks_snapshot sinks = point.sinks();
+        BOOST_REQUIRE_EQUAL(sinks.size(), 2U);
+
+        BOOST_CHECK_EQUAL(point.cp()->Unadvise(first), S_OK);
+        BOOST_CHECK_EQUAL(point.sinks().size(), 1U);
+        BOOST_CHECK_EQUAL(sinks.size(), 2U);
+        BOOST_CHECK_EQUAL(sinks.begin()->first, first);
+        BOOST_CHECK_EQUAL(counted_sink::live, live + 2);
+    }
+
+    BOOST_CHECK_EQUAL(counted_sink::live, live + 1);
+
+    BOOST_CHECK_EQUAL(point.cp()->Unadvise(second), S_OK);
+    BOOST_CHECK_EQUAL(
+        point.cp()->Unadvise(second), CONNECT_E_NOCONNECTION);
+    BOOST_CHECK(!point.is_connected());
+    BOOST_CHECK_EQUAL(counted_sink::live, live);
+}
+
+BOOST_AUTO_TEST_CASE( fire_applies_traits )
+{
+    com_ptr<IUnknown> parent = new test_object();
+    test_point point(parent.in());
+    advise_new_sink(point);
+    advise_new_sink(point);
+
+    volatile long calls = 0;
+    cp_nothrow ignore;
+    point.fire(count_calls(&calls, E_FAIL), ignore);
+    BOOST_CHECK_EQUAL(calls, 2);
+    BOOST_CHECK_EQUAL(point.sinks().size(), 2U);
+
+    cp_nothrow_remove remove;
+    point.fire(count_calls(&calls, E_FAIL), remove);
+    BOOST_CHECK_EQUAL(calls, 4);
+    BOOST_CHECK(!point.is_connected());
+}
+
+/**
+ * Firing on some threads while others advise and unadvise never calls a
+ * released sink, and leaves every connection accounted for.
+ */
+BOOST_AUTO_TEST_CASE( concurrent_advise_unadvise_fire )
+{
+    com_ptr<IUnknown> parent = new test_object();
+    test_point point(parent.in());
+    long live = counted_sink::live;
+    advise_new_sink(point);
+
+    volatile long calls = 0;
+    volatile long failures = 0;
+    {
+        thread_pool pool(4);
+        vector< future<void> > done;
+        for (int i = 0; i < 2; ++i)
+        {
+            done.push_back(pool.submit<void>(
+                fire_repeatedly(point, &calls, 5000)));
+            done.push_back(pool.submit<void>(
+                advise_repeatedly(point, &failures, 1000)));
+        }
+        for (size_t i = 0; i < done.size(); ++i)
+            done[i].get();
+    }
+
+    BOOST_CHECK_EQUAL(failures, 0);
+    BOOST_CHECK_GE(calls, 2 * 5000);
+    test_point::sinks_snapshot sinks = point.sinks();
+    BOOST_REQUIRE_EQUAL(sinks.size(), 1U);
+
+    BOOST_CHECK_EQUAL(point.cp()->Unadvise(sinks.begin()->first), S_OK);
+    sinks = point.sinks();
+    BOOST_CHECK_EQUAL(counted_sink::live, live);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,17 +4,24 @@
 #include <comet/ptr.h>
 #include <comet/server.h> // simple_object
 #include <comet/smart_enum.h>
+#include <comet/snapshot_enum.h>
 #include <comet/stl_enum.h>
+#include <comet/variant.h>
+#include <comet/variant_iterator.h>
 
 #include <exception>
 #include <stdexcept> // runtime_error
 #include <vector>
 
 using comet::com_ptr;
+using comet::make_snapshot_enumeration;
 using comet::nil;
 using comet::simple_object;
 using comet::smart_enumeration;
+using comet::stl_enumeration;
 using comet::stl_enumeration_t;
+using comet::variant_iterator;
+using comet::variant_t;
 
 using std::exception;
 using std::runtime_error;
@@ -211,4 +218,124 @@ BOOST_AUTO_TEST_CASE( smart_enumeration_non_empty )
     enum_chunk_test(e);
 }
 
+/**
+ * variant_iterator fetching in batches smaller, equal to and larger than
+ * the collection.
+ */
+BOOST_AUTO_TEST_CASE( variant_iterator_batches )
+{
+    vector<variant_t> coll;
+    for (int i = 0; i < 10; ++i)
+        coll.push_back(variant_t(i));
+
+    const size_t batch_sizes[] = { 1, 3, 10, 64 };
+    for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b)
+    {
+        com_ptr<IEnumVARIANT> e = stl_enumeration<IEnumVARIANT>::create(coll);
+
+        int expected = 0;
+        for (variant_iterator it(e, batch_sizes[b]);
+             it != variant_iterator(); ++it)
+        {
+            BOOST_CHECK_EQUAL((*it).as_int(), expected);
+            ++expected;
+        }
+        BOOST_CHECK_EQUAL(expected, 10);
+    }
+}
+
+/**
+ * An iterator at the end holds no element.
+ */
+BOOST_AUTO_TEST_CASE( variant_iterator_end_is_empty )
+{
+    vector<variant_t> coll(1, variant_t(7));
+    com_ptr<IEnumVARIANT> e = stl_enumeration<IEnumVARIANT>::create(coll);
+
+    variant_iterator it(e);
+    BOOST_CHECK_EQUAL((*it).as_int(), 7);
+
+    ++it;
+    BOOST_CHECK(!(it != variant_iterator()));
+    BOOST_CHECK((*it).is_empty());
+}
+
+/**
+ * Copies of an iterator share the prefetched elements.
+ */
+BOOST_AUTO_TEST_CASE( variant_iterator_copies_share_batch )
+{
+    vector<variant_t> coll;
+    for (int i = 0; i < 4; ++i)
+        coll.push_back(variant_t(i));
+
+    com_ptr<IEnumVARIANT> e = stl_enumeration<IEnumVARIANT>::create(coll);
+
+    variant_iterator it(e, 64);
+    variant_iterator old = it++;
+    BOOST_CHECK_EQUAL((*old).as_int(), 0);
+    BOOST_CHECK_EQUAL((*it).as_int(), 1);
+
+    ++old;
+    BOOST_CHECK_EQUAL((*old).as_int(), 2);
+    ++it;
+    BOOST_CHECK_EQUAL((*it).as_int(), 3);
+}
+
+/**
+ * Skip stops at the end of the collection and reports a short skip.
+ */
+BOOST_AUTO_TEST_CASE( skip_random_access )
+{
+    vector<variant_t> coll;
+    for (int i = 0; i < 10; ++i)
+        coll.push_back(variant_t(i));
+
+    com_ptr<IEnumVARIANT> e = stl_enumeration<IEnumVARIANT>::create(coll);
+
+    BOOST_CHECK_EQUAL(e->Skip(4), S_OK);
+
+    variant_t v;
+    ULONG fetched = 0;
+    BOOST_CHECK_EQUAL(e->Next(1, v.out(), &fetched), S_OK);
+    BOOST_CHECK_EQUAL(fetched, 1U);
+    BOOST_CHECK_EQUAL(v.as_int(), 4);
+
+    BOOST_CHECK_EQUAL(e->Skip(100), S_FALSE);
+    BOOST_CHECK_EQUAL(e->Next(1, v.out(), &fetched), S_FALSE);
+    BOOST_CHECK_EQUAL(fetched, 0U);
+
+    BOOST_CHECK_EQUAL(e->Reset(), S_OK);
+    BOOST_CHECK_EQUAL(e->Skip(10), S_OK);
+    BOOST_CHECK_EQUAL(e->Skip(1), S_FALSE);
+}
+
+/**
+ * Snapshot enumeration is unaffected by later changes to the collection
+ * and its clones start from the same position.
+ */
+BOOST_AUTO_TEST_CASE( snapshot_enumeration_clone )
+{
+    vector<variant_t> coll;
+    for (int i = 0; i < 5; ++i)
+        coll.push_back(variant_t(i));
+
+    com_ptr<IEnumVARIANT> e = make_snapshot_enumeration<IEnumVARIANT>(coll);
+    coll.clear();
+
+    BOOST_CHECK_EQUAL(e->Skip(2), S_OK);
+
+    com_ptr<IEnumVARIANT> clone;
+    BOOST_REQUIRE_EQUAL(e->Clone(clone.out()), S_OK);
+    e = NULL; // clone must keep the snapshot alive
+
+    int expected = 2;
+    for (variant_iterator it(clone); it != variant_iterator(); ++it)
+    {
+        BOOST_CHECK_EQUAL((*it).as_int(), expected);
+        ++expected;
+    }
+    BOOST_CHECK_EQUAL(expected, 5);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
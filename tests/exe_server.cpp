@@ -0,0 +1,361 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/exe_server.h> // test subject
+
+#include <comet/module.h> // module
+#include <comet/ptr.h>
+#include <comet/server.h> // simple_object
+#include <comet/sta_dispatcher.h>
+#include <comet/threading.h> // critical_section, auto_cs, event, thread
+
+#include <set>
+#include <vector>
+
+using comet::auto_cs;
+using comet::com_ptr;
+using comet::critical_section;
+using comet::event;
+using comet::exe_server;
+using comet::future;
+using comet::impl::apartment_pool;
+using comet::module;
+using comet::nil;
+using comet::simple_object;
+using comet::sta_dispatcher;
+using comet::thread;
+using comet::try_cast;
+
+using std::set;
+using std::vector;
+
+namespace {
+
+    class test_object : public simple_object<nil> {};
+
+    /// Class factory that notes the threads it creates objects on.
+    class recording_factory : public simple_object<IClassFactory>
+    {
+    public:
+        STDMETHOD(CreateInstance)(IUnknown* outer, REFIID riid, void** ppv)
+        {
+            if (outer)
+                return CLASS_E_NOAGGREGATION;
+
+            {
+                auto_cs lock(cs_);
+                threads_.insert(::GetCurrentThreadId());
+            }
+
+            com_ptr<IUnknown> object = new test_object();
+            return object->QueryInterface(riid, ppv);
+        }
+
+        STDMETHOD(LockServer)(BOOL) { return S_OK; }
+
+        set<DWORD> threads() const
+        {
+            auto_cs lock(cs_);
+            return threads_;
+        }
+
+    private:
+        critical_section cs_;
+        set<DWORD> threads_;
+    };
+
+    /// Joins a single-threaded apartment for the duration of a test, as
+    /// the thread running an exe_server does.
+    struct sta_fixture
+    {
+        sta_fixture() : hr(::CoInitializeEx(0, COINIT_APARTMENTTHREADED)) {}
+
+        ~sta_fixture()
+        {
+            if (SUCCEEDED(hr))
+                ::CoUninitialize();
+        }
+
+        HRESULT hr;
+    };
+
+    // {5B7E2B1C-8D43-4E0A-9F1E-6C2A7D3B9E41}
+    const CLSID CLSID_apartment_test = { 0x5b7e2b1c, 0x8d43, 0x4e0a,
+        { 0x9f, 0x1e, 0x6c, 0x2a, 0x7d, 0x3b, 0x9e, 0x41 } };
+
+    com_ptr<IUnknown> create(IClassFactory* factory)
+    {
+        com_ptr<IUnknown> object;
+        BOOST_REQUIRE_EQUAL(
+            factory->CreateInstance(
+                0, IID_IUnknown, reinterpret_cast<void**>(object.out())),
+            S_OK);
+        return object;
+    }
+
+    /// Type library without any classes.
+    struct empty_typelib
+    {
+        typedef nil coclasses;
+    };
+
+    /**
+     * Runs an exe_server on its own thread, which is the thread it posts
+     * its quit message to.
+     *
+     * Running a server shuts the module down as it ends, so tests that
+     * follow can't rely on anything disposed of then.
+     */
+    class server_thread : public thread
+    {
+    public:
+        server_thread(DWORD idle_time, DWORD drain_time)
+            : dispatcher(0), idle_time_(idle_time), drain_time_(drain_time)
+        {}
+
+        /// Runs calls on the server thread while the server is running.
+        sta_dispatcher* dispatcher;
+        event ready;
+
+    private:
+        DWORD thread_main()
+        {
+            ::CoInitializeEx(0, COINIT_APARTMENTTHREADED);
+            {
+                exe_server<empty_typelib> server(::GetModuleHandle(0));
+                server.shutdown_delays(idle_time_, drain_time_);
+
+                sta_dispatcher calls;
+                dispatcher = &calls;
+                ready.set();
+
+                server.run();
+            }
+            ::CoUninitialize();
+            return 0;
+        }
+
+        DWORD idle_time_;
+        DWORD drain_time_;
+    };
+
+    /**
+     * Releases the test's module lock so the server stops, then takes
+     * another once the server has decided to, as would a call arriving
+     * while the server shuts down.
+     *
+     * Runs on the server thread.  Returns the tick count when it took the
+     * lock.
+     */
+    struct lock_while_stopping
+    {
+        DWORD operator()() const
+        {
+            module().unlock();
+
+            // The server has decided to stop once its quit message arrives
+            DWORD start = ::GetTickCount();
+            MSG msg;
+            while (!::PeekMessage(&msg, 0, WM_QUIT, WM_QUIT, PM_NOREMOVE) &&
+                   ::GetTickCount() - start < 5000)
+                ::Sleep(10);
+
+            module().lock();
+            return ::GetTickCount();
+        }
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( exe_server_tests )
+
+/**
+ * Activations through the pool's factory take the apartments in turn, none
+ * of them the activating thread's.
+ */
+BOOST_FIXTURE_TEST_CASE( activations_spread_across_apartments, sta_fixture )
+{
+    recording_factory* factory = new recording_factory();
+    com_ptr<IClassFactory> factory_ref = factory;
+
+    apartment_pool pool;
+    pool.start(3);
+    {
+        com_ptr<IClassFactory> wrapper =
+            try_cast(com_ptr<IUnknown>(pool.wrap(factory)));
+
+        for (int i = 0; i < 6; ++i)
+            create(wrapper.in());
+    }
+    pool.stop();
+
+    set<DWORD> threads = factory->threads();
+    BOOST_CHECK_EQUAL(threads.size(), 3U);
+    BOOST_CHECK(threads.count(::GetCurrentThreadId()) == 0);
+}
+
+/**
+ * stop() ends every apartment thread before it returns.
+ */
+BOOST_FIXTURE_TEST_CASE( stop_joins_apartments, sta_fixture )
+{
+    recording_factory* factory = new recording_factory();
+    com_ptr<IClassFactory> factory_ref = factory;
+
+    apartment_pool pool;
+    pool.start(2);
+    {
+        com_ptr<IClassFactory> wrapper =
+            try_cast(com_ptr<IUnknown>(pool.wrap(factory)));
+
+        // One activation in each apartment shows which threads they are
+        create(wrapper.in());
+        create(wrapper.in());
+    }
+
+    set<DWORD> ids = factory->threads();
+    BOOST_REQUIRE_EQUAL(ids.size(), 2U);
+
+    vector<HANDLE> threads;
+    for (set<DWORD>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+        HANDLE thread = ::OpenThread(SYNCHRONIZE, FALSE, *it);
+        BOOST_REQUIRE(thread != NULL);
+        threads.push_back(thread);
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        BOOST_CHECK_EQUAL(
+            ::WaitForSingleObject(threads[i], 0), DWORD(WAIT_TIMEOUT));
+
+    pool.stop();
+    BOOST_CHECK(pool.empty());
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(
+            ::WaitForSingleObject(threads[i], 0), DWORD(WAIT_OBJECT_0));
+        ::CloseHandle(threads[i]);
+    }
+}
+
+/**
+ * The pool's factory ignores the references COM takes and drops, so it
+ * outlives registering and revoking it, and can be registered again.
+ */
+BOOST_FIXTURE_TEST_CASE( factory_survives_revocation, sta_fixture )
+{
+    recording_factory* factory = new recording_factory();
+    com_ptr<IClassFactory> factory_ref = factory;
+
+    apartment_pool pool;
+    pool.start(1);
+    IUnknown* wrapper = pool.wrap(factory);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        DWORD cookie;
+        BOOST_REQUIRE_EQUAL(
+            ::CoRegisterClassObject(
+                CLSID_apartment_test, wrapper, CLSCTX_INPROC_SERVER,
+                REGCLS_MULTIPLEUSE, &cookie),
+            S_OK);
+
+        {
+            com_ptr<IUnknown> object;
+            BOOST_CHECK_EQUAL(
+                ::CoCreateInstance(
+                    CLSID_apartment_test, 0, CLSCTX_INPROC_SERVER,
+                    IID_IUnknown, reinterpret_cast<void**>(object.out())),
+                S_OK);
+        }
+
+        BOOST_CHECK_EQUAL(::CoRevokeClassObject(cookie), S_OK);
+    }
+
+    // Still usable after COM has let go of it
+    {
+        com_ptr<IClassFactory> still_there =
+            try_cast(com_ptr<IUnknown>(wrapper));
+        create(still_there.in());
+    }
+    BOOST_CHECK_EQUAL(factory->threads().size(), 1U);
+
+    pool.stop();
+}
+
+/**
+ * With no idle period the server quits as soon as the last module lock is
+ * released, not after the default five seconds.
+ */
+BOOST_AUTO_TEST_CASE( no_idle_time_quits_on_last_unlock )
+{
+    BOOST_REQUIRE_EQUAL(module().lock_count(), 0);
+    module().lock();
+
+    server_thread server(0, 10000);
+    server.start();
+    BOOST_REQUIRE(server.ready.wait(5000));
+
+    // Locked, so the server carries on
+    BOOST_CHECK(!server.wait(200));
+
+    DWORD released = ::GetTickCount();
+    module().unlock();
+    BOOST_REQUIRE(server.wait(5000));
+    BOOST_CHECK_LT(::GetTickCount() - released, 1000U);
+}
+
+/**
+ * A lock taken once the server has decided to stop is waited for, and the
+ * server ends as soon as it is released rather than after a fixed pause.
+ */
+BOOST_AUTO_TEST_CASE( drain_waits_for_late_lock )
+{
+    BOOST_REQUIRE_EQUAL(module().lock_count(), 0);
+    module().lock();
+
+    server_thread server(0, 10000);
+    server.start();
+    BOOST_REQUIRE(server.ready.wait(5000));
+
+    future<DWORD> locked =
+        server.dispatcher->post<DWORD>(lock_while_stopping());
+    BOOST_REQUIRE(locked.wait(5000));
+    BOOST_REQUIRE_EQUAL(module().lock_count(), 1);
+
+    // Still held, so the server is still draining
+    BOOST_CHECK(!server.wait(300));
+
+    DWORD released = ::GetTickCount();
+    module().unlock();
+    BOOST_REQUIRE(server.wait(5000));
+    BOOST_CHECK_LT(::GetTickCount() - released, 1000U);
+}
+
+/**
+ * A lock that is never released holds the server up for the drain limit
+ * and no longer.
+ */
+BOOST_AUTO_TEST_CASE( drain_gives_up_at_limit )
+{
+    BOOST_REQUIRE_EQUAL(module().lock_count(), 0);
+    module().lock();
+
+    server_thread server(0, 500);
+    server.start();
+    BOOST_REQUIRE(server.ready.wait(5000));
+
+    future<DWORD> locked =
+        server.dispatcher->post<DWORD>(lock_while_stopping());
+    BOOST_REQUIRE(locked.wait(5000));
+
+    BOOST_REQUIRE(server.wait(5000));
+    DWORD drained = ::GetTickCount() - locked.get();
+    BOOST_CHECK_GE(drained, 400U);
+    BOOST_CHECK_LT(drained, 2000U);
+
+    BOOST_CHECK_EQUAL(module().lock_count(), 1);
+    module().unlock();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
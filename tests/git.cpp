@@ -0,0 +1,69 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/git.h> // test subject
+
+#include <comet/error.h> // com_error
+#include <comet/ptr.h>
+#include <comet/server.h> // simple_object
+
+using comet::com_error;
+using comet::com_ptr;
+using comet::GIT;
+using comet::GIT_cookie;
+using comet::nil;
+using comet::simple_object;
+
+namespace {
+
+    class test_object : public simple_object<nil> {};
+
+    /// Joins the MTA for the duration of a test.
+    struct mta_fixture
+    {
+        mta_fixture() : hr(::CoInitializeEx(0, COINIT_MULTITHREADED)) {}
+
+        ~mta_fixture()
+        {
+            GIT::release_thread_cache();
+            if (SUCCEEDED(hr))
+                ::CoUninitialize();
+        }
+
+        HRESULT hr;
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( git_tests )
+
+BOOST_FIXTURE_TEST_CASE( cached_interface, mta_fixture )
+{
+    GIT git;
+    com_ptr<IUnknown> object = new test_object();
+    GIT_cookie<IUnknown> cookie = git.register_interface(object);
+
+    com_ptr<IUnknown> first = git.get_cached_interface(cookie);
+    com_ptr<IUnknown> second = git.get_cached_interface(cookie);
+    BOOST_CHECK(first == object);
+    BOOST_CHECK(second == first);
+
+    git.revoke_interface(cookie);
+
+    // The revoked cookie must not be served from the cache
+    BOOST_CHECK_THROW(git.get_cached_interface(cookie), com_error);
+}
+
+BOOST_FIXTURE_TEST_CASE( release_thread_cache, mta_fixture )
+{
+    GIT git;
+    com_ptr<IUnknown> object = new test_object();
+    GIT_cookie<IUnknown> cookie = git.register_interface(object);
+
+    git.get_cached_interface(cookie);
+    GIT::release_thread_cache();
+    BOOST_CHECK(git.get_cached_interface(cookie) == object);
+
+    git.revoke_interface(cookie);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,227 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/mapped_file_stream.h> // test subject
+
+#include <comet/bstr.h> // bstr_t
+#include <comet/error.h> // com_error
+#include <comet/ptr.h> // com_ptr
+#include <comet/stream.h> // adapt_stream
+
+#include <fstream>
+#include <limits> // numeric_limits
+#include <sstream> // ostringstream
+#include <string>
+#include <vector>
+
+using comet::adapt_stream;
+using comet::bstr_t;
+using comet::com_error;
+using comet::com_ptr;
+using comet::mapped_file_stream;
+
+using std::ofstream;
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+namespace {
+
+    /// Temporary file that is deleted at the end of the test.
+    class temp_file_fixture
+    {
+    public:
+        temp_file_fixture()
+        {
+            wchar_t directory[MAX_PATH];
+            wchar_t name[MAX_PATH];
+            BOOST_REQUIRE(::GetTempPathW(MAX_PATH, directory));
+            BOOST_REQUIRE(::GetTempFileNameW(directory, L"cmt", 0, name));
+            path_ = name;
+        }
+
+        ~temp_file_fixture()
+        {
+            ::DeleteFileW(path_.c_str());
+        }
+
+        const bstr_t& create_file(const string& contents)
+        {
+            ofstream file(path_.c_str(), std::ios_base::binary);
+            file.write(contents.data(), contents.size());
+            return path_;
+        }
+
+    private:
+        bstr_t path_;
+    };
+
+    string read_bytes(com_ptr<IStream> stream, ULONG count, HRESULT& hr)
+    {
+        vector<char> buffer(count + 1);
+        ULONG read = 99;
+        hr = stream->Read(&buffer[0], count, &read);
+        return string(&buffer[0], read);
+    }
+
+    ULONGLONG seek(com_ptr<IStream> stream, LONGLONG offset, DWORD origin)
+    {
+        LARGE_INTEGER move;
+        move.QuadPart = offset;
+        ULARGE_INTEGER position;
+        BOOST_REQUIRE_EQUAL(stream->Seek(move, origin, &position), S_OK);
+        return position.QuadPart;
+    }
+}
+
+BOOST_FIXTURE_TEST_SUITE( mapped_file_stream_tests, temp_file_fixture )
+
+BOOST_AUTO_TEST_CASE( read_whole_file )
+{
+    com_ptr<IStream> s =
+        new mapped_file_stream(create_file("gobbeldy gook"));
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 13, hr), "gobbeldy gook");
+    BOOST_CHECK_EQUAL(hr, S_OK);
+
+    BOOST_CHECK_EQUAL(read_bytes(s, 10, hr), "");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+BOOST_AUTO_TEST_CASE( read_past_end )
+{
+    com_ptr<IStream> s =
+        new mapped_file_stream(create_file("gobbeldy gook"));
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 20, hr), "gobbeldy gook");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+BOOST_AUTO_TEST_CASE( empty_file )
+{
+    com_ptr<IStream> s = new mapped_file_stream(create_file(""));
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 10, hr), "");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+BOOST_AUTO_TEST_CASE( missing_file )
+{
+    BOOST_CHECK_THROW(
+        new mapped_file_stream(L"C:\\no\\such\\file.bin"), com_error);
+}
+
+BOOST_AUTO_TEST_CASE( seek_positions )
+{
+    com_ptr<IStream> s =
+        new mapped_file_stream(create_file("gobbeldy gook"));
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(seek(s, 9, STREAM_SEEK_SET), 9U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 4, hr), "gook");
+
+    BOOST_CHECK_EQUAL(seek(s, -8, STREAM_SEEK_END), 5U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 3, hr), "ldy");
+
+    BOOST_CHECK_EQUAL(seek(s, -6, STREAM_SEEK_CUR), 2U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 3, hr), "bbe");
+
+    // Past the end is allowed, before the start is not
+    BOOST_CHECK_EQUAL(seek(s, 20, STREAM_SEEK_SET), 20U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 3, hr), "");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+
+    LARGE_INTEGER move;
+    move.QuadPart = -1;
+    ULARGE_INTEGER position;
+    BOOST_CHECK_EQUAL(
+        s->Seek(move, STREAM_SEEK_SET, &position), STG_E_INVALIDFUNCTION);
+    BOOST_CHECK_EQUAL(position.QuadPart, 20U);
+}
+
+BOOST_AUTO_TEST_CASE( write_fails )
+{
+    com_ptr<IStream> s =
+        new mapped_file_stream(create_file("gobbeldy gook"));
+
+    ULONG written = 99;
+    BOOST_CHECK_EQUAL(s->Write("bob", 3, &written), STG_E_ACCESSDENIED);
+    BOOST_CHECK_EQUAL(written, 0U);
+}
+
+BOOST_AUTO_TEST_CASE( stat_size_and_name )
+{
+    const bstr_t& path = create_file("gobbeldy gook");
+    com_ptr<IStream> s = new mapped_file_stream(path);
+
+    STATSTG stat;
+    BOOST_REQUIRE_EQUAL(s->Stat(&stat, STATFLAG_DEFAULT), S_OK);
+    BOOST_CHECK_EQUAL(stat.type, static_cast<DWORD>(STGTY_STREAM));
+    BOOST_CHECK_EQUAL(stat.cbSize.QuadPart, 13U);
+    BOOST_CHECK(bstr_t(stat.pwcsName) == path);
+    ::CoTaskMemFree(stat.pwcsName);
+
+    BOOST_REQUIRE_EQUAL(s->Stat(&stat, STATFLAG_NONAME), S_OK);
+    BOOST_CHECK(stat.pwcsName == NULL);
+}
+
+/**
+ * A clone starts where the original was and moves independently, and
+ * outlives it.
+ */
+BOOST_AUTO_TEST_CASE( clone_shares_mapping )
+{
+    com_ptr<IStream> s =
+        new mapped_file_stream(create_file("gobbeldy gook"));
+
+    HRESULT hr;
+    read_bytes(s, 4, hr);
+
+    com_ptr<IStream> c;
+    BOOST_REQUIRE_EQUAL(s->Clone(c.out()), S_OK);
+
+    BOOST_CHECK_EQUAL(read_bytes(s, 4, hr), "eldy");
+    BOOST_CHECK_EQUAL(read_bytes(c, 4, hr), "eldy");
+
+    s = 0;
+
+    BOOST_CHECK_EQUAL(read_bytes(c, 5, hr), " gook");
+}
+
+/**
+ * Enough bytes that CopyTo goes round more than once.
+ */
+BOOST_AUTO_TEST_CASE( copy_to_stream )
+{
+    string data;
+    while (data.size() < static_cast<size_t>(3 * COMET_MAPPED_FILE_READAHEAD))
+        data += "gobbeldy gook ";
+
+    com_ptr<IStream> s = new mapped_file_stream(create_file(data));
+
+    ostringstream copy;
+    com_ptr<IStream> d = adapt_stream(copy);
+
+    // Start part way in
+    seek(s, 5, STREAM_SEEK_SET);
+
+    ULARGE_INTEGER amount;
+    amount.QuadPart = (std::numeric_limits<ULONGLONG>::max)();
+    ULARGE_INTEGER bytes_read;
+    ULARGE_INTEGER bytes_written;
+    BOOST_CHECK_EQUAL(
+        s->CopyTo(d.in(), amount, &bytes_read, &bytes_written), S_OK);
+    BOOST_CHECK_EQUAL(bytes_read.QuadPart, data.size() - 5);
+    BOOST_CHECK_EQUAL(bytes_written.QuadPart, data.size() - 5);
+
+    BOOST_CHECK(copy.str() == data.substr(5));
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 1, hr), "");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,335 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/memory_stream.h> // test subject
+
+#include <comet/ptr.h> // com_ptr
+#include <comet/stream.h> // adapt_stream
+
+#include <limits> // numeric_limits
+#include <sstream> // ostringstream
+#include <string>
+#include <vector>
+
+using comet::adapt_stream;
+using comet::com_ptr;
+using comet::memory_stream;
+using comet::memory_stream_chunks;
+
+using std::ostringstream;
+using std::string;
+using std::vector;
+
+namespace {
+
+    string read_bytes(com_ptr<IStream> stream, ULONG count, HRESULT& hr)
+    {
+        vector<char> buffer(count + 1);
+        ULONG read = 99;
+        hr = stream->Read(&buffer[0], count, &read);
+        return string(&buffer[0], read);
+    }
+
+    void write_bytes(com_ptr<IStream> stream, const string& data)
+    {
+        ULONG written = 99;
+        BOOST_REQUIRE_EQUAL(
+            stream->Write(
+                data.data(), static_cast<ULONG>(data.size()), &written),
+            S_OK);
+        BOOST_REQUIRE_EQUAL(written, data.size());
+    }
+
+    ULONGLONG seek(com_ptr<IStream> stream, LONGLONG offset, DWORD origin)
+    {
+        LARGE_INTEGER move;
+        move.QuadPart = offset;
+        ULARGE_INTEGER position;
+        BOOST_REQUIRE_EQUAL(stream->Seek(move, origin, &position), S_OK);
+        return position.QuadPart;
+    }
+
+    ULONGLONG stream_size(com_ptr<IStream> stream)
+    {
+        STATSTG stat;
+        BOOST_REQUIRE_EQUAL(stream->Stat(&stat, STATFLAG_NONAME), S_OK);
+        return stat.cbSize.QuadPart;
+    }
+
+    /// Enough data to need several chunks.
+    string big_data()
+    {
+        string data;
+        while (data.size() < 5 * COMET_MEMORY_STREAM_CHUNK_SIZE)
+            data += "gobbeldy gook ";
+        return data;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE( memory_stream_tests )
+
+BOOST_AUTO_TEST_CASE( write_then_read )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+    BOOST_CHECK_EQUAL(stream_size(s), 13U);
+
+    seek(s, 0, STREAM_SEEK_SET);
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 13, hr), "gobbeldy gook");
+    BOOST_CHECK_EQUAL(hr, S_OK);
+
+    BOOST_CHECK_EQUAL(read_bytes(s, 10, hr), "");
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+/**
+ * Writes straddling chunk boundaries come back intact.
+ */
+BOOST_AUTO_TEST_CASE( write_across_chunks )
+{
+    string data = big_data();
+
+    com_ptr<IStream> s = new memory_stream();
+    for (size_t i = 0; i < data.size(); i += 1000)
+        write_bytes(s, data.substr(i, 1000));
+    BOOST_CHECK_EQUAL(stream_size(s), data.size());
+
+    seek(s, 0, STREAM_SEEK_SET);
+
+    HRESULT hr;
+    BOOST_CHECK(
+        read_bytes(s, static_cast<ULONG>(data.size()), hr) == data);
+    BOOST_CHECK_EQUAL(hr, S_OK);
+}
+
+BOOST_AUTO_TEST_CASE( overwrite_middle )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+
+    seek(s, 2, STREAM_SEEK_SET);
+    write_bytes(s, "BBE");
+    BOOST_CHECK_EQUAL(stream_size(s), 13U);
+
+    seek(s, 0, STREAM_SEEK_SET);
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 13, hr), "goBBEldy gook");
+}
+
+BOOST_AUTO_TEST_CASE( write_past_end_fills_with_zeros )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "bob");
+
+    seek(s, 6, STREAM_SEEK_SET);
+    write_bytes(s, "bob");
+
+    seek(s, 0, STREAM_SEEK_SET);
+
+    HRESULT hr;
+    BOOST_CHECK(read_bytes(s, 9, hr) == string("bob\0\0\0bob", 9));
+}
+
+/**
+ * Bytes cut off by SetSize don't come back when the stream grows again.
+ */
+BOOST_AUTO_TEST_CASE( set_size )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+
+    ULARGE_INTEGER size;
+    size.QuadPart = 3;
+    BOOST_REQUIRE_EQUAL(s->SetSize(size), S_OK);
+    BOOST_CHECK_EQUAL(stream_size(s), 3U);
+
+    size.QuadPart = 6;
+    BOOST_REQUIRE_EQUAL(s->SetSize(size), S_OK);
+    BOOST_CHECK_EQUAL(stream_size(s), 6U);
+
+    seek(s, 0, STREAM_SEEK_SET);
+
+    HRESULT hr;
+    BOOST_CHECK(read_bytes(s, 10, hr) == string("gob\0\0\0", 6));
+    BOOST_CHECK_EQUAL(hr, S_FALSE);
+}
+
+BOOST_AUTO_TEST_CASE( seek_positions )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(seek(s, -8, STREAM_SEEK_END), 5U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 3, hr), "ldy");
+
+    BOOST_CHECK_EQUAL(seek(s, -6, STREAM_SEEK_CUR), 2U);
+    BOOST_CHECK_EQUAL(read_bytes(s, 3, hr), "bbe");
+
+    LARGE_INTEGER move;
+    move.QuadPart = -1;
+    ULARGE_INTEGER position;
+    BOOST_CHECK_EQUAL(
+        s->Seek(move, STREAM_SEEK_SET, &position), STG_E_INVALIDFUNCTION);
+    BOOST_CHECK_EQUAL(position.QuadPart, 5U);
+}
+
+/**
+ * The clone reads the same bytes until one of them writes, and each then
+ * sees only its own writes.
+ */
+BOOST_AUTO_TEST_CASE( clone_copy_on_write )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+    seek(s, 0, STREAM_SEEK_SET);
+
+    com_ptr<IStream> c;
+    BOOST_REQUIRE_EQUAL(s->Clone(c.out()), S_OK);
+
+    write_bytes(c, "GOB");
+    write_bytes(s, "bob");
+
+    HRESULT hr;
+    seek(s, 0, STREAM_SEEK_SET);
+    BOOST_CHECK_EQUAL(read_bytes(s, 13, hr), "bobbeldy gook");
+    seek(c, 0, STREAM_SEEK_SET);
+    BOOST_CHECK_EQUAL(read_bytes(c, 13, hr), "GOBbeldy gook");
+}
+
+BOOST_AUTO_TEST_CASE( clone_outlives_original )
+{
+    com_ptr<IStream> s = new memory_stream();
+    write_bytes(s, "gobbeldy gook");
+    seek(s, 4, STREAM_SEEK_SET);
+
+    com_ptr<IStream> c;
+    BOOST_REQUIRE_EQUAL(s->Clone(c.out()), S_OK);
+    s = 0;
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(c, 9, hr), "eldy gook");
+}
+
+/**
+ * Everything fitted in the first chunk, so the bytes come out in the same
+ * buffer they were written to.
+ */
+BOOST_AUTO_TEST_CASE( release_bytes_without_copy )
+{
+    memory_stream* m = new memory_stream(100);
+    com_ptr<IStream> s = m;
+    write_bytes(s, "gobbeldy gook");
+
+    vector<unsigned char> bytes;
+    m->release_bytes(bytes);
+
+    BOOST_CHECK_EQUAL(bytes.size(), 13U);
+    BOOST_CHECK_GE(bytes.capacity(), 100U);
+    BOOST_CHECK(string(bytes.begin(), bytes.end()) == "gobbeldy gook");
+
+    BOOST_CHECK_EQUAL(stream_size(s), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( release_bytes_joins_chunks )
+{
+    string data = big_data();
+
+    memory_stream* m = new memory_stream();
+    com_ptr<IStream> s = m;
+    for (size_t i = 0; i < data.size(); i += 1000)
+        write_bytes(s, data.substr(i, 1000));
+
+    vector<unsigned char> bytes;
+    m->release_bytes(bytes);
+
+    BOOST_CHECK(string(bytes.begin(), bytes.end()) == data);
+}
+
+BOOST_AUTO_TEST_CASE( release_chunks )
+{
+    string data = big_data();
+
+    memory_stream* m = new memory_stream();
+    com_ptr<IStream> s = m;
+    for (size_t i = 0; i < data.size(); i += 1000)
+        write_bytes(s, data.substr(i, 1000));
+
+    memory_stream_chunks chunks;
+    m->release_chunks(chunks);
+
+    BOOST_CHECK_GT(chunks.size(), 1U);
+
+    string joined;
+    for (size_t i = 0; i < chunks.size(); ++i)
+        joined.append(chunks[i].begin(), chunks[i].end());
+    BOOST_CHECK(joined == data);
+}
+
+/**
+ * Releasing from one stream leaves a clone sharing the bytes untouched.
+ */
+BOOST_AUTO_TEST_CASE( release_bytes_shared_with_clone )
+{
+    memory_stream* m = new memory_stream();
+    com_ptr<IStream> s = m;
+    write_bytes(s, "gobbeldy gook");
+    seek(s, 0, STREAM_SEEK_SET);
+
+    com_ptr<IStream> c;
+    BOOST_REQUIRE_EQUAL(s->Clone(c.out()), S_OK);
+
+    vector<unsigned char> bytes;
+    m->release_bytes(bytes);
+    BOOST_CHECK(string(bytes.begin(), bytes.end()) == "gobbeldy gook");
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(c, 13, hr), "gobbeldy gook");
+}
+
+BOOST_AUTO_TEST_CASE( adopt_bytes )
+{
+    string data("gobbeldy gook");
+    vector<unsigned char> bytes(data.begin(), data.end());
+    const unsigned char* buffer = &bytes[0];
+
+    memory_stream* m = new memory_stream(bytes);
+    com_ptr<IStream> s = m;
+    BOOST_CHECK(bytes.empty());
+
+    HRESULT hr;
+    BOOST_CHECK_EQUAL(read_bytes(s, 13, hr), "gobbeldy gook");
+
+    m->release_bytes(bytes);
+    BOOST_CHECK(&bytes[0] == buffer);
+}
+
+BOOST_AUTO_TEST_CASE( copy_to_stream )
+{
+    string data = big_data();
+
+    com_ptr<IStream> s = new memory_stream();
+    for (size_t i = 0; i < data.size(); i += 1000)
+        write_bytes(s, data.substr(i, 1000));
+
+    ostringstream copy;
+    com_ptr<IStream> d = adapt_stream(copy);
+
+    seek(s, 5, STREAM_SEEK_SET);
+
+    ULARGE_INTEGER amount;
+    amount.QuadPart = (std::numeric_limits<ULONGLONG>::max)();
+    ULARGE_INTEGER bytes_read;
+    ULARGE_INTEGER bytes_written;
+    BOOST_CHECK_EQUAL(
+        s->CopyTo(d.in(), amount, &bytes_read, &bytes_written), S_OK);
+    BOOST_CHECK_EQUAL(bytes_read.QuadPart, data.size() - 5);
+    BOOST_CHECK_EQUAL(bytes_written.QuadPart, data.size() - 5);
+
+    BOOST_CHECK(copy.str() == data.substr(5));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
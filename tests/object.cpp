@@ -23,13 +23,91 @@
 
 #include <string>
 
+using comet::activation_pool_metrics;
+using comet::class_factory_pooled;
 using comet::com_error;
 using comet::com_error_from_interface;
 using comet::com_ptr;
+using comet::impl::activation_pool;
 using comet::simple_object;
 
 using std::string;
 
+namespace {
+
+    /// Object for a pooled class factory that counts its instances.
+    template<int Tag, size_t PoolSize>
+    class pooled_object : public simple_object<IPersist>
+    {
+    public:
+        enum { pool_size = PoolSize };
+
+        pooled_object()
+        {
+            // Off the test's thread, the constructor may be held up
+            if (::GetCurrentThreadId() != test_thread && gate)
+                ::WaitForSingleObject(gate, 5000);
+            ::Sleep(delay);
+            ::InterlockedIncrement(&live);
+        }
+
+        ~pooled_object()
+        {
+            ::InterlockedDecrement(&live);
+        }
+
+        virtual HRESULT STDMETHODCALLTYPE GetClassID(CLSID*)
+        {
+            return E_NOTIMPL;
+        }
+
+        static activation_pool_metrics metrics()
+        {
+            return activation_pool<pooled_object>::instance().metrics();
+        }
+
+        static DWORD test_thread;
+        static HANDLE gate;
+        static DWORD delay;
+        static long volatile live;
+    };
+
+    template<int Tag, size_t PoolSize>
+    DWORD pooled_object<Tag, PoolSize>::test_thread = ::GetCurrentThreadId();
+
+    template<int Tag, size_t PoolSize>
+    HANDLE pooled_object<Tag, PoolSize>::gate = 0;
+
+    template<int Tag, size_t PoolSize>
+    DWORD pooled_object<Tag, PoolSize>::delay = 0;
+
+    template<int Tag, size_t PoolSize>
+    long volatile pooled_object<Tag, PoolSize>::live = 0;
+
+    template<typename T>
+    com_ptr<IPersist> activate(class_factory_pooled<T, false>& factory)
+    {
+        com_ptr<IPersist> object;
+        BOOST_REQUIRE_EQUAL(
+            factory.CreateInstance(
+                0, IID_IPersist, reinterpret_cast<void**>(object.out())),
+            S_OK);
+        return object;
+    }
+
+    template<typename T>
+    void wait_for_ready(size_t count)
+    {
+        for (int i = 0; i < 500; ++i)
+        {
+            if (T::metrics().ready == count)
+                return;
+            ::Sleep(10);
+        }
+        BOOST_FAIL("pool not filled in time");
+    }
+}
+
 BOOST_AUTO_TEST_SUITE( object_tests )
 
 // Test that exceptions are correctly converted to Error info and back again
@@ -109,4 +187,62 @@ BOOST_AUTO_TEST_CASE( contained_exceptions_propagate_out )
     BOOST_CHECK_EQUAL(error.source().s_str(), "error_object.GetClassID");
 }
 
+/**
+ * Activations are served from the pool, which is topped up after each.
+ */
+BOOST_AUTO_TEST_CASE( pool_hit_refills )
+{
+    typedef pooled_object<1, 2> object_type;
+
+    class_factory_pooled<object_type, false> factory;
+    wait_for_ready<object_type>(2);
+
+    com_ptr<IPersist> object = activate(factory);
+    BOOST_CHECK_EQUAL(object_type::metrics().hits, 1U);
+    BOOST_CHECK_EQUAL(object_type::metrics().misses, 0U);
+
+    wait_for_ready<object_type>(2);
+    BOOST_CHECK_EQUAL(object_type::live, 3);
+}
+
+/**
+ * An activation that finds the pool empty constructs the object itself.
+ */
+BOOST_AUTO_TEST_CASE( pool_miss )
+{
+    typedef pooled_object<2, 2> object_type;
+    object_type::gate = ::CreateEvent(0, true, false, 0);
+
+    class_factory_pooled<object_type, false> factory;
+    com_ptr<IPersist> object = activate(factory);
+    BOOST_CHECK_EQUAL(object_type::metrics().hits, 0U);
+    BOOST_CHECK_EQUAL(object_type::metrics().misses, 1U);
+
+    ::SetEvent(object_type::gate);
+    wait_for_ready<object_type>(2);
+    BOOST_CHECK_EQUAL(object_type::metrics().misses, 1U);
+
+    ::CloseHandle(object_type::gate);
+    object_type::gate = 0;
+}
+
+/**
+ * Shutting down while the pool is being filled waits for the object under
+ * construction and destroys every waiting object.
+ */
+BOOST_AUTO_TEST_CASE( pool_shutdown_during_refill )
+{
+    typedef pooled_object<3, 8> object_type;
+    object_type::delay = 20;
+
+    {
+        class_factory_pooled<object_type, false> factory;
+        ::Sleep(50);
+        activation_pool<object_type>::instance().object_dispose();
+    }
+
+    BOOST_CHECK_EQUAL(object_type::metrics().ready, 0U);
+    BOOST_CHECK_EQUAL(object_type::live, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/serialise.h> // test subject
+
+#include <comet/bstr.h>
+#include <comet/ptr.h>
+#include <comet/safearray.h>
+#include <comet/stream.h> // adapt_stream
+#include <comet/variant.h>
+
+#include <sstream> // stringstream
+#include <stdexcept>
+#include <string>
+
+using comet::adapt_stream;
+using comet::bstr_t;
+using comet::com_error;
+using comet::com_ptr;
+using comet::safearray_t;
+using comet::variant_reader;
+using comet::variant_t;
+using comet::variant_writer;
+
+using std::string;
+using std::stringstream;
+
+namespace {
+
+    /// Append the bytes of a value as they would be serialised.
+    template<typename T>
+    void append_raw(string& data, T value)
+    {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE( serialise_tests )
+
+BOOST_AUTO_TEST_CASE( scalar_round_trip )
+{
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    {
+        variant_writer writer(stream);
+        writer.write(variant_t(42));
+        writer.write(variant_t(3.5));
+        writer.write(variant_t(L"a string"));
+        writer.write(variant_t(true));
+        writer.write(variant_t());
+        writer.flush();
+    }
+
+    data.seekg(0);
+    variant_reader reader(stream);
+
+    variant_t v;
+    reader.read(v);
+    BOOST_CHECK_EQUAL(v.get_vt(), VT_I4);
+    BOOST_CHECK_EQUAL(v.as_int(), 42);
+    reader.read(v);
+    BOOST_CHECK_EQUAL(v.get_vt(), VT_R8);
+    BOOST_CHECK_EQUAL(v.as_double(), 3.5);
+    reader.read(v);
+    BOOST_CHECK_EQUAL(v.get_vt(), VT_BSTR);
+    BOOST_CHECK(v == L"a string");
+    reader.read(v);
+    BOOST_CHECK_EQUAL(v.get_vt(), VT_BOOL);
+    BOOST_CHECK(bool(v));
+    reader.read(v);
+    BOOST_CHECK(v.is_empty());
+}
+
+BOOST_AUTO_TEST_CASE( safearray_round_trip )
+{
+    safearray_t<long> longs(3, 1);
+    longs[1] = 7; longs[2] = 8; longs[3] = 9;
+
+    safearray_t<variant_t> mixed(3, 0);
+    mixed[0] = 1;
+    mixed[1] = L"two";
+    mixed[2] = longs;
+
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    {
+        // Small chunks to exercise buffer refilling
+        variant_writer writer(stream, 3);
+        writer.write(mixed);
+        writer.flush();
+    }
+
+    data.seekg(0);
+    variant_reader reader(stream, 3);
+
+    safearray_t<variant_t> result;
+    reader.read(result);
+
+    BOOST_REQUIRE_EQUAL(result.size(), 3U);
+    BOOST_CHECK_EQUAL(result.lower_bound(), 0);
+    BOOST_CHECK(result[0] == 1);
+    BOOST_CHECK(result[1] == L"two");
+
+    safearray_t<long> nested(result[2]);
+    BOOST_REQUIRE_EQUAL(nested.size(), 3U);
+    BOOST_CHECK_EQUAL(nested.lower_bound(), 1);
+    BOOST_CHECK_EQUAL(nested[1], 7);
+    BOOST_CHECK_EQUAL(nested[3], 9);
+}
+
+BOOST_AUTO_TEST_CASE( streamed_array )
+{
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    {
+        variant_writer writer(stream);
+        writer.begin_array(VT_R8, 1000);
+        for (int i = 0; i < 1000; ++i)
+            writer.write(variant_t(i)); // converted to VT_R8
+        writer.end_array();
+        writer.flush();
+    }
+
+    data.seekg(0);
+    variant_reader reader(stream);
+
+    VARTYPE vt;
+    size_t count;
+    long lb;
+    reader.begin_array(vt, count, lb);
+    BOOST_CHECK_EQUAL(vt, VT_R8);
+    BOOST_REQUIRE_EQUAL(count, 1000U);
+    BOOST_CHECK_EQUAL(lb, 0);
+
+    variant_t v;
+    for (size_t i = 0; i < count; ++i)
+    {
+        reader.read(v);
+        BOOST_CHECK_EQUAL(v.get_vt(), VT_R8);
+        BOOST_CHECK_EQUAL(v.as_double(), double(i));
+    }
+    reader.end_array();
+}
+
+BOOST_AUTO_TEST_CASE( element_count_enforced )
+{
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    variant_writer writer(stream);
+    writer.begin_array(VT_I4, 1);
+    BOOST_CHECK_THROW(writer.end_array(), std::runtime_error);
+    writer.write(variant_t(1));
+    BOOST_CHECK_THROW(writer.write(variant_t(2)), std::runtime_error);
+    writer.end_array();
+}
+
+/**
+ * An array bigger than the reader allocates on trust arrives whole.
+ */
+BOOST_AUTO_TEST_CASE( large_array_round_trip )
+{
+    const size_t count = 3 * comet::impl::SERIALISE_TRUSTED_SIZE / 4 + 1;
+    safearray_t<long> longs(count, 0);
+    for (size_t i = 0; i < count; ++i)
+        longs[i] = static_cast<long>(i);
+
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    {
+        variant_writer writer(stream);
+        writer.write(longs);
+        writer.flush();
+    }
+
+    data.seekg(0);
+    variant_reader reader(stream);
+
+    safearray_t<long> result;
+    reader.read(result);
+    BOOST_REQUIRE_EQUAL(result.size(), count);
+    BOOST_CHECK_EQUAL(result[0], 0);
+    BOOST_CHECK_EQUAL(result[count - 1], static_cast<long>(count - 1));
+}
+
+/**
+ * A corrupt element count or string length runs into the end of the stream
+ * rather than allocating what it claims.
+ */
+BOOST_AUTO_TEST_CASE( corrupt_length_rejected )
+{
+    string bytes;
+    append_raw(bytes, static_cast<VARTYPE>(VT_ARRAY | VT_I4));
+    append_raw(bytes, static_cast<ULONG>(0xFFFFFFF0));
+    append_raw(bytes, static_cast<LONG>(0));
+    append_raw(bytes, static_cast<LONG>(1));
+
+    stringstream data(bytes);
+    com_ptr<IStream> stream = adapt_stream(data);
+    variant_t v;
+    BOOST_CHECK_THROW(variant_reader(stream).read(v), com_error);
+
+    bytes.clear();
+    append_raw(bytes, static_cast<VARTYPE>(VT_BSTR));
+    append_raw(bytes, static_cast<ULONG>(0xFFFFFFF0));
+    bytes += "short";
+
+    stringstream string_data(bytes);
+    stream = adapt_stream(string_data);
+    BOOST_CHECK_THROW(variant_reader(stream).read(v), com_error);
+}
+
+/**
+ * Arrays nested deeper than the reader allows are rejected.
+ */
+BOOST_AUTO_TEST_CASE( nesting_depth_limited )
+{
+    const size_t depth = comet::impl::SERIALISE_MAX_DEPTH + 1;
+
+    stringstream data;
+    com_ptr<IStream> stream = adapt_stream(data);
+
+    {
+        variant_writer writer(stream);
+        for (size_t i = 0; i < depth; ++i)
+            writer.begin_array(VT_VARIANT, 1);
+        writer.begin_array(VT_I4, 0);
+        for (size_t i = 0; i <= depth; ++i)
+            writer.end_array();
+        writer.flush();
+    }
+
+    data.seekg(0);
+    variant_t v;
+    BOOST_CHECK_THROW(variant_reader(stream).read(v), com_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
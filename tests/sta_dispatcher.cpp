@@ -0,0 +1,228 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/sta_dispatcher.h> // test subject
+
+#include <comet/git.h> // GIT, GIT_cookie
+#include <comet/ptr.h>
+#include <comet/server.h> // simple_object
+#include <comet/thread_pool.h> // thread_pool
+#include <comet/threading.h> // event, thread
+
+#include <exception> // terminate
+#include <memory> // auto_ptr
+
+using comet::com_ptr;
+using comet::event;
+using comet::future;
+using comet::GIT;
+using comet::GIT_cookie;
+using comet::nil;
+using comet::simple_object;
+using comet::sta_dispatcher;
+using comet::thread;
+using comet::thread_pool;
+
+namespace {
+
+    class test_object : public simple_object<nil> {};
+
+    /// STA thread that owns a dispatcher and an object until told to quit.
+    class sta_thread : public thread
+    {
+    public:
+        sta_thread() : object_(0) {}
+
+        sta_dispatcher* dispatcher;
+        GIT_cookie<IUnknown> cookie;
+        event ready;
+
+        IUnknown* object() const { return object_; }
+
+    private:
+        DWORD thread_main()
+        {
+            ::CoInitializeEx(0, COINIT_APARTMENTTHREADED);
+            {
+                GIT git;
+                com_ptr<IUnknown> object = new test_object();
+                object_ = object.raw();
+                cookie = git.register_interface(object);
+
+                std::auto_ptr<sta_dispatcher> owned(new sta_dispatcher());
+                dispatcher = owned.get();
+                ready.set();
+
+                MSG msg;
+                while (::GetMessage(&msg, 0, 0, 0) > 0)
+                {
+                    ::TranslateMessage(&msg);
+                    ::DispatchMessage(&msg);
+                }
+
+                owned.reset();
+                git.revoke_interface(cookie);
+            }
+            ::CoUninitialize();
+            return 0;
+        }
+
+        IUnknown* object_;
+    };
+
+    struct current_thread
+    {
+        DWORD operator()() const { return ::GetCurrentThreadId(); }
+    };
+
+    struct object_address
+    {
+        IUnknown* operator()(IUnknown* object) const { return object; }
+    };
+
+    struct quit
+    {
+        void operator()() const { ::PostQuitMessage(0); }
+    };
+
+#ifdef COMET_COROUTINES
+    /// Coroutine that runs to completion with nobody waiting for it.
+    struct detached
+    {
+        struct promise_type
+        {
+            detached get_return_object() { return detached(); }
+            std::suspend_never initial_suspend() { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    /// Where an awaiting coroutine resumed and what it was given.
+    struct resumption
+    {
+        resumption() : thread_id(0), value(0) {}
+
+        DWORD thread_id;
+        int value;
+        event done;
+    };
+
+    detached await_and_record(future<int> result, resumption* resumed)
+    {
+        resumed->value = co_await result;
+        resumed->thread_id = ::GetCurrentThreadId();
+        resumed->done.set();
+    }
+
+    /// Returns 42 once the gate opens.
+    struct gated_value
+    {
+        explicit gated_value(event* gate) : gate(gate) {}
+
+        int operator()() const
+        {
+            gate->wait(5000);
+            return 42;
+        }
+
+        event* gate;
+    };
+
+    /// Starts a coroutine awaiting `result` on the calling thread.
+    struct start_awaiting
+    {
+        start_awaiting(const future<int>& result, resumption* resumed)
+            : result(result), resumed(resumed) {}
+
+        DWORD operator()() const
+        {
+            await_and_record(result, resumed);
+            return ::GetCurrentThreadId();
+        }
+
+        future<int> result;
+        resumption* resumed;
+    };
+#endif
+}
+
+BOOST_AUTO_TEST_SUITE( sta_dispatcher_tests )
+
+BOOST_AUTO_TEST_CASE( calls_run_in_apartment )
+{
+    sta_thread sta;
+    sta.start();
+    BOOST_REQUIRE(sta.ready.wait(5000));
+
+    future<DWORD> id = sta.dispatcher->post<DWORD>(current_thread());
+    future<IUnknown*> address =
+        sta.dispatcher->invoke<IUnknown*>(sta.cookie, object_address());
+
+    BOOST_REQUIRE(id.wait(5000));
+    BOOST_CHECK_EQUAL(id.get(), ::GetThreadId(sta.handle()));
+
+    // In its own apartment the GIT gives back the object, not a proxy
+    BOOST_REQUIRE(address.wait(5000));
+    BOOST_CHECK_EQUAL(address.get(), sta.object());
+
+    sta.dispatcher->post<void>(quit());
+    BOOST_CHECK(sta.wait(5000));
+}
+
+#ifdef COMET_COROUTINES
+
+/**
+ * A coroutine awaiting on an STA thread resumes on that thread.
+ */
+BOOST_AUTO_TEST_CASE( await_on_sta_resumes_on_sta )
+{
+    sta_thread sta;
+    sta.start();
+    BOOST_REQUIRE(sta.ready.wait(5000));
+
+    thread_pool pool(1);
+    event gate;
+    resumption resumed;
+    future<int> value = pool.submit<int>(gated_value(&gate));
+
+    future<DWORD> started =
+        sta.dispatcher->post<DWORD>(start_awaiting(value, &resumed));
+    BOOST_REQUIRE(started.wait(5000));
+    BOOST_CHECK(!resumed.done.is_set());
+
+    gate.set();
+    BOOST_REQUIRE(resumed.done.wait(5000));
+    BOOST_CHECK_EQUAL(resumed.value, 42);
+    BOOST_CHECK_EQUAL(resumed.thread_id, started.get());
+
+    sta.dispatcher->post<void>(quit());
+    BOOST_CHECK(sta.wait(5000));
+}
+
+/**
+ * A coroutine awaiting on an MTA thread resumes on a thread-pool thread,
+ * not the one that awaited.
+ */
+BOOST_AUTO_TEST_CASE( await_on_mta_resumes_on_pool_thread )
+{
+    thread_pool mta(1);
+    thread_pool pool(1);
+    event gate;
+    resumption resumed;
+    future<int> value = pool.submit<int>(gated_value(&gate));
+
+    future<DWORD> started =
+        mta.submit<DWORD>(start_awaiting(value, &resumed));
+    BOOST_REQUIRE(started.wait(5000));
+
+    gate.set();
+    BOOST_REQUIRE(resumed.done.wait(5000));
+    BOOST_CHECK_EQUAL(resumed.value, 42);
+    BOOST_CHECK(resumed.thread_id != started.get());
+}
+
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,7 @@
 
 #include <comet/error.h> // com_error_from_interface
 #include <comet/ptr.h>   // com_ptr
+#include <comet/server.h> // simple_object
 
 #include <cstdio> // tmpnam, remove
 #include <exception>
@@ -40,9 +41,12 @@ using boost::shared_ptr;
 using boost::test_tools::predicate_result;
 
 using comet::adapt_stream;
+using comet::adapt_stream_buffered;
 using comet::adapt_stream_pointer;
 using comet::com_ptr;
 using comet::com_error_from_interface;
+using comet::comtype;
+using comet::simple_object;
 
 using std::auto_ptr;
 using std::exception;
@@ -671,6 +675,151 @@ BOOST_AUTO_TEST_CASE(write_to_stl_ostream_error_buffered)
     BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gob");
 }
 
+// A buffered adapter leaves writes in the stream's buffer until the bytes
+// written since the last flush reach the threshold.
+BOOST_AUTO_TEST_CASE(write_buffered_flushes_at_threshold)
+{
+    mock_streambuf buf(400);
+
+    ostream stl_stream(&buf);
+
+    com_ptr<IStream> s = adapt_stream_buffered(stl_stream, 8);
+
+    ULONG count = 99;
+    BOOST_CHECK(is_s_ok(s->Write("gob", 3, &count), s));
+    BOOST_CHECK_EQUAL(count, 3U);
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "");
+
+    BOOST_CHECK(is_s_ok(s->Write("beldy", 5, &count), s));
+    BOOST_CHECK_EQUAL(count, 5U);
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gobbeldy");
+}
+
+BOOST_AUTO_TEST_CASE(write_buffered_flushes_on_commit)
+{
+    mock_streambuf buf(400);
+
+    ostream stl_stream(&buf);
+
+    com_ptr<IStream> s = adapt_stream_buffered(stl_stream);
+
+    string data("gobbeldy gook");
+    ULONG count = 99;
+    BOOST_CHECK(is_s_ok(
+        s->Write(&data[0], static_cast<ULONG>(data.size()), &count), s));
+    BOOST_CHECK_EQUAL(count, data.size());
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "");
+
+    BOOST_CHECK(is_s_ok(s->Commit(STGC_DEFAULT), s));
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gobbeldy gook");
+}
+
+BOOST_AUTO_TEST_CASE(write_buffered_flushes_on_release)
+{
+    mock_streambuf buf(400);
+
+    ostream stl_stream(&buf);
+
+    {
+        com_ptr<IStream> s = adapt_stream_buffered(stl_stream);
+
+        string data("gobbeldy gook");
+        ULONG count = 99;
+        BOOST_CHECK(is_s_ok(
+            s->Write(&data[0], static_cast<ULONG>(data.size()), &count), s));
+
+        BOOST_CHECK_EQUAL(buf.controlled_sequence(), "");
+    }
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gobbeldy gook");
+}
+
+// An error writing out buffered data is reported by the Write that flushes,
+// exactly as an unbuffered adapter reports it.
+BOOST_AUTO_TEST_CASE(write_buffered_error_at_threshold)
+{
+    mock_streambuf buf(400);
+    buf.mock_behaviour_write_fails_after(3);
+    buf.mock_behaviour_failure_type(mock_streambuf::return_eof);
+
+    ostream stl_stream(&buf);
+
+    com_ptr<IStream> s = adapt_stream_buffered(stl_stream, 8);
+
+    ULONG count = 99;
+    BOOST_CHECK(is_s_ok(s->Write("gob", 3, &count), s));
+    BOOST_CHECK_EQUAL(count, 3U);
+
+    count = 99;
+    BOOST_CHECK(has_hresult(s->Write("beldy", 5, &count), s, STG_E_MEDIUMFULL));
+
+    // Stream unable to return exact written count
+    BOOST_CHECK_EQUAL(count, 0U);
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gob");
+}
+
+BOOST_AUTO_TEST_CASE(write_buffered_error_on_commit)
+{
+    mock_streambuf buf(400);
+    buf.mock_behaviour_write_fails_after(3);
+    buf.mock_behaviour_failure_type(mock_streambuf::throw_exception);
+
+    ostream stl_stream(&buf);
+
+    com_ptr<IStream> s = adapt_stream_buffered(stl_stream);
+
+    string data("gobbeldy gook");
+    ULONG count = 99;
+    BOOST_CHECK(is_s_ok(
+        s->Write(&data[0], static_cast<ULONG>(data.size()), &count), s));
+
+    BOOST_CHECK(FAILED(s->Commit(STGC_DEFAULT)));
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gob");
+}
+
+/**
+ * Write throughput to a file in 4 KB chunks, flushing each chunk against
+ * buffering them.
+ *
+ * Timings depend on the machine so are only reported, not checked.
+ */
+BOOST_AUTO_TEST_CASE(write_buffered_throughput)
+{
+    const ULONG chunk_size = 4096;
+    const int chunk_count = 4096;
+    const vector<char> chunk(chunk_size, 'x');
+
+    DWORD timings[2];
+    for (int buffered = 0; buffered < 2; ++buffered)
+    {
+        test_output_stream stl_stream = output_stream();
+
+        com_ptr<IStream> s = (buffered) ? adapt_stream_buffered(stl_stream)
+                                        : adapt_stream(stl_stream);
+
+        DWORD start = ::GetTickCount();
+        for (int i = 0; i < chunk_count; ++i)
+        {
+            ULONG count;
+            BOOST_REQUIRE(is_s_ok(s->Write(&chunk[0], chunk_size, &count), s));
+        }
+        BOOST_REQUIRE(is_s_ok(s->Commit(STGC_DEFAULT), s));
+        timings[buffered] = ::GetTickCount() - start;
+    }
+
+    BOOST_TEST_MESSAGE(chunk_count << " writes of " << chunk_size
+                                   << " bytes to std::ofstream: adapt_stream "
+                                   << timings[0]
+                                   << "ms, adapt_stream_buffered "
+                                   << timings[1] << "ms");
+}
+
 BOOST_AUTO_TEST_CASE(read_then_write_stl_stream)
 {
     string data = "gobbeldy gook";
@@ -1245,6 +1394,160 @@ BOOST_AUTO_TEST_CASE(copy_ostream)
     BOOST_CHECK_EQUAL(dest.str(), string());
 }
 
+/**
+ * Stream in front of an adapter whose Write fails and counts its calls.
+ *
+ * Offers the adapter's direct access to its C++ stream, so a copy that
+ * uses that instead of Write still reaches the adapter.
+ */
+class write_refusing_stream : public simple_object<IStream>
+{
+public:
+    explicit write_refusing_stream(const com_ptr<IStream>& adapter)
+        : m_adapter(adapter), m_writes(0)
+    {}
+
+    long writes() const
+    {
+        return m_writes;
+    }
+
+    STDMETHOD(QueryInterface)(REFIID riid, void** ppv)
+    {
+        if (riid == comtype<comet::impl::stream_splice_target>::uuid())
+        {
+            return m_adapter->QueryInterface(riid, ppv);
+        }
+        return simple_object<IStream>::QueryInterface(riid, ppv);
+    }
+
+    STDMETHOD(Read)(void*, ULONG, ULONG*) { return E_NOTIMPL; }
+
+    STDMETHOD(Write)(const void*, ULONG, ULONG* written)
+    {
+        ++m_writes;
+        if (written)
+        {
+            *written = 0U;
+        }
+        return STG_E_ACCESSDENIED;
+    }
+
+    STDMETHOD(Seek)(LARGE_INTEGER, DWORD, ULARGE_INTEGER*)
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(SetSize)(ULARGE_INTEGER) { return E_NOTIMPL; }
+
+    STDMETHOD(CopyTo)(
+        IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER*)
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(Commit)(DWORD) { return E_NOTIMPL; }
+    STDMETHOD(Revert)() { return E_NOTIMPL; }
+
+    STDMETHOD(LockRegion)(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(UnlockRegion)(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(Stat)(STATSTG*, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(Clone)(IStream**) { return E_NOTIMPL; }
+
+private:
+    com_ptr<IStream> m_adapter;
+    long m_writes;
+};
+
+// Copying to an adapter held by pointer also moves the bytes directly
+// between the C++ streams, never calling the destination's Write.
+BOOST_AUTO_TEST_CASE(copy_to_adapted_stream_pointer)
+{
+    string data = large_data();
+
+    test_input_stream source = input_stream(data);
+    shared_ptr<ostringstream> dest(new ostringstream);
+
+    com_ptr<IStream> s = adapt_stream(source);
+    write_refusing_stream* refusing =
+        new write_refusing_stream(adapt_stream_pointer(dest));
+    com_ptr<IStream> d = refusing;
+
+    ULARGE_INTEGER amount;
+    amount.QuadPart = static_cast<ULONGLONG>(data.size());
+    ULARGE_INTEGER bytes_read = {0};
+    ULARGE_INTEGER bytes_written = {0};
+    BOOST_CHECK(
+        is_s_ok(s->CopyTo(d.in(), amount, &bytes_read, &bytes_written), s));
+    BOOST_CHECK_EQUAL(bytes_read.QuadPart, data.size());
+    BOOST_CHECK_EQUAL(bytes_written.QuadPart, data.size());
+
+    check_read_to_end(s, string());
+
+    BOOST_CHECK_EQUAL(dest->str(), data);
+    BOOST_CHECK_EQUAL(refusing->writes(), 0);
+}
+
+// Copying to a stream that is not an adapter goes through its Write method
+BOOST_AUTO_TEST_CASE(copy_to_other_stream)
+{
+    string data = large_data();
+
+    test_input_stream source = input_stream(data);
+
+    com_ptr<IStream> s = adapt_stream(source);
+    com_ptr<IStream> d;
+    BOOST_REQUIRE(SUCCEEDED(::CreateStreamOnHGlobal(NULL, TRUE, d.out())));
+
+    ULARGE_INTEGER amount;
+    amount.QuadPart = static_cast<ULONGLONG>(data.size());
+    ULARGE_INTEGER bytes_read = {0};
+    ULARGE_INTEGER bytes_written = {0};
+    BOOST_CHECK(
+        is_s_ok(s->CopyTo(d.in(), amount, &bytes_read, &bytes_written), s));
+    BOOST_CHECK_EQUAL(bytes_read.QuadPart, data.size());
+    BOOST_CHECK_EQUAL(bytes_written.QuadPart, data.size());
+
+    LARGE_INTEGER start = {0};
+    BOOST_REQUIRE(is_s_ok(d->Seek(start, STREAM_SEEK_SET, NULL), d));
+    check_read_to_end(d, data);
+}
+
+// A destination adapter failing to write fails the copy as its Write would
+BOOST_AUTO_TEST_CASE(copy_to_failing_adapter)
+{
+    test_input_stream source = input_stream("gobbeldy gook");
+
+    mock_streambuf buf(0);
+    buf.mock_behaviour_write_fails_after(3);
+    buf.mock_behaviour_failure_type(mock_streambuf::return_eof);
+
+    ostream dest(&buf);
+
+    com_ptr<IStream> s = adapt_stream(source);
+    com_ptr<IStream> d = adapt_stream(dest);
+
+    ULARGE_INTEGER amount = {13};
+    ULARGE_INTEGER bytes_read = {0};
+    ULARGE_INTEGER bytes_written = {99};
+    BOOST_CHECK(has_hresult(
+        s->CopyTo(d.in(), amount, &bytes_read, &bytes_written), s,
+        STG_E_MEDIUMFULL));
+
+    // Stream unable to return exact written count
+    BOOST_CHECK_EQUAL(bytes_written.QuadPart, 0U);
+
+    BOOST_CHECK_EQUAL(buf.controlled_sequence(), "gob");
+}
+
 BOOST_AUTO_TEST_CASE(commit_inout)
 {
     test_io_stream stl_stream = io_stream("abcd");
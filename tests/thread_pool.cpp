@@ -0,0 +1,168 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/thread_pool.h> // test subject
+
+#include <comet/error.h> // com_error
+
+#include <stdexcept> // runtime_error
+#include <vector>
+
+using comet::com_error;
+using comet::future;
+using comet::pool_apartment_none;
+using comet::pool_apartment_sta;
+using comet::thread_pool;
+
+using std::vector;
+
+namespace {
+
+    struct square
+    {
+        explicit square(long value) : value(value) {}
+        long operator()() const { return value * value; }
+        long value;
+    };
+
+    struct fail_with_com_error
+    {
+        long operator()() const { throw com_error(E_ACCESSDENIED); }
+    };
+
+    struct fail_with_exception
+    {
+        void operator()() const { throw std::runtime_error("task failed"); }
+    };
+
+    /// Notes the thread it ran on, in the next free slot.
+    struct record_thread
+    {
+        record_thread(volatile long* counter, DWORD* threads)
+            : counter(counter), threads(threads) {}
+
+        void operator()() const
+        {
+            threads[::InterlockedIncrement(counter) - 1] =
+                ::GetCurrentThreadId();
+        }
+
+        volatile long* counter;
+        DWORD* threads;
+    };
+
+    /**
+     * Submits children to its own worker's queue, then blocks the worker
+     * until they have all run, so only the other workers can run them.
+     * Gives up after five seconds.
+     */
+    struct spawn_and_block
+    {
+        spawn_and_block(
+            thread_pool& pool, volatile long* counter, DWORD* threads,
+            long count)
+            : pool(&pool), counter(counter), threads(threads), count(count)
+        {}
+
+        DWORD operator()() const
+        {
+            for (long i = 0; i < count; ++i)
+                pool->submit<void>(record_thread(counter, threads));
+
+            DWORD start = ::GetTickCount();
+            while (*counter < count && ::GetTickCount() - start < 5000)
+                ::Sleep(1);
+
+            return ::GetCurrentThreadId();
+        }
+
+        thread_pool* pool;
+        volatile long* counter;
+        DWORD* threads;
+        long count;
+    };
+
+    /// Reports which apartment, if any, the worker is in.
+    struct probe_apartment
+    {
+        HRESULT operator()() const
+        {
+            HRESULT hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
+            if (SUCCEEDED(hr))
+                ::CoUninitialize();
+            return hr;
+        }
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( thread_pool_tests )
+
+BOOST_AUTO_TEST_CASE( results )
+{
+    thread_pool pool(4);
+
+    vector< future<long> > results;
+    for (long i = 0; i < 100; ++i)
+        results.push_back(pool.submit<long>(square(i)));
+
+    for (long i = 0; i < 100; ++i)
+        BOOST_CHECK_EQUAL(results[i].get(), i * i);
+}
+
+BOOST_AUTO_TEST_CASE( exceptions )
+{
+    thread_pool pool(2);
+
+    future<long> com_failure = pool.submit<long>(fail_with_com_error());
+    future<void> failure = pool.submit<void>(fail_with_exception());
+
+    try
+    {
+        com_failure.get();
+        BOOST_ERROR("com_error not rethrown");
+    }
+    catch (const com_error& e)
+    {
+        BOOST_CHECK_EQUAL(e.hr(), E_ACCESSDENIED);
+    }
+
+    BOOST_CHECK_THROW(failure.get(), std::runtime_error);
+}
+
+/**
+ * Tasks queued by a worker that then blocks are run by the other workers.
+ */
+BOOST_AUTO_TEST_CASE( stealing )
+{
+    const long count = 1000;
+    volatile long counter = 0;
+    vector<DWORD> threads(count);
+
+    DWORD parent;
+    {
+        thread_pool pool(4);
+        parent = pool.submit<DWORD>(
+            spawn_and_block(pool, &counter, &threads[0], count)).get();
+        // Destruction waits for the last child to note its thread
+    }
+
+    // Without stealing the children would still be waiting for the parent
+    BOOST_REQUIRE_EQUAL(counter, count);
+    for (long i = 0; i < count; ++i)
+    {
+        BOOST_CHECK(threads[i] != 0);
+        BOOST_CHECK(threads[i] != parent);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( apartments )
+{
+    thread_pool sta_pool(2, pool_apartment_sta);
+    BOOST_CHECK_EQUAL(
+        sta_pool.submit<HRESULT>(probe_apartment()).get(), RPC_E_CHANGED_MODE);
+
+    thread_pool plain_pool(2, pool_apartment_none);
+    BOOST_CHECK(SUCCEEDED(plain_pool.submit<HRESULT>(probe_apartment()).get()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
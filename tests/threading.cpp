@@ -1,14 +1,82 @@
+#include <boost/mpl/vector.hpp>
 #include <boost/test/unit_test.hpp>
 
 #define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/distributed_rw_lock.h> // distributed_rw_lock, auto_distributed_*
 #include <comet/lw_lock.h> // lw_lock, auto_reader_lock, auto_writer_lock
 #include <comet/threading.h> // thread
 
+#include <vector>
+
+using comet::auto_distributed_reader_lock;
+using comet::auto_distributed_writer_lock;
 using comet::auto_reader_lock;
 using comet::auto_writer_lock;
+using comet::distributed_rw_lock;
 using comet::lw_lock;
 using comet::thread;
 
+namespace {
+
+    /// Scoped guards for each kind of lock.
+    template<typename Lock> struct lock_guards;
+
+    template<> struct lock_guards<lw_lock>
+    {
+        typedef auto_reader_lock reader;
+        typedef auto_writer_lock writer;
+    };
+
+    template<> struct lock_guards<distributed_rw_lock>
+    {
+        typedef auto_distributed_reader_lock reader;
+        typedef auto_distributed_writer_lock writer;
+    };
+
+    template<typename Lock, typename ReaderLock>
+    class reader_thread : public thread
+    {
+    public:
+        reader_thread(const Lock& lock, long iterations)
+            : lock_(lock), iterations_(iterations)
+        {}
+
+    private:
+        DWORD thread_main()
+        {
+            for (long i = 0; i < iterations_; ++i)
+            {
+                ReaderLock rl(lock_);
+            }
+            return 0;
+        }
+
+        const Lock& lock_;
+        long iterations_;
+    };
+
+    /// Milliseconds for `thread_count` threads to take a read lock
+    /// `iterations` times each.
+    template<typename Lock, typename ReaderLock>
+    DWORD time_readers(const Lock& lock, int thread_count, long iterations)
+    {
+        std::vector<reader_thread<Lock, ReaderLock>*> readers;
+        for (int i = 0; i < thread_count; ++i)
+            readers.push_back(
+                new reader_thread<Lock, ReaderLock>(lock, iterations));
+
+        DWORD start = ::GetTickCount();
+        for (int i = 0; i < thread_count; ++i)
+            readers[i]->start();
+        for (int i = 0; i < thread_count; ++i)
+        {
+            BOOST_CHECK(readers[i]->wait(60000));
+            delete readers[i];
+        }
+        return ::GetTickCount() - start;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE( threading_tests )
 
 BOOST_AUTO_TEST_CASE( lock )
@@ -42,4 +110,97 @@ BOOST_AUTO_TEST_CASE( lock )
         throw std::runtime_error("class thread is broken");
 }
 
+typedef boost::mpl::vector<lw_lock, distributed_rw_lock> rw_locks;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE( lock_contention, Lock, rw_locks )
+{
+    // Writers keep two counters equal; readers must never see them differ
+    struct shared_state
+    {
+        shared_state() : first(0), second(0), mismatches(0) {}
+
+        Lock lock;
+        long first;
+        long second;
+        long volatile mismatches;
+    };
+
+    struct Worker : public thread
+    {
+        shared_state& state_;
+        bool writer_;
+
+        Worker(shared_state& state, bool writer)
+            : state_(state), writer_(writer)
+        {}
+
+        DWORD thread_main()
+        {
+            for (int i = 0; i < 20000; ++i)
+            {
+                if (writer_)
+                {
+                    typename lock_guards<Lock>::writer awl(state_.lock);
+                    ++state_.first;
+                    ++state_.second;
+                }
+                else
+                {
+                    typename lock_guards<Lock>::reader arl(state_.lock);
+                    if (state_.first != state_.second)
+                        InterlockedIncrement(&state_.mismatches);
+                }
+            }
+            return 0;
+        }
+    };
+
+    shared_state state;
+
+    const int thread_count = 8;
+    Worker* workers[thread_count];
+    for (int i = 0; i < thread_count; ++i)
+    {
+        workers[i] = new Worker(state, i % 4 == 0);
+        workers[i]->start();
+    }
+
+    for (int i = 0; i < thread_count; ++i)
+    {
+        BOOST_CHECK(workers[i]->wait(30000));
+        delete workers[i];
+    }
+
+    BOOST_CHECK_EQUAL(state.mismatches, 0);
+    BOOST_CHECK_EQUAL(state.first, 2 * 20000);
+    BOOST_CHECK_EQUAL(state.second, 2 * 20000);
+}
+
+/**
+ * Read-mostly throughput of lw_lock against distributed_rw_lock.
+ *
+ * Timings depend on the machine so are only reported, not checked.
+ */
+BOOST_AUTO_TEST_CASE( reader_scaling )
+{
+    const long iterations = 200000;
+
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        lw_lock single;
+        distributed_rw_lock distributed;
+
+        DWORD single_ms = time_readers<lw_lock, auto_reader_lock>(
+            single, threads, iterations);
+        DWORD distributed_ms = time_readers<
+            distributed_rw_lock, auto_distributed_reader_lock>(
+                distributed, threads, iterations);
+
+        BOOST_TEST_MESSAGE(
+            threads << " reader thread(s), " << iterations
+            << " reads each: lw_lock " << single_ms
+            << "ms, distributed_rw_lock " << distributed_ms << "ms");
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -3,11 +3,18 @@
 
 #define COMET_ASSERT_THROWS_ALWAYS
 #include <comet/bstr.h>
+#include <comet/datetime.h>
+#include <comet/error.h>
 #include <comet/variant.h>
 
+#include <algorithm> // replace
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 using comet::bstr_t;
+using comet::com_error;
+using comet::datetime_t;
 using comet::variant_t;
 
 using std::runtime_error;
@@ -230,4 +237,152 @@ BOOST_AUTO_TEST_CASE_TEMPLATE( variant_numeric_conversion, T, numeric_types )
     expect_greater_than(T(1), T(0));
 }
 
+BOOST_AUTO_TEST_CASE( inline_numeric_conversion )
+{
+    BOOST_CHECK_EQUAL(variant_t(short(5)).as_longlong(), 5);
+    BOOST_CHECK_EQUAL(variant_t(7).as_double(), 7.0);
+    BOOST_CHECK_EQUAL(variant_t(true).as_int(), -1);
+    BOOST_CHECK_EQUAL(variant_t().as_int(), 0);
+    BOOST_CHECK(!static_cast<bool>(variant_t(0.0)));
+    BOOST_CHECK(static_cast<bool>(variant_t(2)));
+
+    // Rounding matches VariantChangeTypeEx: half to even
+    BOOST_CHECK_EQUAL(variant_t(2.5).as_int(), 2);
+    BOOST_CHECK_EQUAL(variant_t(3.5).as_int(), 4);
+    BOOST_CHECK_EQUAL(variant_t(-2.5).as_int(), -2);
+    BOOST_CHECK_EQUAL(variant_t(2.6).as_short(), 3);
+
+    // Values that don't fit still report overflow
+    BOOST_CHECK_THROW(variant_t(300).as_uchar(), com_error);
+    BOOST_CHECK_THROW(variant_t(-1).as_uint(), com_error);
+    BOOST_CHECK_THROW(variant_t(1e300).as_longlong(), com_error);
+    BOOST_CHECK_THROW(variant_t(1e300).as_float(), com_error);
+}
+
+namespace {
+
+    /// Convert the slow way for comparison.
+    template<typename T>
+    T ole_convert(const wchar_t* text, VARTYPE vt, T (*get)(const VARIANT&))
+    {
+        VARIANT in = variant_t(text).detach();
+        VARIANT out;
+        ::VariantInit(&out);
+        HRESULT hr = ::VariantChangeTypeEx(
+            &out, &in, ::GetThreadLocale(), 0, vt);
+        BOOST_REQUIRE(SUCCEEDED(hr));
+        T result = get(out);
+        ::VariantClear(&out);
+        ::VariantClear(&in);
+        return result;
+    }
+
+    long get_i4(const VARIANT& v) { return V_I4(&v); }
+    LONGLONG get_i8(const VARIANT& v) { return V_I8(&v); }
+    double get_r8(const VARIANT& v) { return V_R8(&v); }
+    LONGLONG get_cy(const VARIANT& v) { return V_CY(&v).int64; }
+    DATE get_date(const VARIANT& v) { return V_DATE(&v); }
+}
+
+BOOST_AUTO_TEST_CASE( inline_string_conversion )
+{
+    wchar_t decimal[4];
+    ::GetLocaleInfoW(::GetThreadLocale(), LOCALE_SDECIMAL, decimal, 4);
+
+    const wchar_t* integers[] = {
+        L"0", L"7", L"-7", L"42", L"2147483647", L"-2147483648",
+        L"0012", L"9223372036854775807", L"-9223372036854775808" };
+    for (size_t i = 0; i < sizeof(integers) / sizeof(integers[0]); ++i)
+    {
+        BOOST_CHECK_EQUAL(
+            variant_t(integers[i]).as_longlong(),
+            ole_convert(integers[i], VT_I8, get_i8));
+        BOOST_CHECK_EQUAL(
+            variant_t(integers[i]).as_double(),
+            ole_convert(integers[i], VT_R8, get_r8));
+        BOOST_CHECK_EQUAL(
+            variant_t(integers[i]).as_curency().get().int64,
+            ole_convert(integers[i], VT_CY, get_cy));
+    }
+
+    BOOST_CHECK_EQUAL(variant_t(L"-123").as_int(), -123);
+    BOOST_CHECK_THROW(variant_t(L"2147483648").as_int(), com_error);
+    BOOST_CHECK_THROW(variant_t(L"-1").as_uint(), com_error);
+
+    const wchar_t* reals[] = {
+        L"0.5", L"-0.25", L"3.14159", L"1e10", L"2.5E-3", L"123456.789",
+        L"0.1", L"9007199254740993", L"1e300" };
+    for (size_t i = 0; i < sizeof(reals) / sizeof(reals[0]); ++i)
+    {
+        std::wstring text(reals[i]);
+        std::replace(text.begin(), text.end(), L'.', decimal[0]);
+        BOOST_CHECK_EQUAL(
+            variant_t(text.c_str()).as_double(),
+            ole_convert(text.c_str(), VT_R8, get_r8));
+    }
+
+    // Fractions need rounding to an integer; OLE still handles them
+    std::wstring two_and_a_half(L"2.5");
+    std::replace(
+        two_and_a_half.begin(), two_and_a_half.end(), L'.', decimal[0]);
+    BOOST_CHECK_EQUAL(
+        variant_t(two_and_a_half.c_str()).as_int(),
+        ole_convert(two_and_a_half.c_str(), VT_I4, get_i4));
+
+    const wchar_t* currencies[] = { L"1.2345", L"-99.5", L"1.23456" };
+    for (size_t i = 0; i < sizeof(currencies) / sizeof(currencies[0]); ++i)
+    {
+        std::wstring text(currencies[i]);
+        std::replace(text.begin(), text.end(), L'.', decimal[0]);
+        BOOST_CHECK_EQUAL(
+            variant_t(text.c_str()).as_curency().get().int64,
+            ole_convert(text.c_str(), VT_CY, get_cy));
+    }
+
+    const wchar_t* dates[] = {
+        L"2024-02-29", L"1999-12-31 23:59:59", L"1899-12-30 06:00",
+        L"1850-06-15 12:00:00" };
+    for (size_t i = 0; i < sizeof(dates) / sizeof(dates[0]); ++i)
+    {
+        BOOST_CHECK_EQUAL(
+            datetime_t(variant_t(dates[i])).get(),
+            ole_convert(dates[i], VT_DATE, get_date));
+    }
+
+    // Not a real date, so the inline parser must leave it to OLE
+    BOOST_CHECK_THROW(datetime_t(variant_t(L"2023-02-29")), com_error);
+
+    // Anything unusual also goes to OLE
+    BOOST_CHECK_EQUAL(variant_t(L" 12").as_int(), 12);
+    BOOST_CHECK_THROW(variant_t(L"twelve").as_int(), com_error);
+}
+
+BOOST_AUTO_TEST_CASE( plain_data_copy )
+{
+    std::vector<variant_t> values;
+    values.push_back(variant_t(42));
+    values.push_back(variant_t(2.5));
+    values.push_back(variant_t(L"owned"));
+    values.push_back(variant_t::null());
+    values.push_back(variant_t(variant_t(L"123").as_decimal()));
+
+    std::vector<variant_t> copies(values);
+    BOOST_REQUIRE_EQUAL(copies.size(), values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(copies[i].get_vt(), values[i].get_vt());
+        BOOST_CHECK(copies[i] == values[i]);
+    }
+
+    // The string is still deep-copied
+    values[2] = L"changed";
+    BOOST_CHECK(copies[2] == L"owned");
+
+    // Reassigning across plain and owning types
+    copies[0] = copies[2];
+    copies[2] = 7;
+    BOOST_CHECK(copies[0] == L"owned");
+    BOOST_CHECK_EQUAL(copies[2].as_int(), 7);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
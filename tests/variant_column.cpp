@@ -0,0 +1,112 @@
+#include <boost/test/unit_test.hpp>
+
+#define COMET_ASSERT_THROWS_ALWAYS
+#include <comet/variant_column.h> // test subject
+
+#include <comet/bstr.h>
+#include <comet/safearray.h>
+#include <comet/variant.h>
+
+#include <vector>
+
+using comet::bstr_t;
+using comet::convert_column;
+using comet::safearray_t;
+using comet::variant_t;
+
+using std::vector;
+
+BOOST_AUTO_TEST_SUITE( variant_column_tests )
+
+BOOST_AUTO_TEST_CASE( uniform_column )
+{
+    safearray_t<variant_t> cells(1000, 1);
+    for (long i = 1; i <= 1000; ++i)
+        cells[i] = i * 0.5;
+
+    vector<double> values;
+    vector<bool> failed;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 0U);
+
+    BOOST_REQUIRE_EQUAL(values.size(), 1000U);
+    BOOST_REQUIRE_EQUAL(failed.size(), 1000U);
+    BOOST_CHECK_EQUAL(values[0], 0.5);
+    BOOST_CHECK_EQUAL(values[999], 500.0);
+    BOOST_CHECK(!failed[999]);
+}
+
+BOOST_AUTO_TEST_CASE( mixed_column )
+{
+    safearray_t<variant_t> cells(5, 0);
+    cells[0] = 42;
+    cells[1] = 2.5;
+    cells[2] = L"17";
+    cells[3] = L"not a number";
+    cells[4] = variant_t(true);
+
+    vector<LONGLONG> values;
+    vector<bool> failed;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 1U);
+
+    BOOST_REQUIRE_EQUAL(values.size(), 5U);
+    BOOST_CHECK_EQUAL(values[0], 42);
+    BOOST_CHECK_EQUAL(values[1], 2); // half to even
+    BOOST_CHECK_EQUAL(values[2], 17);
+    BOOST_CHECK(failed[3]);
+    BOOST_CHECK_EQUAL(values[3], 0);
+    BOOST_CHECK_EQUAL(values[4], -1);
+    BOOST_CHECK(!failed[0] && !failed[1] && !failed[2] && !failed[4]);
+}
+
+BOOST_AUTO_TEST_CASE( string_column )
+{
+    safearray_t<variant_t> cells(3, 0);
+    cells[0] = L"text";
+    cells[1] = 7;
+    cells[2] = variant_t(); // VT_EMPTY converts to ""
+
+    vector<bstr_t> values;
+    vector<bool> failed;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 0U);
+
+    BOOST_REQUIRE_EQUAL(values.size(), 3U);
+    BOOST_CHECK(values[0] == L"text");
+    BOOST_CHECK(values[1] == L"7");
+    BOOST_CHECK(values[2].is_empty());
+}
+
+/**
+ * Int columns take the uniform path for VT_I4 cells and convert the rest.
+ */
+BOOST_AUTO_TEST_CASE( int_column )
+{
+    safearray_t<variant_t> cells(2, 0);
+    cells[0] = L"17";
+    cells[1] = 42L;
+
+    vector<int> values;
+    vector<bool> failed;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 0U);
+
+    BOOST_REQUIRE_EQUAL(values.size(), 2U);
+    BOOST_CHECK_EQUAL(values[0], 17);
+    BOOST_CHECK_EQUAL(values[1], 42);
+
+    cells[0] = 7L;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 0U);
+    BOOST_CHECK_EQUAL(values[0], 7);
+    BOOST_CHECK_EQUAL(values[1], 42);
+}
+
+BOOST_AUTO_TEST_CASE( empty_array )
+{
+    safearray_t<variant_t> cells;
+
+    vector<double> values(3, 1.0);
+    vector<bool> failed;
+    BOOST_CHECK_EQUAL(convert_column(cells, values, failed), 0U);
+    BOOST_CHECK(values.empty());
+    BOOST_CHECK(failed.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()